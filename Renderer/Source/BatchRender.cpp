@@ -0,0 +1,243 @@
+//
+//  BatchRender.cpp
+//  HARDRender
+//
+
+#include "BatchRender.h"
+
+static const double MODEL_SAMPLE_RATE = 44100.0;
+
+struct BatchJob
+{
+    FileRenderOptions options;
+    int index = 0;
+};
+
+struct BatchStatistics
+{
+    std::atomic<int> numRendered{0};
+    std::atomic<int> numFailed{0};
+    std::atomic<juce::int64> numFramesRendered{0};
+    double audioSecondsRendered = 0.0;      // under printLock
+    juce::CriticalSection printLock;
+};
+
+static float getJobValue(const juce::var& job, const juce::var& defaults, const juce::Identifier& name, float defaultValue)
+{
+    if (job.hasProperty(name))
+    {
+        return juce::jlimit(0.0f, 1.0f, (float)job[name]);
+    }
+    if (defaults.hasProperty(name))
+    {
+        return juce::jlimit(0.0f, 1.0f, (float)defaults[name]);
+    }
+    return defaultValue;
+}
+
+static juce::File getJobFile(const juce::var& job, const juce::Identifier& name, const juce::File& baseDirectory)
+{
+    juce::String path = job[name].toString();
+    return path.isEmpty() ? juce::File() : baseDirectory.getChildFile(path);
+}
+
+static bool parseManifest(const juce::File& manifestFile, juce::Array<BatchJob>& jobs, juce::String& error)
+{
+    juce::var manifest;
+    juce::Result result = juce::JSON::parse(manifestFile.loadFileAsString(), manifest);
+    if (result.failed())
+    {
+        error = result.getErrorMessage();
+        return false;
+    }
+
+    juce::var defaults = manifest.isObject() ? manifest : juce::var();
+    const juce::Array<juce::var>* jobList = manifest.isArray() ? manifest.getArray() : manifest["jobs"].getArray();
+    if (jobList == nullptr)
+    {
+        error = "No \"jobs\" array";
+        return false;
+    }
+
+    const juce::File baseDirectory = manifestFile.getParentDirectory();
+    for (const auto& entry : *jobList)
+    {
+        BatchJob job;
+        job.index = jobs.size();
+        job.options.sourceFile = getJobFile(entry, "source", baseDirectory);
+        job.options.sidechainFile = getJobFile(entry, "sidechain", baseDirectory);
+        job.options.outputFile = getJobFile(entry, "output", baseDirectory);
+        if ((job.options.sourceFile == juce::File()) or (job.options.outputFile == juce::File()))
+        {
+            error = "Job " + juce::String(job.index) + " needs a \"source\" and an \"output\"";
+            return false;
+        }
+
+        RenderParameters& parameters = job.options.parameters;
+        parameters.harmony = getJobValue(entry, defaults, "harmony", parameters.harmony);
+        parameters.rhythm = getJobValue(entry, defaults, "rhythm", parameters.rhythm);
+        parameters.sourceGain = getJobValue(entry, defaults, "sourceGain", parameters.sourceGain);
+        parameters.sidechainGain = getJobValue(entry, defaults, "sidechainGain", parameters.sidechainGain);
+        jobs.add(job);
+    }
+    return true;
+}
+
+// One inference engine per worker, each with its own session and intra-op pool.
+// A session runs one inference at a time, so workers sharing one would queue on
+// it with a pool sized for a fraction of the cores. The sessions share their
+// prepacked weights through the environment.
+class EnginePool
+{
+public:
+    EnginePool(const ModelSource& modelSource, const MorpherModel::Options& modelOptions, std::shared_ptr<WindowCache> windowCache, int numEngines)
+    {
+        for (int i = 0; i < numEngines; i++)
+        {
+            auto model = std::make_shared<MorpherModel>(modelSource, modelOptions);
+            if (i == 0)
+            {
+                std::fprintf(stderr, "Loaded %s.\n", model->getLoadInfo().toString().toRawUTF8());
+            }
+            model->warmup(3);
+            engines.push_back(std::make_unique<ONNXMorpherInferenceThread>(model, false));
+            engines.back()->setWindowCache(windowCache);
+            freeEngines.add(engines.back().get());
+        }
+    }
+
+    ONNXMorpherInferenceThread* acquire()
+    {
+        const juce::ScopedLock lock(critical);
+        jassert(!freeEngines.isEmpty());
+        return freeEngines.removeAndReturn(freeEngines.size() - 1);
+    }
+
+    void release(ONNXMorpherInferenceThread* engine)
+    {
+        const juce::ScopedLock lock(critical);
+        freeEngines.add(engine);
+    }
+
+private:
+    juce::CriticalSection critical;
+    std::vector<std::unique_ptr<ONNXMorpherInferenceThread>> engines;
+    juce::Array<ONNXMorpherInferenceThread*> freeEngines;
+};
+
+class BatchRenderJob: public juce::ThreadPoolJob
+{
+public:
+    BatchRenderJob(const BatchJob& j, int total, EnginePool& pool, BatchStatistics& stats)
+    :juce::ThreadPoolJob("BatchRenderJob"), job(j), numJobs(total), enginePool(pool), statistics(stats)
+    {
+    }
+
+    JobStatus runJob() override
+    {
+        const juce::File target = job.options.outputFile;
+        target.getParentDirectory().createDirectory();
+
+        // Render next to the target and rename on success, so an existing output is always complete
+        juce::TemporaryFile temporary(target);
+        FileRenderOptions options = job.options;
+        options.outputFile = temporary.getFile();
+
+        ONNXMorpherInferenceThread* engine = enginePool.acquire();
+        juce::String error;
+        double sampleRate = MODEL_SAMPLE_RATE;
+        juce::uint32 startTime = juce::Time::getMillisecondCounter();
+        juce::int64 numFrames = runFileRender(*engine, options, error, &sampleRate);
+        double seconds = (juce::Time::getMillisecondCounter() - startTime)*0.001;
+        enginePool.release(engine);
+
+        if ((numFrames >= 0) and !temporary.overwriteTargetFileWithTemporary())
+        {
+            numFrames = -1;
+            error = "Could not move the result to " + target.getFullPathName();
+        }
+
+        const juce::ScopedLock lock(statistics.printLock);
+        if (numFrames < 0)
+        {
+            statistics.numFailed++;
+            std::fprintf(stderr, "[%d/%d] FAILED %s: %s\n", job.index+1, numJobs, target.getFileName().toRawUTF8(), error.toRawUTF8());
+        }
+        else
+        {
+            statistics.numRendered++;
+            statistics.numFramesRendered += numFrames;
+            statistics.audioSecondsRendered += numFrames/sampleRate;
+            std::fprintf(stderr, "[%d/%d] %s (%.1fs, %.1fx realtime)\n", job.index+1, numJobs, target.getFileName().toRawUTF8(),
+                         seconds, numFrames/sampleRate/juce::jmax(seconds, 0.001));
+        }
+        return jobHasFinished;
+    }
+
+private:
+    BatchJob job;
+    int numJobs;
+    EnginePool& enginePool;
+    BatchStatistics& statistics;
+};
+
+int runBatchRender(const ModelSource& modelSource, const BatchRenderOptions& options)
+{
+    juce::Array<BatchJob> jobs;
+    juce::String error;
+    if (!parseManifest(options.manifestFile, jobs, error))
+    {
+        std::fprintf(stderr, "Could not read %s: %s\n", options.manifestFile.getFullPathName().toRawUTF8(), error.toRawUTF8());
+        return -1;
+    }
+
+    juce::Array<BatchJob> pendingJobs;
+    for (const auto& job : jobs)
+    {
+        if (options.overwrite or !job.options.outputFile.existsAsFile())
+        {
+            pendingJobs.add(job);
+        }
+    }
+    int numSkipped = jobs.size() - pendingJobs.size();
+    if (pendingJobs.isEmpty())
+    {
+        std::fprintf(stderr, "All %d jobs already rendered.\n", jobs.size());
+        return 0;
+    }
+
+    int numJobThreads = juce::jlimit(1, pendingJobs.size(), options.numJobThreads);
+    OrtEnvironment::Options environmentOptions;
+    environmentOptions.sharedWeights = true;
+    MorpherModel::Options modelOptions;
+    modelOptions.environment = OrtEnvironment::getShared(environmentOptions);
+    modelOptions.intraOpThreads = options.intraOpThreads;
+    if (modelOptions.intraOpThreads <= 0)
+    {
+        modelOptions.intraOpThreads = juce::jmax(1, juce::SystemStats::getNumCpus()/numJobThreads);
+    }
+    std::fprintf(stderr, "%d jobs (%d already rendered), %d parallel jobs x %d intra-op threads.\n",
+                 jobs.size(), numSkipped, numJobThreads, modelOptions.intraOpThreads);
+
+    EnginePool enginePool(modelSource, modelOptions, options.windowCache, numJobThreads);
+    BatchStatistics statistics;
+
+    juce::uint32 startTime = juce::Time::getMillisecondCounter();
+    {
+        juce::ThreadPool pool(numJobThreads);
+        for (const auto& job : pendingJobs)
+        {
+            pool.addJob(new BatchRenderJob(job, jobs.size(), enginePool, statistics), true);
+        }
+        while (pool.getNumJobs() > 0)
+        {
+            juce::Thread::sleep(100);
+        }
+    }
+    double seconds = juce::jmax(0.001, (juce::Time::getMillisecondCounter() - startTime)*0.001);
+
+    double audioSeconds = statistics.audioSecondsRendered;
+    std::fprintf(stderr, "\nRendered %d, failed %d, skipped %d in %.1fs\n", (int)statistics.numRendered, (int)statistics.numFailed, numSkipped, seconds);
+    std::fprintf(stderr, "%.1f min of audio, %.1fx realtime, %.2f jobs/s\n", audioSeconds/60.0, audioSeconds/seconds, statistics.numRendered/seconds);
+    return statistics.numFailed;
+}
@@ -0,0 +1,38 @@
+//
+//  BatchRender.h
+//  HARDRender
+//
+
+#ifndef BatchRender_h
+#define BatchRender_h
+
+#include <JuceHeader.h>
+#include "FileRender.h"
+
+struct BatchRenderOptions
+{
+    juce::File manifestFile;
+    int numJobThreads = 1;              // jobs rendered in parallel
+    int intraOpThreads = 0;             // ONNX Runtime threads per job's session, 0 splits the cores between jobs
+    bool overwrite = false;             // re-render jobs whose output already exists
+    std::shared_ptr<WindowCache> windowCache;   // shared by all jobs, may be null
+};
+
+// Renders every source/sidechain pair listed in a JSON manifest:
+//
+//  {
+//      "harmony": 0.5, "rhythm": 0.5,
+//      "jobs": [
+//          {"source": "stems/a.wav", "sidechain": "grooves/x.wav", "output": "out/a_x.wav", "rhythm": 1.0},
+//          ...
+//      ]
+//  }
+//
+// Fader and gain values ("harmony", "rhythm", "sourceGain", "sidechainGain") can be set per job or
+// once at the top level, and relative paths are resolved against the manifest's directory. Each worker
+// has its own session of the model, sharing its prepacked weights with the others. Outputs are written to a temporary file and renamed when
+// complete, so an interrupted batch can be resumed by running it again.
+// Returns the number of failed jobs, or -1 if the manifest could not be read.
+int runBatchRender(const ModelSource& modelSource, const BatchRenderOptions& options);
+
+#endif /* BatchRender_h */
@@ -0,0 +1,626 @@
+//
+//  Benchmark.cpp
+//  HARDRender
+//
+
+#include "Benchmark.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#if JUCE_MAC
+ #include <mach/mach.h>
+#endif
+
+// Noise input, so no path through the model is trivially cheap
+static void fillRandom(std::vector<float>& data, juce::Random& random)
+{
+    for (auto& value : data)
+    {
+        value = random.nextFloat()*0.2f - 0.1f;
+    }
+}
+
+// Returns the median of the timed calls in milliseconds
+template <typename Function>
+static double timeMedian(int iterations, Function&& function)
+{
+    std::vector<double> times;
+    for (int i = 0; i < iterations; i++)
+    {
+        double start = juce::Time::getMillisecondCounterHiRes();
+        function();
+        times.push_back(juce::Time::getMillisecondCounterHiRes() - start);
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size()/2];
+}
+
+void runFaderGridBenchmark(MorpherModel& model, const FaderGridBenchmarkOptions& options)
+{
+    const int numPoints = options.pointsPerAxis*options.pointsPerAxis;
+    const size_t inputSize = MorpherModel::NUM_INPUT_CHANNELS*MorpherModel::WINDOW_SAMPLES;
+    const size_t outputSize = MorpherModel::NUM_OUTPUT_CHANNELS*MorpherModel::WINDOW_SAMPLES;
+    std::vector<float> input(inputSize*(size_t)numPoints);
+    std::vector<float> output(outputSize*(size_t)numPoints);
+    juce::Random random(1);
+    fillRandom(input, random);
+
+    model.warmup(3);
+    model.runBatch(input.data(), output.data(), numPoints);
+
+    double single = timeMedian(options.iterations, [&]
+    {
+        model.run(input.data(), output.data());
+    });
+    double separate = timeMedian(options.iterations, [&]
+    {
+        for (int p = 0; p < numPoints; p++)
+        {
+            model.run(input.data() + inputSize*(size_t)p, output.data() + outputSize*(size_t)p);
+        }
+    });
+    double batched = timeMedian(options.iterations, [&]
+    {
+        model.runBatch(input.data(), output.data(), numPoints);
+    });
+
+    // One window is 8192 new samples at 44.1kHz
+    const double windowMs = 8192.0/44.1;
+    std::printf("Fader grid %dx%d (%d points), median of %d runs%s\n", options.pointsPerAxis, options.pointsPerAxis,
+                numPoints, options.iterations, model.hasDynamicBatch() ? "" : " (model has a fixed batch size, batched = separate)");
+    std::printf("  single window      %8.2f ms\n", single);
+    std::printf("  %2d separate runs   %8.2f ms  (%.0f%% of a %.0f ms window)\n", numPoints, separate, 100.0*separate/windowMs, windowMs);
+    std::printf("  batched run        %8.2f ms  (%.0f%% of a window, %.2fx faster than separate)\n", batched, 100.0*batched/windowMs, separate/batched);
+
+    auto memory = model.getMemoryStats();
+    auto arena = model.getSharedArenaStats();
+    if (arena.limitBytes > 0)
+    {
+        std::printf("  session memory     %.1f MB weights, %.1f MB peak during runs\n", memory.weightBytes/1048576.0, memory.peakRunBytes/1048576.0);
+        std::printf("  shared arena       %.1f MB reserved, %.1f MB peak, %.0f MB limit\n",
+                    arena.reservedBytes/1048576.0, arena.peakReservedBytes/1048576.0, arena.limitBytes/1048576.0);
+    }
+}
+
+// Windows per second of all instances, times the 8192 new samples per window at 44.1kHz
+static double measureThroughput(const ModelSource& modelSource, int numInstances, int numThreads, bool sharedPool, double seconds)
+{
+    OrtEnvironment::Options environmentOptions;
+    environmentOptions.globalThreadPools = sharedPool;
+    environmentOptions.intraOpThreads = numThreads;
+    // Released by the previous configuration, so these options take effect
+    auto environment = OrtEnvironment::getShared(environmentOptions);
+    jassert(environment->hasGlobalThreadPools() == sharedPool);
+
+    MorpherModel::Options modelOptions;
+    modelOptions.intraOpThreads = numThreads;
+    modelOptions.environment = environment;
+    std::vector<std::unique_ptr<MorpherModel>> models;
+    for (int i = 0; i < numInstances; i++)
+    {
+        models.push_back(std::make_unique<MorpherModel>(modelSource, modelOptions));
+        models.back()->warmup(1);
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<juce::int64> numWindows{0};
+    std::vector<std::thread> threads;
+    double start = juce::Time::getMillisecondCounterHiRes();
+    for (int i = 0; i < numInstances; i++)
+    {
+        threads.emplace_back([&, model = models[(size_t)i].get(), i]
+        {
+            std::vector<float> input(MorpherModel::NUM_INPUT_CHANNELS*MorpherModel::WINDOW_SAMPLES);
+            std::vector<float> output(MorpherModel::NUM_OUTPUT_CHANNELS*MorpherModel::WINDOW_SAMPLES);
+            juce::Random random(i);
+            fillRandom(input, random);
+            while (!stop)
+            {
+                model->run(input.data(), output.data());
+                numWindows++;
+            }
+        });
+    }
+    juce::Thread::sleep((int)(seconds*1000.0));
+    stop = true;
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    double elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - start)/1000.0;
+    return (double)numWindows*8192.0/44100.0/elapsedSeconds;
+}
+
+void runScalingBenchmark(const ModelSource& modelSource, const ScalingBenchmarkOptions& options)
+{
+    std::printf("Throughput as a multiple of real time (%d cores, %.0f s per run)\n", juce::SystemStats::getNumCpus(), options.seconds);
+    std::printf("  instances  threads  per-session pools  shared pool\n");
+    for (int numInstances : options.instanceCounts)
+    {
+        for (int numThreads : options.threadCounts)
+        {
+            double perSession = measureThroughput(modelSource, numInstances, numThreads, false, options.seconds);
+            double shared = measureThroughput(modelSource, numInstances, numThreads, true, options.seconds);
+            std::printf("  %9d  %7d  %16.2fx  %10.2fx\n", numInstances, numThreads, perSession, shared);
+            std::fflush(stdout);
+        }
+    }
+}
+
+struct ProcessStats
+{
+    int numThreads = -1;
+    juce::int64 residentBytes = -1;
+    // Resident memory with shared pages divided between the processes sharing
+    // them (PSS). macOS has no PSS; its physical footprint, which leaves out
+    // clean file-backed pages such as mapped weights, is used instead.
+    juce::int64 proportionalBytes = -1;
+};
+
+// -1 where the platform is not supported
+static ProcessStats getProcessStats()
+{
+    ProcessStats stats;
+   #if JUCE_MAC
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+    {
+        stats.residentBytes = (juce::int64)info.resident_size;
+    }
+    task_vm_info_data_t vmInfo;
+    mach_msg_type_number_t vmCount = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&vmInfo, &vmCount) == KERN_SUCCESS)
+    {
+        stats.proportionalBytes = (juce::int64)vmInfo.phys_footprint;
+    }
+    thread_act_array_t threads;
+    mach_msg_type_number_t numThreads;
+    if (task_threads(mach_task_self(), &threads, &numThreads) == KERN_SUCCESS)
+    {
+        stats.numThreads = (int)numThreads;
+        for (mach_msg_type_number_t i = 0; i < numThreads; i++)
+        {
+            mach_port_deallocate(mach_task_self(), threads[i]);
+        }
+        vm_deallocate(mach_task_self(), (vm_address_t)threads, sizeof(thread_act_t)*numThreads);
+    }
+   #elif JUCE_LINUX
+    juce::StringArray lines;
+    lines.addLines(juce::File("/proc/self/status").loadFileAsString());
+    for (const auto& line : lines)
+    {
+        if (line.startsWith("Threads:"))
+        {
+            stats.numThreads = line.fromFirstOccurrenceOf(":", false, false).getIntValue();
+        }
+        else if (line.startsWith("VmRSS:"))
+        {
+            stats.residentBytes = line.fromFirstOccurrenceOf(":", false, false).getLargeIntValue()*1024;
+        }
+    }
+    lines.clear();
+    lines.addLines(juce::File("/proc/self/smaps_rollup").loadFileAsString());
+    for (const auto& line : lines)
+    {
+        if (line.startsWith("Pss:"))
+        {
+            stats.proportionalBytes = line.fromFirstOccurrenceOf(":", false, false).getLargeIntValue()*1024;
+        }
+    }
+   #endif
+    return stats;
+}
+
+// One plugin instance's lifetime: load, start a window, tear down mid-inference.
+// Returns the teardown time in milliseconds.
+static double runInstance(const ModelSource& modelSource, const MorpherModel::Options& modelOptions, juce::Random& random)
+{
+    const int window = MorpherModel::WINDOW_SAMPLES;
+    std::vector<stereo_float> input1((size_t)window), input2((size_t)window);
+    for (int i = 0; i < window; i++)
+    {
+        input1[(size_t)i] = {random.nextFloat()*0.2f - 0.1f, random.nextFloat()*0.2f - 0.1f};
+        input2[(size_t)i] = {random.nextFloat()*0.2f - 0.1f, random.nextFloat()*0.2f - 0.1f};
+    }
+    auto output = std::make_unique<FifoBuffer>();
+
+    auto engine = std::make_unique<ONNXMorpherInferenceThread>(std::make_shared<MorpherModel>(modelSource, modelOptions), true);
+    engine->requestInference(input1.data(), input2.data(), 0.5f, 0.5f, 1.0f, 1.0f, output.get());
+    // Sometimes before, sometimes during the run
+    juce::Thread::sleep(random.nextInt(20));
+
+    double start = juce::Time::getMillisecondCounterHiRes();
+    engine.reset();
+    return juce::Time::getMillisecondCounterHiRes() - start;
+}
+
+bool runLifecycleStress(const ModelSource& modelSource, const LifecycleStressOptions& options)
+{
+    juce::Random random(1);
+    // The first instance initializes ONNX Runtime for good, so it is part of the baseline
+    runInstance(modelSource, options.modelOptions, random);
+    const ProcessStats before = getProcessStats();
+
+    std::vector<double> teardownMs;
+    for (int i = 0; i < options.numInstances; i++)
+    {
+        teardownMs.push_back(runInstance(modelSource, options.modelOptions, random));
+    }
+    const ProcessStats after = getProcessStats();
+    std::sort(teardownMs.begin(), teardownMs.end());
+
+    const double maxMs = teardownMs.empty() ? 0.0 : teardownMs.back();
+    std::printf("%d instances created and destroyed\n", options.numInstances);
+    if (!teardownMs.empty())
+    {
+        std::printf("  teardown           median %.2f ms, max %.2f ms (limit %d ms)\n",
+                    teardownMs[teardownMs.size()/2], maxMs, ONNXMorpherInferenceThread::SHUTDOWN_TIMEOUT_MS);
+    }
+    std::printf("  threads            %d -> %d\n", before.numThreads, after.numThreads);
+    std::printf("  resident memory    %.1f MB -> %.1f MB\n", before.residentBytes/1048576.0, after.residentBytes/1048576.0);
+
+    bool passed = (maxMs < ONNXMorpherInferenceThread::SHUTDOWN_TIMEOUT_MS) and (after.numThreads <= before.numThreads);
+    // Allocator caches keep some memory, but not a session per instance
+    const juce::int64 sessionBytes = (juce::int64)modelSource.getSize();
+    if ((before.residentBytes >= 0) and (after.residentBytes - before.residentBytes > sessionBytes*4))
+    {
+        passed = false;
+    }
+    std::printf("%s\n", passed ? "PASSED" : "FAILED");
+    return passed;
+}
+
+// Median of the models' own load times, without their teardown
+static double medianLoadMs(const ModelSource& source, const MorpherModel::Options& options, int iterations, const juce::File& directoryToClear)
+{
+    std::vector<double> times;
+    for (int i = 0; i < iterations; i++)
+    {
+        directoryToClear.deleteRecursively();
+        MorpherModel model(source, options);
+        times.push_back(model.getLoadInfo().milliseconds);
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size()/2];
+}
+
+void runLoadBenchmark(const ModelSource& modelSource, int iterations)
+{
+    juce::Array<ModelSource> sources;
+    juce::MemoryBlock bytes;
+    sources.add(modelSource);
+    if (!modelSource.isInMemory())
+    {
+        modelSource.getFile().loadFileAsData(bytes);
+        sources.add(ModelSource::fromMemory(bytes.getData(), bytes.getSize(), "memory copy of " + modelSource.getFile().getFileName()));
+        const juce::File sibling = modelSource.getFile().withFileExtension(modelSource.isOrtFormat() ? ".onnx" : ".ort");
+        if (sibling.existsAsFile())
+        {
+            sources.add(ModelSource::fromFile(sibling));
+        }
+    }
+
+    std::printf("Model load time, median of %d loads\n", iterations);
+    {
+        MorpherModel::Options options;
+        options.environment = OrtEnvironment::getShared({});
+        for (const auto& source : sources)
+        {
+            double median = medianLoadMs(source, options, iterations, {});
+            std::printf("  %8.1f ms  %s, %.1f MB\n", median, source.getDescription().toRawUTF8(), source.getSize()/1048576.0);
+        }
+    }
+
+    // The environment is recreated once the one above is released
+    const juce::File cacheDirectory = juce::File::getSpecialLocation(juce::File::tempDirectory).getNonexistentChildFile("HARDModelCache", "");
+    OrtEnvironment::Options environmentOptions;
+    environmentOptions.optimizedModelDirectory = cacheDirectory;
+    MorpherModel::Options options;
+    options.environment = OrtEnvironment::getShared(environmentOptions);
+    if (options.environment->getOptions().optimizedModelDirectory != cacheDirectory)
+    {
+        return;
+    }
+    std::printf("Optimized model cache\n");
+    for (const auto& source : sources)
+    {
+        if (source.isOrtFormat())
+        {
+            continue;
+        }
+        double cold = medianLoadMs(source, options, iterations, cacheDirectory);
+        double warm = medianLoadMs(source, options, iterations, {});
+        std::printf("  %8.1f ms  cold (optimizes and saves), %s\n", cold, source.getDescription().toRawUTF8());
+        std::printf("  %8.1f ms  warm (loads the optimized copy)\n", warm);
+    }
+    cacheDirectory.deleteRecursively();
+}
+
+// The environment the plugin uses for its weights: the optimized model cache
+// turns an ONNX model into an ORT-format file that can be mapped
+static OrtEnvironment::Options getWeightsEnvironmentOptions(bool sharedWeights)
+{
+    OrtEnvironment::Options options;
+    options.optimizedModelDirectory = OptimizedModelCache::getDefaultDirectory();
+    options.sharedWeights = sharedWeights;
+    return options;
+}
+
+static void printMemoryRow(int numInstances, bool sharedWeights, const char* where, juce::int64 residentBytes, juce::int64 proportionalBytes)
+{
+    std::printf("  %2d instances  %-15s %-8s  RSS %8.1f MB  PSS %8.1f MB  (%.1f / %.1f MB per instance)\n",
+                numInstances, sharedWeights ? "shared weights" : "private weights", where,
+                residentBytes/1048576.0, proportionalBytes/1048576.0,
+                residentBytes/1048576.0/numInstances, proportionalBytes/1048576.0/numInstances);
+}
+
+static void measureInstances(const ModelSource& modelSource, int numInstances, bool sharedWeights)
+{
+    MorpherModel::Options modelOptions;
+    modelOptions.environment = OrtEnvironment::getShared(getWeightsEnvironmentOptions(sharedWeights));
+    // The optimized copy exists before the baseline, and ONNX Runtime is initialized
+    MorpherModel(modelSource, modelOptions).warmup(1);
+    const ProcessStats before = getProcessStats();
+
+    std::vector<std::unique_ptr<MorpherModel>> models;
+    for (int i = 0; i < numInstances; i++)
+    {
+        models.push_back(std::make_unique<MorpherModel>(modelSource, modelOptions));
+        models.back()->warmup(1);
+    }
+    const ProcessStats after = getProcessStats();
+    printMemoryRow(numInstances, sharedWeights, "1 process", after.residentBytes - before.residentBytes,
+                   after.proportionalBytes - before.proportionalBytes);
+}
+
+// Waits for count files with the given extension, or gives up after a minute
+static bool waitForFiles(const juce::File& directory, const juce::String& extension, int count)
+{
+    for (int i = 0; i < 6000; i++)
+    {
+        if (directory.getNumberOfChildFiles(juce::File::findFiles, "*" + extension) >= count)
+        {
+            return true;
+        }
+        juce::Thread::sleep(10);
+    }
+    return false;
+}
+
+static void measureProcesses(const ModelSource& modelSource, int numInstances, bool sharedWeights)
+{
+    const juce::File directory = juce::File::getSpecialLocation(juce::File::tempDirectory).getNonexistentChildFile("HARDMemory", "");
+    directory.createDirectory();
+    juce::OwnedArray<juce::ChildProcess> children;
+    for (int i = 0; i < numInstances; i++)
+    {
+        juce::StringArray command {juce::File::getSpecialLocation(juce::File::currentExecutableFile).getFullPathName(),
+                                   "memory", "--child=" + directory.getFullPathName()};
+        if (modelSource.getFile().existsAsFile())
+        {
+            command.add("--model=" + modelSource.getFile().getFullPathName());
+        }
+        if (!sharedWeights)
+        {
+            command.add("--private-weights");
+        }
+        auto* child = children.add(new juce::ChildProcess());
+        child->start(command, juce::ChildProcess::wantStdOut);
+    }
+
+    // Every process measures itself once all of them have loaded, so the shared
+    // pages are divided between all of them
+    bool measured = waitForFiles(directory, ".ready", numInstances);
+    directory.getChildFile("go").create();
+    measured = measured and waitForFiles(directory, ".measured", numInstances);
+    directory.getChildFile("done").create();
+
+    juce::int64 residentBytes = 0;
+    juce::int64 proportionalBytes = 0;
+    for (auto* child : children)
+    {
+        juce::StringArray values = juce::StringArray::fromTokens(child->readAllProcessOutput(), false);
+        residentBytes += values[0].getLargeIntValue();
+        proportionalBytes += values[1].getLargeIntValue();
+    }
+    directory.deleteRecursively();
+    if (!measured)
+    {
+        std::printf("  %2d instances  %s: processes did not start\n", numInstances, sharedWeights ? "shared weights" : "private weights");
+        return;
+    }
+    // Whole processes, including what the renderer itself uses
+    printMemoryRow(numInstances, sharedWeights, "processes", residentBytes, proportionalBytes);
+}
+
+void runMemoryBenchmark(const ModelSource& modelSource, const MemoryBenchmarkOptions& options)
+{
+    std::printf("Memory added by model instances%s\n", options.separateProcesses ? ", one process each" : "");
+    for (int numInstances : options.instanceCounts)
+    {
+        for (bool sharedWeights : {false, true})
+        {
+            if (options.separateProcesses)
+            {
+                measureProcesses(modelSource, numInstances, sharedWeights);
+            }
+            else
+            {
+                measureInstances(modelSource, numInstances, sharedWeights);
+            }
+        }
+    }
+}
+
+bool runMemoryBenchmarkChild(const ModelSource& modelSource, const juce::File& signalDirectory, bool sharedWeights)
+{
+    MorpherModel::Options modelOptions;
+    modelOptions.environment = OrtEnvironment::getShared(getWeightsEnvironmentOptions(sharedWeights));
+    MorpherModel model(modelSource, modelOptions);
+    model.warmup(1);
+
+    const juce::String name = juce::Uuid().toString();
+    signalDirectory.getChildFile(name + ".ready").create();
+    if (!waitForFiles(signalDirectory, "go", 1))
+    {
+        return false;
+    }
+    const ProcessStats stats = getProcessStats();
+    signalDirectory.getChildFile(name + ".measured").create();
+    waitForFiles(signalDirectory, "done", 1);
+    std::printf("%lld %lld\n", (long long)stats.residentBytes, (long long)stats.proportionalBytes);
+    return true;
+}
+
+void runTierBenchmark(const ModelSource& fullModel, int iterations)
+{
+    auto settings = WorkerPolicy::openUserSettings();
+    auto tiers = QualityTier::findTiers(fullModel, *settings);
+    const double hopMs = ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES*1000.0/44100.0;
+    MorpherModel::Options options;
+    options.environment = OrtEnvironment::getShared({});
+
+    std::printf("Window cost of %d quality tiers, median of %d windows\n", tiers.size(), iterations);
+    for (auto& tier : tiers)
+    {
+        MorpherModel model(tier.source, options);
+        model.warmup(2);
+        std::vector<double> times;
+        for (int i = 0; i < iterations; i++)
+        {
+            const double start = juce::Time::getMillisecondCounterHiRes();
+            model.warmup(1);
+            times.push_back(juce::Time::getMillisecondCounterHiRes() - start);
+        }
+        std::sort(times.begin(), times.end());
+        tier.windowMs = times[times.size()/2];
+        tier.storeCost(*settings);
+        std::printf("  %8.1f ms  %-8s load %.2f  %s\n", tier.windowMs, tier.name.toRawUTF8(), tier.windowMs/hopMs, tier.source.getDescription().toRawUTF8());
+    }
+    if (tiers.size() < 2)
+    {
+        std::printf("Only one tier: add morpher-<name>.onnx or .ort files next to the model\n");
+    }
+    settings->saveIfNeeded();
+}
+
+// One instance's audio callback: a block in and out every block period, and a
+// window request every DNN_INPUT_SAMPLES, as in HARDAudioProcessor::processBlock.
+// It starts from the state a reprime leaves: LEAD_IN_SAMPLES in the input and
+// the delay less those in the output, so the first window is as tight as after
+// a start or seek in the plugin.
+static void runRealtimeInstance(ONNXMorpherInferenceThread& engine, InferenceTelemetry& telemetry, CallbackMonitor& monitor, const TelemetryBenchmarkOptions& options, int seed)
+{
+    const int window = MorpherModel::WINDOW_SAMPLES;
+    const double sampleRate = 44100.0;
+    const double blockMs = options.blockSize*1000.0/sampleRate;
+    std::vector<stereo_float> input1((size_t)window), input2((size_t)window);
+    std::vector<float> outL((size_t)options.blockSize), outR((size_t)options.blockSize);
+    juce::Random random(seed);
+    for (int i = 0; i < window; i++)
+    {
+        input1[(size_t)i] = {random.nextFloat()*0.2f - 0.1f, random.nextFloat()*0.2f - 0.1f};
+        input2[(size_t)i] = {random.nextFloat()*0.2f - 0.1f, random.nextFloat()*0.2f - 0.1f};
+    }
+    const int leadIn = (int)(ONNXMorpherInferenceThread::DNN_OUTPUT_DROP_HEAD_SAMPLES + ONNXMorpherInferenceThread::OVERLAP_SAMPLES);
+    auto output = std::make_unique<FifoBuffer>();
+    output->fillZeros(options.outputDelaySamples - leadIn);
+
+    const juce::int64 numBlocks = (juce::int64)(options.seconds*sampleRate/options.blockSize);
+    int newSamples = leadIn;
+    int inputSamples = leadIn;
+    const double start = juce::Time::getMillisecondCounterHiRes();
+    for (juce::int64 block = 0; block < numBlocks; block++)
+    {
+        {
+            CallbackMonitor::ScopedCallback callback(monitor, options.blockSize, sampleRate);
+            newSamples += options.blockSize;
+            inputSamples += options.blockSize;
+            if ((newSamples >= (int)ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES) and (inputSamples >= window) and !engine.threadIsInferring())
+            {
+                int samplesLeft = output->getBufferSize() - (int)ONNXMorpherInferenceThread::OVERLAP_SAMPLES - options.blockSize;
+                engine.setDeadline(samplesLeft*1000.0/sampleRate);
+                engine.requestInference(input1.data(), input2.data(), 0.5f, 0.5f, 1.0f, 1.0f, output.get());
+                newSamples -= ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES;
+                inputSamples -= ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES;
+            }
+            callback.mark(CallbackMonitor::request);
+            if (output->getBufferSize() < options.blockSize)
+            {
+                telemetry.countUnderrun();
+            }
+            else
+            {
+                output->readData(outL.data(), outR.data(), options.blockSize, options.blockSize);
+            }
+            callback.mark(CallbackMonitor::output);
+        }
+        double nextMs = start + (double)(block+1)*blockMs;
+        double waitMs = nextMs - juce::Time::getMillisecondCounterHiRes();
+        if (waitMs > 0.0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds((juce::int64)(waitMs*1000.0)));
+        }
+    }
+    engine.shutdown();
+}
+
+bool runTelemetryBenchmark(const ModelSource& modelSource, const TelemetryBenchmarkOptions& options)
+{
+    std::vector<std::unique_ptr<ONNXMorpherInferenceThread>> engines;
+    std::vector<std::shared_ptr<InferenceTelemetry>> telemetries;
+    std::vector<std::unique_ptr<CallbackMonitor>> monitors;
+    for (int i = 0; i < options.numInstances; i++)
+    {
+        auto model = std::make_shared<MorpherModel>(modelSource, MorpherModel::Options());
+        model->warmup(1);
+        engines.push_back(std::make_unique<ONNXMorpherInferenceThread>(std::move(model), true));
+        telemetries.push_back(std::make_shared<InferenceTelemetry>());
+        engines.back()->setTelemetry(telemetries.back());
+        monitors.push_back(std::make_unique<CallbackMonitor>());
+        monitors.back()->setEnabled(true);
+    }
+    std::printf("%d instance(s) in real time for %.0f s, %d-sample blocks, %d-sample output delay\n",
+                options.numInstances, options.seconds, options.blockSize, options.outputDelaySamples);
+    std::fflush(stdout);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.numInstances; i++)
+    {
+        telemetries[(size_t)i]->reset();
+        threads.emplace_back([&, i]
+        {
+            runRealtimeInstance(*engines[(size_t)i], *telemetries[(size_t)i], *monitors[(size_t)i], options, i);
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    bool passed = true;
+    juce::Array<juce::var> dumps;
+    for (int i = 0; i < options.numInstances; i++)
+    {
+        const InferenceTelemetry::Snapshot snapshot = telemetries[(size_t)i]->getSnapshot();
+        const CallbackMonitor::Snapshot callback = monitors[(size_t)i]->getSnapshot();
+        std::printf("Instance %d\n%s\n%s\n", i+1, snapshot.toString().toRawUTF8(), callback.toString().toRawUTF8());
+        for (const auto& overrun : monitors[(size_t)i]->getOverrunLog())
+        {
+            std::printf("  %s\n", overrun.toString().toRawUTF8());
+        }
+        auto* dump = new juce::DynamicObject();
+        dump->setProperty("inference", snapshot.toVar());
+        dump->setProperty("callback", callback.toVar());
+        dumps.add(juce::var(dump));
+        passed = passed and (snapshot.underruns == 0);
+    }
+    if (options.dumpFile != juce::File())
+    {
+        options.dumpFile.replaceWithText(juce::JSON::toString(juce::var(dumps)));
+        std::printf("Written to %s\n", options.dumpFile.getFullPathName().toRawUTF8());
+    }
+    return passed;
+}
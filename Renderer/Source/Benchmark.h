@@ -0,0 +1,93 @@
+//
+//  Benchmark.h
+//  HARDRender
+//
+
+#ifndef Benchmark_h
+#define Benchmark_h
+
+#include <JuceHeader.h>
+#include "../../Source/MorpherModel.h"
+#include "../../Source/ONNXInferenceThread.hpp"
+#include "../../Source/OptimizedModelCache.h"
+#include "../../Source/TierGovernor.h"
+#include "../../Source/InferenceTelemetry.h"
+#include "../../Source/CallbackMonitor.h"
+
+struct FaderGridBenchmarkOptions
+{
+    int pointsPerAxis = 3;
+    int iterations = 10;
+};
+
+// Times one batched run over a pointsPerAxis^2 fader grid against the same
+// number of separate runs, and prints both to stdout.
+void runFaderGridBenchmark(MorpherModel& model, const FaderGridBenchmarkOptions& options);
+
+struct ScalingBenchmarkOptions
+{
+    juce::Array<int> instanceCounts {1, 2, 4, 8};
+    juce::Array<int> threadCounts {1, 2, 4};
+    double seconds = 5.0;
+};
+
+// Runs N instances, each with its own session and calling thread, back to back
+// for every N x M in the options: once with a pool of M threads per session and
+// once with all sessions sharing one global pool of M threads. Prints the total
+// throughput as a multiple of real time.
+void runScalingBenchmark(const ModelSource& modelSource, const ScalingBenchmarkOptions& options);
+
+struct LifecycleStressOptions
+{
+    int numInstances = 200;
+    MorpherModel::Options modelOptions;
+};
+
+// Creates and destroys numInstances plugin-style workers, each with its own
+// model and a window in flight, and checks that the process thread count and
+// resident memory return to where they were. Returns false on a leak or a
+// teardown that exceeded ONNXMorpherInferenceThread::SHUTDOWN_TIMEOUT_MS.
+bool runLifecycleStress(const ModelSource& modelSource, const LifecycleStressOptions& options);
+
+// Loads the model iterations times from each path it can take: the file, the
+// same bytes from memory, and the ORT-format or ONNX file next to it if there is
+// one. Then loads the ONNX ones through an empty optimized model cache (cold)
+// and a filled one (warm). Prints the median load time of each to stdout.
+void runLoadBenchmark(const ModelSource& modelSource, int iterations);
+
+struct MemoryBenchmarkOptions
+{
+    juce::Array<int> instanceCounts {1, 16};
+    bool separateProcesses = false;     // one instance per process, like sandboxed plugin hosts
+};
+
+// Loads N instances with and without shared weights, and prints the resident
+// (RSS) and proportional (PSS) memory they take. Within one process this is
+// what the instances add; with separate processes, the processes' totals.
+void runMemoryBenchmark(const ModelSource& modelSource, const MemoryBenchmarkOptions& options);
+// One of the separate processes: loads the model and reports its memory when
+// the parent signals through files in signalDirectory. Returns false if it never did.
+bool runMemoryBenchmarkChild(const ModelSource& modelSource, const juce::File& signalDirectory, bool sharedWeights);
+
+// Times one window of every quality tier found next to the model (median of
+// iterations), prints the costs against the 44.1kHz hop and stores them in
+// HARD.settings, where the plugin's tier governor reads them.
+void runTierBenchmark(const ModelSource& fullModel, int iterations);
+
+struct TelemetryBenchmarkOptions
+{
+    int numInstances = 1;
+    double seconds = 10.0;
+    int blockSize = 512;
+    int outputDelaySamples = 16384+8192;    // the plugin's safe latency
+    juce::File dumpFile;                    // JSON of every instance's telemetry, if set
+};
+
+// Runs numInstances plugin-style engines, each fed one block at a time in real
+// time with its output FIFO primed to outputDelaySamples, and prints each one's
+// inference telemetry (stage time percentiles, deadline slack and underruns)
+// and the callback monitor's figures for its simulated audio callback.
+// Returns false if any instance underran.
+bool runTelemetryBenchmark(const ModelSource& modelSource, const TelemetryBenchmarkOptions& options);
+
+#endif /* Benchmark_h */
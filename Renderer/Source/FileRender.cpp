@@ -0,0 +1,215 @@
+//
+//  FileRender.cpp
+//  HARDRender
+//
+
+#include "FileRender.h"
+
+// Samples mapped at a time, so resident memory stays bounded for any file length
+static const juce::int64 MAP_SECTION_SAMPLES = 1 << 20;
+static const int WRITER_BUFFER_SAMPLES = 1 << 16;
+static const double MODEL_SAMPLE_RATE = 44100.0;
+
+class AudioFileStream
+{
+public:
+    explicit AudioFileStream(const juce::File& file)
+    {
+        if (file.hasFileExtension("wav;wave"))
+        {
+            juce::WavAudioFormat wav;
+            mappedReader = wav.createMemoryMappedReader(file);
+        }
+        else if (file.hasFileExtension("aif;aiff"))
+        {
+            juce::AiffAudioFormat aiff;
+            mappedReader = aiff.createMemoryMappedReader(file);
+        }
+
+        if (mappedReader != nullptr)
+        {
+            reader.reset(mappedReader);
+        }
+        else
+        {
+            juce::AudioFormatManager formatManager;
+            formatManager.registerBasicFormats();
+            reader.reset(formatManager.createReaderFor(file));
+        }
+    }
+
+    bool isValid() const {return reader != nullptr;}
+    juce::int64 getLength() const {return reader->lengthInSamples;}
+    double getSampleRate() const {return reader->sampleRate;}
+
+    // Reads numSamples starting at startSample into l/r, duplicating mono files.
+    void read(juce::int64 startSample, int numSamples, float l[], float r[])
+    {
+        jassert(numSamples <= RENDER_CHUNK_FRAMES);
+        if (mappedReader != nullptr)
+        {
+            juce::Range<juce::int64> wanted(startSample, startSample + numSamples);
+            if (!mappedReader->getMappedSection().contains(wanted))
+            {
+                mappedReader->mapSectionOfFile({startSample, juce::jmin(startSample + MAP_SECTION_SAMPLES, getLength())});
+            }
+        }
+        reader->read(&scratch, 0, numSamples, startSample, true, true);
+        juce::FloatVectorOperations::copy(l, scratch.getReadPointer(0), numSamples);
+        juce::FloatVectorOperations::copy(r, scratch.getReadPointer(1), numSamples);
+    }
+
+private:
+    std::unique_ptr<juce::AudioFormatReader> reader;
+    juce::MemoryMappedAudioFormatReader* mappedReader = nullptr;
+    juce::AudioBuffer<float> scratch{2, RENDER_CHUNK_FRAMES};
+};
+
+class AudioFileInput: public RenderInput
+{
+public:
+    AudioFileInput(AudioFileStream& source, AudioFileStream* sidechain)
+    :sourceStream(source), sidechainStream(sidechain)
+    {
+    }
+
+    int read(float sourceL[], float sourceR[], float sidechainL[], float sidechainR[], int maxFrames) override
+    {
+        int numFrames = (int)juce::jmin((juce::int64)maxFrames, sourceStream.getLength() - position);
+        sourceStream.read(position, numFrames, sourceL, sourceR);
+
+        int numSidechain = 0;
+        if (sidechainStream != nullptr)
+        {
+            numSidechain = (int)juce::jlimit((juce::int64)0, (juce::int64)numFrames, sidechainStream->getLength() - position);
+        }
+        if (numSidechain > 0)
+        {
+            sidechainStream->read(position, numSidechain, sidechainL, sidechainR);
+        }
+        // A sidechain shorter than the source is padded with silence
+        juce::FloatVectorOperations::clear(sidechainL + numSidechain, numFrames - numSidechain);
+        juce::FloatVectorOperations::clear(sidechainR + numSidechain, numFrames - numSidechain);
+
+        position += numFrames;
+        return numFrames;
+    }
+
+private:
+    AudioFileStream& sourceStream;
+    AudioFileStream* sidechainStream;
+    juce::int64 position = 0;
+};
+
+class AudioFileOutput: public RenderOutput
+{
+public:
+    explicit AudioFileOutput(juce::AudioFormatWriter* writer)
+    :writerThread("RenderFileWriter")
+    {
+        writerThread.startThread();
+        threadedWriter = std::make_unique<juce::AudioFormatWriter::ThreadedWriter>(writer, writerThread, WRITER_BUFFER_SAMPLES);
+    }
+
+    ~AudioFileOutput() override
+    {
+        threadedWriter.reset();
+        writerThread.stopThread(1000);
+    }
+
+    bool write(const float outL[], const float outR[], int numFrames) override
+    {
+        const float* channels[2] = {outL, outR};
+        // write() only fails while the background buffer is full
+        while (!threadedWriter->write(channels, numFrames))
+        {
+            juce::Thread::sleep(1);
+        }
+        return true;
+    }
+
+    void finish() override
+    {
+        // Deleting the ThreadedWriter flushes everything still buffered
+        threadedWriter.reset();
+    }
+
+private:
+    juce::TimeSliceThread writerThread;
+    std::unique_ptr<juce::AudioFormatWriter::ThreadedWriter> threadedWriter;
+};
+
+static juce::AudioFormatWriter* createWriter(const juce::File& file, double sampleRate)
+{
+    file.deleteFile();
+    std::unique_ptr<juce::OutputStream> stream(file.createOutputStream());
+    if (stream == nullptr)
+    {
+        return nullptr;
+    }
+
+    juce::AudioFormatWriter* writer = nullptr;
+    if (file.hasFileExtension("aif;aiff"))
+    {
+        juce::AiffAudioFormat aiff;
+        writer = aiff.createWriterFor(stream.get(), sampleRate, 2, 24, {}, 0);
+    }
+    else
+    {
+        juce::WavAudioFormat wav;
+        writer = wav.createWriterFor(stream.get(), sampleRate, 2, 32, {}, 0);
+    }
+    if (writer != nullptr)
+    {
+        // Now owned by the writer
+        stream.release();
+    }
+    return writer;
+}
+
+juce::int64 runFileRender(ONNXMorpherInferenceThread& engine, const FileRenderOptions& options, juce::String& error,
+                          double* sourceSampleRate)
+{
+    AudioFileStream source(options.sourceFile);
+    if (!source.isValid())
+    {
+        error = "Could not read " + options.sourceFile.getFullPathName();
+        return -1;
+    }
+    if (sourceSampleRate != nullptr)
+    {
+        *sourceSampleRate = source.getSampleRate();
+    }
+
+    std::unique_ptr<AudioFileStream> sidechain;
+    if (options.sidechainFile != juce::File())
+    {
+        sidechain = std::make_unique<AudioFileStream>(options.sidechainFile);
+        if (!sidechain->isValid())
+        {
+            error = "Could not read " + options.sidechainFile.getFullPathName();
+            return -1;
+        }
+    }
+
+    if (source.getSampleRate() != MODEL_SAMPLE_RATE)
+    {
+        std::fprintf(stderr, "Warning: %s is %.0fHz, the model expects 44100Hz.\n", options.sourceFile.getFileName().toRawUTF8(), source.getSampleRate());
+    }
+
+    juce::AudioFormatWriter* writer = createWriter(options.outputFile, source.getSampleRate());
+    if (writer == nullptr)
+    {
+        error = "Could not write " + options.outputFile.getFullPathName();
+        return -1;
+    }
+
+    AudioFileInput input(source, sidechain.get());
+    AudioFileOutput output(writer);
+    juce::int64 numFrames = runRenderJob(engine, input, output, options.parameters);
+    if (numFrames < 0)
+    {
+        error = "Writing " + options.outputFile.getFullPathName() + " failed";
+    }
+    return numFrames;
+}
@@ -0,0 +1,29 @@
+//
+//  FileRender.h
+//  HARDRender
+//
+
+#ifndef FileRender_h
+#define FileRender_h
+
+#include <JuceHeader.h>
+#include "RenderJob.h"
+
+struct FileRenderOptions
+{
+    juce::File sourceFile;
+    juce::File sidechainFile;           // juce::File() means silence
+    juce::File outputFile;
+    RenderParameters parameters;
+};
+
+// Renders audio files without decoding them into memory. WAV and AIFF inputs
+// are read through memory-mapped readers that only map a bounded section of the
+// file at a time; other formats fall back to JUCE's streaming readers. The output
+// is written by a background ThreadedWriter.
+// Returns the number of frames written, or -1 and an error message. sourceSampleRate, if not
+// null, receives the sample rate of the source file.
+juce::int64 runFileRender(ONNXMorpherInferenceThread& engine, const FileRenderOptions& options, juce::String& error,
+                          double* sourceSampleRate = nullptr);
+
+#endif /* FileRender_h */
@@ -0,0 +1,470 @@
+//
+//  Main.cpp
+//  HARDRender
+//
+//  Command line renderer sharing the plugin's inference engine.
+//
+
+#include <JuceHeader.h>
+#include "PipeRender.h"
+#include "FileRender.h"
+#include "BatchRender.h"
+#include "Benchmark.h"
+#include "../../Source/OrtAutotuner.h"
+#include "../../Source/RtLog.h"
+
+// Without --model, the plugin's search order (HARD_MODEL, modelPath in HARD.settings, ...)
+static ModelSource getModelSource(const juce::ArgumentList& args)
+{
+    if (args.containsOption("--model"))
+    {
+        return ModelSource::fromFile(args.getExistingFileForOption("--model"));
+    }
+    ModelSource source = ModelSource::getDefault();
+    if (!source.isValid())
+    {
+        juce::ConsoleApplication::fail("No model found, use --model=<file> or set HARD_MODEL");
+    }
+    return source;
+}
+
+static void printLoadInfo(const MorpherModel& model)
+{
+    std::fprintf(stderr, "Loaded %s\n", model.getLoadInfo().toString().toRawUTF8());
+}
+
+static int getIntOption(const juce::ArgumentList& args, juce::StringRef option, int defaultValue)
+{
+    if (!args.containsOption(option))
+    {
+        return defaultValue;
+    }
+    return args.getValueForOption(option).getIntValue();
+}
+
+// Same keys as the plugin's HARD.settings
+static WorkerPolicy getWorkerPolicy(const juce::ArgumentList& args)
+{
+    juce::PropertySet settings;
+    if (args.containsOption("--priority"))
+    {
+        settings.setValue("workerPriority", args.getValueForOption("--priority"));
+    }
+    settings.setValue("workerCores", args.getValueForOption("--cores"));
+    settings.setValue("workerExcludedCores", args.getValueForOption("--exclude-cores"));
+    settings.setValue("workerFlushDenormals", !args.containsOption("--no-ftz"));
+    return WorkerPolicy::fromSettings(settings);
+}
+
+// Applies the policy to the calling thread, which runs the windows, and reports
+// what the OS granted it and the model's pool threads
+static void applyWorkerPolicy(const WorkerPolicy& policy, MorpherModel& model)
+{
+    WorkerPolicy::Status status = policy.applyToCurrentThread();
+    // One run, so every pool thread has started and reported in
+    model.warmup(1);
+    std::fprintf(stderr, "Inference thread: %s%s\n", status.description.toRawUTF8(), status.wasApplied() ? "" : " (not fully applied)");
+    auto pool = model.getPoolThreadStatus();
+    if (pool.numThreads > 0)
+    {
+        std::fprintf(stderr, "Pool threads: %d, %d not fully applied (%s)\n", pool.numThreads, pool.numNotApplied, pool.lastDescription.toRawUTF8());
+    }
+}
+
+static juce::File getCacheDirectory(const juce::ArgumentList& args)
+{
+    if (args.containsOption("--cache-dir"))
+    {
+        return args.getFileForOption("--cache-dir");
+    }
+    return DiskWindowCache::getDefaultDirectory();
+}
+
+// --cache uses the plugin's render cache, --cache-dir another one
+static std::shared_ptr<WindowCache> createWindowCache(const juce::ArgumentList& args, const ModelSource& modelSource)
+{
+    if (!args.containsOption("--cache") and !args.containsOption("--cache-dir"))
+    {
+        return nullptr;
+    }
+    DiskWindowCache::Options options;
+    options.directory = getCacheDirectory(args);
+    options.maxBytes = (juce::int64)getIntOption(args, "--cache-size", (int)(options.maxBytes >> 20)) << 20;
+    if (args.containsOption("--cache-lossless"))
+    {
+        options.encoding = DiskWindowCache::Encoding::deflate;
+    }
+    auto windowCache = std::make_shared<WindowCache>((size_t)64 << 20);
+    windowCache->setBackingStore(std::make_shared<DiskWindowCache>(options, modelSource.getContentHash()));
+    return windowCache;
+}
+
+static void printCacheStats(const std::shared_ptr<WindowCache>& windowCache)
+{
+    if (windowCache != nullptr)
+    {
+        auto stats = windowCache->getStats();
+        std::fprintf(stderr, "Cache: %lld hits (%lld from disk), %lld misses.\n",
+                     (long long)stats.hits, (long long)stats.diskHits, (long long)stats.misses);
+    }
+}
+
+static std::unique_ptr<ONNXMorpherInferenceThread> createEngine(const juce::ArgumentList& args, std::shared_ptr<WindowCache> windowCache)
+{
+    const WorkerPolicy policy = getWorkerPolicy(args);
+    MorpherModel::Options options;
+    options.intraOpThreads = getIntOption(args, "--intra-op-threads", options.intraOpThreads);
+    options.threadPolicy = std::make_shared<const WorkerPolicy>(policy);
+    auto model = std::make_shared<MorpherModel>(getModelSource(args), options);
+    printLoadInfo(*model);
+    applyWorkerPolicy(policy, *model);
+    auto engine = std::make_unique<ONNXMorpherInferenceThread>(model, false);
+    engine->setWindowCache(std::move(windowCache));
+    return engine;
+}
+
+static float getFloatOption(const juce::ArgumentList& args, juce::StringRef option, float defaultValue)
+{
+    if (!args.containsOption(option))
+    {
+        return defaultValue;
+    }
+    return juce::jlimit(0.0f, 1.0f, args.getValueForOption(option).getFloatValue());
+}
+
+static RenderParameters getRenderParameters(const juce::ArgumentList& args)
+{
+    RenderParameters parameters;
+    parameters.harmony = getFloatOption(args, "--harmony", parameters.harmony);
+    parameters.rhythm = getFloatOption(args, "--rhythm", parameters.rhythm);
+    parameters.sourceGain = getFloatOption(args, "--source-gain", parameters.sourceGain);
+    parameters.sidechainGain = getFloatOption(args, "--sidechain-gain", parameters.sidechainGain);
+    return parameters;
+}
+
+static void runPipeCommand(const juce::ArgumentList& args)
+{
+    PipeRenderOptions options;
+    if (args.containsOption("--source"))
+    {
+        options.sourcePath = args.getValueForOption("--source");
+    }
+    if (args.containsOption("--output"))
+    {
+        options.outputPath = args.getValueForOption("--output");
+    }
+    options.sidechainPath = args.getValueForOption("--sidechain");
+    options.parameters = getRenderParameters(args);
+
+    auto windowCache = createWindowCache(args, getModelSource(args));
+    auto engine = createEngine(args, windowCache);
+    juce::int64 numFrames = runPipeRender(*engine, options);
+    if (numFrames < 0)
+    {
+        juce::ConsoleApplication::fail("Could not open or write the source, sidechain or output stream");
+    }
+    std::fprintf(stderr, "Rendered %lld frames.\n", (long long)numFrames);
+    printCacheStats(windowCache);
+}
+
+static void runRenderCommand(const juce::ArgumentList& args)
+{
+    FileRenderOptions options;
+    options.sourceFile = args.getExistingFileForOption("--source");
+    if (args.containsOption("--sidechain"))
+    {
+        options.sidechainFile = args.getExistingFileForOption("--sidechain");
+    }
+    options.outputFile = args.getFileForOption("--output");
+    options.parameters = getRenderParameters(args);
+
+    auto windowCache = createWindowCache(args, getModelSource(args));
+    auto engine = createEngine(args, windowCache);
+    juce::String error;
+    juce::int64 numFrames = runFileRender(*engine, options, error);
+    if (numFrames < 0)
+    {
+        juce::ConsoleApplication::fail(error);
+    }
+    std::fprintf(stderr, "Rendered %lld frames to %s.\n", (long long)numFrames, options.outputFile.getFullPathName().toRawUTF8());
+    printCacheStats(windowCache);
+}
+
+static void runBatchCommand(const juce::ArgumentList& args)
+{
+    BatchRenderOptions options;
+    options.manifestFile = args.getExistingFileForOption("--manifest");
+    options.numJobThreads = getIntOption(args, "--jobs", options.numJobThreads);
+    options.intraOpThreads = getIntOption(args, "--intra-op-threads", options.intraOpThreads);
+    options.overwrite = args.containsOption("--overwrite");
+    options.windowCache = createWindowCache(args, getModelSource(args));
+
+    int numFailed = runBatchRender(getModelSource(args), options);
+    printCacheStats(options.windowCache);
+    if (numFailed != 0)
+    {
+        juce::ConsoleApplication::fail(numFailed < 0 ? "Batch could not start" : juce::String(numFailed) + " jobs failed");
+    }
+}
+
+static void runCacheCommand(const juce::ArgumentList& args)
+{
+    const juce::File directory = getCacheDirectory(args);
+    if (args.containsOption("--clear"))
+    {
+        juce::int64 numDeleted = DiskWindowCache::prune(directory, 0);
+        std::fprintf(stderr, "Deleted %.1f MB.\n", numDeleted/1048576.0);
+    }
+    else if (args.containsOption("--prune"))
+    {
+        juce::int64 maxBytes = (juce::int64)getIntOption(args, "--prune", 0) << 20;
+        juce::int64 numDeleted = DiskWindowCache::prune(directory, maxBytes);
+        std::fprintf(stderr, "Deleted %.1f MB.\n", numDeleted/1048576.0);
+    }
+
+    int numEntries = 0;
+    juce::int64 numBytes = 0;
+    std::printf("%s\n", directory.getFullPathName().toRawUTF8());
+    for (const auto& summary : DiskWindowCache::inspect(directory))
+    {
+        std::printf("  %s  %6d windows  %8.1f MB  last used %s\n    %s\n",
+                    summary.name.toRawUTF8(), summary.numEntries, summary.numBytes/1048576.0,
+                    summary.numEntries > 0 ? summary.newest.toString(true, true).toRawUTF8() : "never",
+                    summary.description.toRawUTF8());
+        numEntries += summary.numEntries;
+        numBytes += summary.numBytes;
+    }
+    std::printf("Total: %d windows, %.1f MB\n", numEntries, numBytes/1048576.0);
+}
+
+static void runBenchmarkCommand(const juce::ArgumentList& args)
+{
+    const WorkerPolicy policy = getWorkerPolicy(args);
+    MorpherModel::Options modelOptions;
+    modelOptions.intraOpThreads = getIntOption(args, "--intra-op-threads", modelOptions.intraOpThreads);
+    modelOptions.threadPolicy = std::make_shared<const WorkerPolicy>(policy);
+    // The plugin's allocator, so its memory use is reported too
+    OrtEnvironment::Options environmentOptions;
+    environmentOptions.sharedAllocator = true;
+    modelOptions.environment = OrtEnvironment::getShared(environmentOptions);
+    MorpherModel model(getModelSource(args), modelOptions);
+    printLoadInfo(model);
+    applyWorkerPolicy(policy, model);
+
+    FaderGridBenchmarkOptions options;
+    options.pointsPerAxis = juce::jlimit(2, 8, getIntOption(args, "--grid", options.pointsPerAxis));
+    options.iterations = juce::jmax(1, getIntOption(args, "--iterations", options.iterations));
+    runFaderGridBenchmark(model, options);
+}
+
+static juce::Array<int> getIntListOption(const juce::ArgumentList& args, juce::StringRef option, const juce::Array<int>& defaultValue)
+{
+    if (!args.containsOption(option))
+    {
+        return defaultValue;
+    }
+    juce::Array<int> values;
+    for (const auto& token : juce::StringArray::fromTokens(args.getValueForOption(option), ",", ""))
+    {
+        if (token.getIntValue() > 0)
+        {
+            values.add(token.getIntValue());
+        }
+    }
+    return values;
+}
+
+static void runScalingCommand(const juce::ArgumentList& args)
+{
+    ScalingBenchmarkOptions options;
+    options.instanceCounts = getIntListOption(args, "--instances", options.instanceCounts);
+    options.threadCounts = getIntListOption(args, "--threads", options.threadCounts);
+    options.seconds = juce::jmax(0.5f, getFloatOption(args, "--seconds", (float)options.seconds));
+    runScalingBenchmark(getModelSource(args), options);
+}
+
+static void runStressCommand(const juce::ArgumentList& args)
+{
+    LifecycleStressOptions options;
+    options.numInstances = juce::jmax(1, getIntOption(args, "--instances", options.numInstances));
+    options.modelOptions.intraOpThreads = getIntOption(args, "--intra-op-threads", options.modelOptions.intraOpThreads);
+    if (!runLifecycleStress(getModelSource(args), options))
+    {
+        juce::ConsoleApplication::fail("Workers were not torn down cleanly");
+    }
+}
+
+static void runLoadCommand(const juce::ArgumentList& args)
+{
+    runLoadBenchmark(getModelSource(args), juce::jmax(1, getIntOption(args, "--iterations", 5)));
+}
+
+static void runTiersCommand(const juce::ArgumentList& args)
+{
+    runTierBenchmark(getModelSource(args), juce::jmax(1, getIntOption(args, "--iterations", 10)));
+}
+
+static void runAutotuneCommand(const juce::ArgumentList& args)
+{
+    const ModelSource source = getModelSource(args);
+    OrtAutotuner::Options options;
+    options.threadCounts = getIntListOption(args, "--threads", {});
+    options.iterations = juce::jmax(1, getIntOption(args, "--iterations", options.iterations));
+    options.verbose = true;
+    std::printf("Autotuning %s on %s\n", source.getDescription().toRawUTF8(), juce::SystemStats::getCpuModel().toRawUTF8());
+    const OrtAutotuner::Configuration fastest = OrtAutotuner::tune(source, options);
+    if (!fastest.isValid())
+    {
+        juce::ConsoleApplication::fail("No configuration could be timed");
+    }
+    std::printf("Fastest: %s (stored in HARD.settings)\n", fastest.toString().toRawUTF8());
+}
+
+static void runTelemetryCommand(const juce::ArgumentList& args)
+{
+    TelemetryBenchmarkOptions options;
+    options.numInstances = juce::jmax(1, getIntOption(args, "--instances", options.numInstances));
+    options.seconds = juce::jmax(1.0f, getFloatOption(args, "--seconds", (float)options.seconds));
+    options.blockSize = juce::jlimit(16, 8192, getIntOption(args, "--block-size", options.blockSize));
+    // Below the plugin's minimum too, to see where underruns start
+    const int leadIn = (int)(ONNXMorpherInferenceThread::DNN_OUTPUT_DROP_HEAD_SAMPLES + ONNXMorpherInferenceThread::OVERLAP_SAMPLES);
+    options.outputDelaySamples = juce::jlimit(leadIn, (int)FifoBuffer::BUFFER_SIZE/2, getIntOption(args, "--delay", options.outputDelaySamples));
+    if (args.containsOption("--json"))
+    {
+        options.dumpFile = args.getFileForOption("--json");
+    }
+    if (!runTelemetryBenchmark(getModelSource(args), options))
+    {
+        juce::ConsoleApplication::fail("Output ran short");
+    }
+}
+
+static void runMemoryCommand(const juce::ArgumentList& args)
+{
+    if (args.containsOption("--child"))
+    {
+        if (!runMemoryBenchmarkChild(getModelSource(args), args.getFileForOption("--child"), !args.containsOption("--private-weights")))
+        {
+            juce::ConsoleApplication::fail("Not signalled by the parent process");
+        }
+        return;
+    }
+    MemoryBenchmarkOptions options;
+    options.instanceCounts = getIntListOption(args, "--instances", options.instanceCounts);
+    options.separateProcesses = args.containsOption("--processes");
+    runMemoryBenchmark(getModelSource(args), options);
+}
+
+int main (int argc, char* argv[])
+{
+    // The engine's own log goes to stderr, errors only unless HARD.settings asks for more
+    juce::SharedResourcePointer<RtLog> rtLog;
+    rtLog->configure(RtLog::Options::fromSettings(*WorkerPolicy::openUserSettings(), RtLog::Level::error));
+    juce::ConsoleApplication app;
+    app.addHelpCommand("--help|-h", "HARD offline renderer", true);
+
+    app.addCommand({"pipe",
+                    "pipe [--model=<file>] [--source=<path|->] [--sidechain=<path>] [--output=<path|->] "
+                    "[--harmony=<0..1>] [--rhythm=<0..1>] [--source-gain=<0..1>] [--sidechain-gain=<0..1>] [--intra-op-threads=<n>] [--priority=<normal|high|fifo|rr>] [--cores=<list>] [--exclude-cores=<list>] [--no-ftz] [--cache|--cache-dir=<dir>]",
+                    "Streams raw interleaved float32 stereo PCM (44.1kHz) through the model.",
+                    "Source defaults to stdin and output to stdout, so the renderer can sit between two ffmpeg "
+                    "processes, e.g.\n"
+                    "  ffmpeg -i a.wav -f f32le -ac 2 -ar 44100 - | HARDRender pipe --model=morpher.onnx "
+                    "--sidechain=b.fifo --harmony=0.5 | ffmpeg -f f32le -ac 2 -ar 44100 -i - out.wav\n"
+                    "Memory use is constant regardless of stream length.",
+                    runPipeCommand});
+
+    app.addCommand({"render",
+                    "render [--model=<file>] --source=<file> [--sidechain=<file>] --output=<file> "
+                    "[--harmony=<0..1>] [--rhythm=<0..1>] [--source-gain=<0..1>] [--sidechain-gain=<0..1>] [--intra-op-threads=<n>] [--priority=<normal|high|fifo|rr>] [--cores=<list>] [--exclude-cores=<list>] [--no-ftz] [--cache|--cache-dir=<dir>]",
+                    "Renders an audio file with a sidechain file to a WAV or AIFF file.",
+                    "WAV and AIFF inputs are memory-mapped a section at a time rather than decoded into memory, "
+                    "so memory use and startup time do not depend on the file length.",
+                    runRenderCommand});
+
+    app.addCommand({"batch",
+                    "batch [--model=<file>] --manifest=<file.json> [--jobs=<n>] [--intra-op-threads=<n>] [--overwrite] [--cache|--cache-dir=<dir>]",
+                    "Renders every source/sidechain pair of a JSON manifest, one model session per parallel job.",
+                    "--jobs sets how many files are rendered in parallel and --intra-op-threads how many threads "
+                    "each job's session uses (default: the cores divided by --jobs). Jobs whose output already exists "
+                    "are skipped unless --overwrite is given, so an interrupted batch resumes where it stopped.",
+                    runBatchCommand});
+
+    app.addCommand({"benchmark",
+                    "benchmark [--model=<file>] [--grid=<n>] [--iterations=<n>] [--intra-op-threads=<n>] [--priority=<normal|high|fifo|rr>] [--cores=<list>] [--exclude-cores=<list>] [--no-ftz]",
+                    "Compares one batched run over an n x n fader grid with n*n separate runs.",
+                    "This is the cost of the plugin's \"instant\" fader mode (3x3 grid) per 186ms window. The scheduling "
+                    "options are those of the plugin's worker (see README), e.g. --priority=fifo --cores=2-3.",
+                    runBenchmarkCommand});
+
+    app.addCommand({"scaling",
+                    "scaling [--model=<file>] [--instances=<n,n,...>] [--threads=<n,n,...>] [--seconds=<s>]",
+                    "Measures total throughput of N concurrent instances with M intra-op threads.",
+                    "Every combination runs once with a thread pool per session, as separate processes or older "
+                    "plugin versions do, and once with the shared pool the plugin now uses for all its instances. "
+                    "Defaults: --instances=1,2,4,8 --threads=1,2,4 --seconds=5.",
+                    runScalingCommand});
+
+    app.addCommand({"stress",
+                    "stress [--model=<file>] [--instances=<n>] [--intra-op-threads=<n>]",
+                    "Creates and destroys n inference workers and checks that nothing leaks.",
+                    "Each worker loads its own model and is destroyed with a window in flight, like a plugin "
+                    "instance removed during playback. Fails if a teardown takes longer than the worker's "
+                    "shutdown limit, or if threads or resident memory do not return to the baseline.",
+                    runStressCommand});
+
+    app.addCommand({"load",
+                    "load [--model=<file>] [--iterations=<n>]",
+                    "Times loading the model from a file, from memory and in ORT format.",
+                    "Without --model, the model is found like the plugin finds it: the HARD_MODEL environment "
+                    "variable, modelPath in HARD.settings, then morpher.ort or morpher.onnx next to the binary. "
+                    "A morpher.ort next to the given model is timed as well.",
+                    runLoadCommand});
+
+    app.addCommand({"memory",
+                    "memory [--model=<file>] [--instances=<n,n,...>] [--processes]",
+                    "Measures the resident (RSS) and proportional (PSS) memory of model instances.",
+                    "Every instance count runs with private weights and with the shared, memory-mapped weights the "
+                    "plugin uses (sharedWeights in HARD.settings). --processes runs each instance in its own process, "
+                    "like hosts that sandbox their plugins. An ONNX model is mapped through its optimized copy in "
+                    "the plugin's model cache. Default: --instances=1,16.",
+                    runMemoryCommand});
+
+    app.addCommand({"autotune",
+                    "autotune [--model=<file>] [--threads=<n,n,...>] [--iterations=<n>]",
+                    "Finds the fastest execution provider and thread count for the model on this machine.",
+                    "Times the default CPU provider, and XNNPACK and oneDNN if ONNX Runtime was built with them, "
+                    "at each thread count (default: powers of two up to the physical cores, and the physical "
+                    "cores). The fastest is stored in HARD.settings for this machine and model, and the plugin's "
+                    "sessions use it from then on. Default: --iterations=5.",
+                    runAutotuneCommand});
+
+    app.addCommand({"tiers",
+                    "tiers [--model=<file>] [--iterations=<n>]",
+                    "Measures the window cost of each quality tier and stores it for the plugin.",
+                    "Tiers are morpher-<name>.onnx or .ort files next to the model (e.g. morpher-tiny.onnx), which is "
+                    "the full tier. The plugin orders tiers by these costs and steps between them when inference "
+                    "falls behind. Default: --iterations=10.",
+                    runTiersCommand});
+
+    app.addCommand({"telemetry",
+                    "telemetry [--model=<file>] [--instances=<n>] [--seconds=<s>] [--block-size=<n>] [--delay=<samples>] [--json=<file>]",
+                    "Plays N plugin-style instances in real time and prints their inference telemetry.",
+                    "Each instance starts from the state a start or seek leaves in the plugin and is fed one block at a "
+                    "time at 44.1kHz, like a host's audio callback, so --delay checks an output delay. It reports "
+                    "the same telemetry as the plugin's stats: queue wait, pack, run and push times, deadline slack and "
+                    "underruns, plus the callback monitor's duration, jitter and over-budget callbacks. Fails if any instance underran. --json writes every instance's telemetry as the "
+                    "plugin's stats button does. Defaults: --instances=1 --seconds=10 --block-size=512 --delay=24576.",
+                    runTelemetryCommand});
+
+    app.addCommand({"cache",
+                    "cache [--cache-dir=<dir>] [--prune=<MB>] [--clear]",
+                    "Lists, prunes or clears the on-disk render cache.",
+                    "Rendered windows are cached per model and fader setting when a render command is given --cache "
+                    "(the plugin's cache directory) or --cache-dir. --cache-size=<MB> limits the cache (default 1024) "
+                    "and --cache-lossless stores windows losslessly instead of as float16. --prune deletes the least "
+                    "recently used windows until the cache fits in the given size.",
+                    runCacheCommand});
+
+    return app.findAndRunCommand(argc, argv);
+}
@@ -0,0 +1,131 @@
+//
+//  PipeRender.cpp
+//  HARDRender
+//
+
+#include "PipeRender.h"
+#include <cstdio>
+
+static FILE* openStream(const juce::String& path, bool forWriting)
+{
+    if (path == "-")
+    {
+        return forWriting ? stdout : stdin;
+    }
+    return std::fopen(path.toRawUTF8(), forWriting ? "wb" : "rb");
+}
+
+static void closeStream(FILE* stream)
+{
+    if ((stream != nullptr) and (stream != stdin) and (stream != stdout))
+    {
+        std::fclose(stream);
+    }
+}
+
+// Reads up to numFrames stereo frames, blocking until they arrive or the stream ends.
+static int readFrames(FILE* stream, float interleaved[], int numFrames)
+{
+    size_t numRead = 0;
+    size_t numWanted = (size_t)numFrames*2;
+    while (numRead < numWanted)
+    {
+        size_t n = std::fread(interleaved + numRead, sizeof(float), numWanted - numRead, stream);
+        if (n == 0)
+        {
+            break;
+        }
+        numRead += n;
+    }
+    return (int)(numRead/2);
+}
+
+static void deinterleave(const float interleaved[], float l[], float r[], int numFrames)
+{
+    for (int i = 0; i < numFrames; i++)
+    {
+        l[i] = interleaved[2*i];
+        r[i] = interleaved[2*i+1];
+    }
+}
+
+class PcmPipeInput: public RenderInput
+{
+public:
+    PcmPipeInput(FILE* source, FILE* sidechain)
+    :sourceStream(source), sidechainStream(sidechain)
+    {
+    }
+
+    int read(float sourceL[], float sourceR[], float sidechainL[], float sidechainR[], int maxFrames) override
+    {
+        jassert(maxFrames <= RENDER_CHUNK_FRAMES);
+        int numFrames = readFrames(sourceStream, interleaved.data(), maxFrames);
+        deinterleave(interleaved.data(), sourceL, sourceR, numFrames);
+
+        int numSidechain = 0;
+        if ((sidechainStream != nullptr) and (numFrames > 0))
+        {
+            numSidechain = readFrames(sidechainStream, interleaved.data(), numFrames);
+        }
+        // A sidechain shorter than the source is padded with silence
+        std::fill(interleaved.begin() + numSidechain*2, interleaved.begin() + numFrames*2, 0.0f);
+        deinterleave(interleaved.data(), sidechainL, sidechainR, numFrames);
+        return numFrames;
+    }
+
+private:
+    FILE* sourceStream;
+    FILE* sidechainStream;
+    std::array<float, RENDER_CHUNK_FRAMES*2> interleaved;
+};
+
+class PcmPipeOutput: public RenderOutput
+{
+public:
+    explicit PcmPipeOutput(FILE* output)
+    :outputStream(output)
+    {
+    }
+
+    bool write(const float outL[], const float outR[], int numFrames) override
+    {
+        jassert(numFrames <= RENDER_CHUNK_FRAMES);
+        for (int i = 0; i < numFrames; i++)
+        {
+            interleaved[2*i] = outL[i];
+            interleaved[2*i+1] = outR[i];
+        }
+        // Fails when downstream closed the pipe
+        return std::fwrite(interleaved.data(), sizeof(float)*2, (size_t)numFrames, outputStream) == (size_t)numFrames;
+    }
+
+    void finish() override
+    {
+        std::fflush(outputStream);
+    }
+
+private:
+    FILE* outputStream;
+    std::array<float, RENDER_CHUNK_FRAMES*2> interleaved;
+};
+
+juce::int64 runPipeRender(ONNXMorpherInferenceThread& engine, const PipeRenderOptions& options)
+{
+    FILE* source = openStream(options.sourcePath, false);
+    FILE* sidechain = options.sidechainPath.isEmpty() ? nullptr : openStream(options.sidechainPath, false);
+    FILE* output = openStream(options.outputPath, true);
+
+    juce::int64 numFrames = -1;
+    if ((source != nullptr) and (output != nullptr) and (options.sidechainPath.isEmpty() or (sidechain != nullptr)))
+    {
+        PcmPipeInput input(source, sidechain);
+        PcmPipeOutput pipeOutput(output);
+        numFrames = runRenderJob(engine, input, pipeOutput, options.parameters);
+    }
+
+    closeStream(source);
+    closeStream(sidechain);
+    closeStream(output);
+    return numFrames;
+}
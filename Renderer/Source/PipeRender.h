@@ -0,0 +1,24 @@
+//
+//  PipeRender.h
+//  HARDRender
+//
+
+#ifndef PipeRender_h
+#define PipeRender_h
+
+#include <JuceHeader.h>
+#include "RenderJob.h"
+
+struct PipeRenderOptions
+{
+    juce::String sourcePath = "-";      // "-" is stdin
+    juce::String sidechainPath;         // empty means silence
+    juce::String outputPath = "-";      // "-" is stdout
+    RenderParameters parameters;
+};
+
+// Streams raw interleaved float32 stereo PCM from pipes/FIFOs through the model.
+// Returns the number of frames written, or -1 if a stream could not be opened or written.
+juce::int64 runPipeRender(ONNXMorpherInferenceThread& engine, const PipeRenderOptions& options);
+
+#endif /* PipeRender_h */
@@ -0,0 +1,130 @@
+//
+//  RenderJob.cpp
+//  HARDRender
+//
+
+#include "RenderJob.h"
+
+static const int WAIT_TIMEOUT_MS = 50;
+
+class RenderInputThread: public juce::Thread
+{
+public:
+    RenderInputThread(OfflineMorpherRenderer& r, RenderInput& i, juce::WaitableEvent& dataPushed, juce::WaitableEvent& spaceFreed)
+    :juce::Thread("RenderInputThread"), renderer(r), input(i), inputPushed(dataPushed), inputConsumed(spaceFreed)
+    {
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            if (renderer.getInputFreeSpace() < RENDER_CHUNK_FRAMES)
+            {
+                inputConsumed.wait(WAIT_TIMEOUT_MS);
+                continue;
+            }
+
+            int numFrames = input.read(sourceL.data(), sourceR.data(), sidechainL.data(), sidechainR.data(), RENDER_CHUNK_FRAMES);
+            if (numFrames > 0)
+            {
+                renderer.pushInput(sourceL.data(), sourceR.data(), sidechainL.data(), sidechainR.data(), numFrames);
+            }
+            if (numFrames < RENDER_CHUNK_FRAMES)
+            {
+                renderer.finishInput();
+                inputPushed.signal();
+                return;
+            }
+            inputPushed.signal();
+        }
+    }
+
+private:
+    OfflineMorpherRenderer& renderer;
+    RenderInput& input;
+    juce::WaitableEvent& inputPushed;
+    juce::WaitableEvent& inputConsumed;
+
+    std::array<float, RENDER_CHUNK_FRAMES> sourceL, sourceR, sidechainL, sidechainR;
+};
+
+class RenderOutputThread: public juce::Thread
+{
+public:
+    RenderOutputThread(OfflineMorpherRenderer& r, RenderOutput& o, juce::WaitableEvent& dataRendered, juce::WaitableEvent& spaceFreed)
+    :juce::Thread("RenderOutputThread"), renderer(r), output(o), outputRendered(dataRendered), outputConsumed(spaceFreed)
+    {
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit() and !renderer.isFinished())
+        {
+            int numFrames = juce::jmin(renderer.getNumOutputReady(), RENDER_CHUNK_FRAMES);
+            if (numFrames == 0)
+            {
+                outputRendered.wait(WAIT_TIMEOUT_MS);
+                continue;
+            }
+
+            renderer.readOutput(outL.data(), outR.data(), numFrames);
+            outputConsumed.signal();
+            if (!output.write(outL.data(), outR.data(), numFrames))
+            {
+                writeFailed = true;
+                return;
+            }
+            numFramesWritten += numFrames;
+        }
+        output.finish();
+    }
+
+    std::atomic<bool> writeFailed{false};
+    std::atomic<juce::int64> numFramesWritten{0};
+
+private:
+    OfflineMorpherRenderer& renderer;
+    RenderOutput& output;
+    juce::WaitableEvent& outputRendered;
+    juce::WaitableEvent& outputConsumed;
+
+    std::array<float, RENDER_CHUNK_FRAMES> outL, outR;
+};
+
+juce::int64 runRenderJob(ONNXMorpherInferenceThread& engine, RenderInput& input, RenderOutput& output, const RenderParameters& parameters)
+{
+    auto renderer = std::make_unique<OfflineMorpherRenderer>(engine);
+    renderer->setParameters(parameters.harmony, parameters.rhythm, parameters.sourceGain, parameters.sidechainGain);
+
+    // The render loop waits on workAvailable, which both the reader (new input)
+    // and the writer (free output space) signal.
+    juce::WaitableEvent workAvailable, inputConsumed, outputRendered;
+    auto reader = std::make_unique<RenderInputThread>(*renderer, input, workAvailable, inputConsumed);
+    auto writer = std::make_unique<RenderOutputThread>(*renderer, output, outputRendered, workAvailable);
+    reader->startThread();
+    writer->startThread();
+
+    while (!renderer->isFinished() and !writer->writeFailed)
+    {
+        if (renderer->canRenderWindow())
+        {
+            renderer->renderNextWindow();
+            inputConsumed.signal();
+            outputRendered.signal();
+        }
+        else if (!writer->isThreadRunning())
+        {
+            break;
+        }
+        else
+        {
+            workAvailable.wait(WAIT_TIMEOUT_MS);
+        }
+    }
+
+    // The writer exits on its own once everything is written or the output failed
+    writer->waitForThreadToExit(-1);
+    reader->stopThread(1000);
+    return writer->writeFailed ? -1 : (juce::int64)writer->numFramesWritten;
+}
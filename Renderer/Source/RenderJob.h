@@ -0,0 +1,48 @@
+//
+//  RenderJob.h
+//  HARDRender
+//
+
+#ifndef RenderJob_h
+#define RenderJob_h
+
+#include <JuceHeader.h>
+#include "../../Source/OfflineRenderer.h"
+
+static const int RENDER_CHUNK_FRAMES = 4096;
+
+// Where a render job pulls its source and sidechain audio from.
+class RenderInput
+{
+public:
+    virtual ~RenderInput() = default;
+    // Fills up to maxFrames samples per channel and returns how many were read.
+    // Returning fewer than maxFrames ends the input.
+    virtual int read(float sourceL[], float sourceR[], float sidechainL[], float sidechainR[], int maxFrames) = 0;
+};
+
+// Where a render job pushes its output to.
+class RenderOutput
+{
+public:
+    virtual ~RenderOutput() = default;
+    // Returns false if the destination cannot take any more data.
+    virtual bool write(const float outL[], const float outR[], int numFrames) = 0;
+    virtual void finish() {}
+};
+
+struct RenderParameters
+{
+    float harmony = 0.0f;
+    float rhythm = 0.0f;
+    float sourceGain = 1.0f;
+    float sidechainGain = 1.0f;
+};
+
+// Renders input to output with the processBlock windowing. A reader thread
+// fills the renderer, the calling thread runs inference and a writer thread
+// drains the output, so memory use does not depend on the length of the job.
+// Returns the number of frames written, or -1 if the output failed.
+juce::int64 runRenderJob(ONNXMorpherInferenceThread& engine, RenderInput& input, RenderOutput& output, const RenderParameters& parameters);
+
+#endif /* RenderJob_h */
@@ -0,0 +1,632 @@
+//
+//  ARADocumentController.cpp
+//  HARD
+//
+
+#include "ARADocumentController.h"
+#include "RtLog.h"
+
+#if JucePlugin_Enable_ARA
+
+static const int WINDOW_SAMPLES = ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES + ONNXMorpherInferenceThread::DNN_INPUT_CACHE_SAMPLES;
+static const int DROP_HEAD_SAMPLES = ONNXMorpherInferenceThread::DNN_OUTPUT_DROP_HEAD_SAMPLES;
+// Input samples before the first output sample of a window (see OfflineMorpherRenderer)
+static const int LEAD_IN_SAMPLES = DROP_HEAD_SAMPLES + ONNXMorpherInferenceThread::OVERLAP_SAMPLES;
+
+//==============================================================================
+ARARenderedRegion::ARARenderedRegion(juce::ARAPlaybackRegion* region, bool sidechain)
+:playbackRegion(region), isSidechain(sidechain)
+{
+    audioSource = region->getAudioModification<juce::ARAAudioModification>()->getAudioSource<juce::ARAAudioSource>();
+    double sampleRate = audioSource->getSampleRate();
+    playbackStart = region->getStartInPlaybackSamples(sampleRate);
+    length = juce::jmax((juce::int64)0, region->getEndInPlaybackSamples(sampleRate) - playbackStart);
+    sourceStart = region->getStartInAudioModificationSamples();
+}
+
+bool ARARenderedRegion::hasSamePlacement(const ARARenderedRegion& other) const
+{
+    return (audioSource == other.audioSource) and (isSidechain == other.isSidechain)
+       and (playbackStart == other.playbackStart) and (sourceStart == other.sourceStart)
+       and (length == other.length) and (contentVersion == other.contentVersion);
+}
+
+void ARARenderedRegion::allocate()
+{
+    int numWindows = getNumWindows();
+    rendered.setSize(2, (int)length);
+    rendered.clear();
+    if (!isSidechain)
+    {
+        heads.setSize(2, numWindows*OVERLAP_SAMPLES);
+        tails.setSize(2, numWindows*OVERLAP_SAMPLES);
+        staging.setSize(2, HOP_SAMPLES + OVERLAP_SAMPLES);
+    }
+    windowRendered.assign((size_t)numWindows, false);
+    dirtyWindows = std::make_unique<std::atomic<bool>[]>((size_t)numWindows);
+    markAllDirty();
+}
+
+juce::Range<juce::int64> ARARenderedRegion::getWindowInputRange(int k) const
+{
+    juce::int64 start = playbackStart + (juce::int64)k*HOP_SAMPLES - LEAD_IN_SAMPLES;
+    return {start, start + WINDOW_SAMPLES};
+}
+
+int ARARenderedRegion::getWindowAt(juce::int64 playbackPosition) const
+{
+    if (!getPlaybackRange().contains(playbackPosition))
+    {
+        return 0;
+    }
+    return (int)((playbackPosition - playbackStart)/HOP_SAMPLES);
+}
+
+juce::int64 ARARenderedRegion::getRenderPriority(juce::int64 playhead) const
+{
+    if (playbackStart + length > playhead)
+    {
+        return juce::jmax((juce::int64)0, playbackStart - playhead);
+    }
+    return std::numeric_limits<juce::int64>::max()/2 + (playhead - playbackStart - length);
+}
+
+void ARARenderedRegion::markDirty(int firstWindow, int numWindows)
+{
+    int end = juce::jmin(getNumWindows(), firstWindow + numWindows);
+    for (int k = juce::jmax(0, firstWindow); k < end; k++)
+    {
+        dirtyWindows[k] = true;
+    }
+    hasDirtyWindows = true;
+}
+
+int ARARenderedRegion::takeDirtyWindow(int firstWindow)
+{
+    // Cleared before scanning, so windows marked during the scan are not lost
+    if (!hasDirtyWindows.exchange(false))
+    {
+        return -1;
+    }
+    const int numWindows = getNumWindows();
+    for (int i = 0; i < numWindows; i++)
+    {
+        int k = (firstWindow + i) % numWindows;
+        if (dirtyWindows[k].exchange(false))
+        {
+            hasDirtyWindows = true;
+            return k;
+        }
+    }
+    return -1;
+}
+
+bool ARARenderedRegion::setParameters(float newHarmony, float newRhythm, float newSourceGain, float newSidechainGain)
+{
+    const float tolerance = 1.0e-4f;
+    if ((std::abs(harmony - newHarmony) < tolerance) and (std::abs(rhythm - newRhythm) < tolerance)
+        and (std::abs(sourceGain - newSourceGain) < tolerance) and (std::abs(sidechainGain - newSidechainGain) < tolerance))
+    {
+        return false;
+    }
+    harmony = newHarmony;
+    rhythm = newRhythm;
+    sourceGain = newSourceGain;
+    sidechainGain = newSidechainGain;
+    markAllDirty();
+    return true;
+}
+
+void ARARenderedRegion::readPlayback(juce::AudioBuffer<float>& buffer, juce::int64 blockStart, int numSamples)
+{
+    auto overlap = getPlaybackRange().getIntersectionWith({blockStart, blockStart + numSamples});
+    if (overlap.isEmpty())
+    {
+        return;
+    }
+    const juce::SpinLock::ScopedLockType lock(bufferLock);
+    for (int ch = 0; ch < juce::jmin(2, buffer.getNumChannels()); ch++)
+    {
+        buffer.addFrom(ch, (int)(overlap.getStart() - blockStart), rendered, ch, (int)(overlap.getStart() - playbackStart), (int)overlap.getLength());
+    }
+}
+
+void ARARenderedRegion::readRendered(juce::Range<juce::int64> playbackRange, stereo_float out[])
+{
+    auto overlap = getPlaybackRange().getIntersectionWith(playbackRange);
+    for (juce::int64 t = overlap.getStart(); t < overlap.getEnd(); t++)
+    {
+        int i = (int)(t - playbackRange.getStart());
+        out[i].l += rendered.getSample(0, (int)(t - playbackStart));
+        out[i].r += rendered.getSample(1, (int)(t - playbackStart));
+    }
+}
+
+void ARARenderedRegion::storeSamples(juce::int64 start, const juce::AudioBuffer<float>& source, int numSamples)
+{
+    for (int done = 0; done < numSamples; done += PUBLISH_SLICE_SAMPLES)
+    {
+        const int numSlice = juce::jmin(PUBLISH_SLICE_SAMPLES, numSamples - done);
+        const juce::SpinLock::ScopedLockType lock(bufferLock);
+        for (int ch = 0; ch < 2; ch++)
+        {
+            rendered.copyFrom(ch, (int)start + done, source, juce::jmin(ch, source.getNumChannels()-1), done, numSlice);
+        }
+    }
+}
+
+void ARARenderedRegion::storeWindow(int k, const stereo_float windowOut[])
+{
+    // From the crossfade before the window to its end
+    const juce::int64 bodyStart = (juce::int64)k*HOP_SAMPLES;
+    const juce::int64 stagingStart = juce::jmax((juce::int64)0, bodyStart - OVERLAP_SAMPLES);
+    const juce::int64 stagingEnd = juce::jmin(length, bodyStart + HOP_SAMPLES);
+    for (int i = 0; i < HOP_SAMPLES; i++)
+    {
+        const stereo_float& value = windowOut[DROP_HEAD_SAMPLES + OVERLAP_SAMPLES + i];
+        if (i >= HOP_SAMPLES - OVERLAP_SAMPLES)
+        {
+            int j = k*OVERLAP_SAMPLES + i - (HOP_SAMPLES - OVERLAP_SAMPLES);
+            tails.setSample(0, j, value.l);
+            tails.setSample(1, j, value.r);
+        }
+        if (bodyStart + i < length)
+        {
+            staging.setSample(0, (int)(bodyStart + i - stagingStart), value.l);
+            staging.setSample(1, (int)(bodyStart + i - stagingStart), value.r);
+        }
+    }
+    for (int i = 0; i < OVERLAP_SAMPLES; i++)
+    {
+        heads.setSample(0, k*OVERLAP_SAMPLES + i, windowOut[DROP_HEAD_SAMPLES + i].l);
+        heads.setSample(1, k*OVERLAP_SAMPLES + i, windowOut[DROP_HEAD_SAMPLES + i].r);
+    }
+    windowRendered[(size_t)k] = true;
+    blendBoundary(k, staging, stagingStart);
+    blendBoundary(k + 1, staging, stagingStart);
+    if (stagingEnd > stagingStart)
+    {
+        storeSamples(stagingStart, staging, (int)(stagingEnd - stagingStart));
+    }
+}
+
+void ARARenderedRegion::blendBoundary(int k, juce::AudioBuffer<float>& destination, juce::int64 destinationStart)
+{
+    // Same crossfade as FifoBuffer::pushDataOverlap, between the tail of window k-1 and the head of window k
+    if ((k <= 0) or (k >= getNumWindows()))
+    {
+        return;
+    }
+    const juce::int64 start = (juce::int64)k*HOP_SAMPLES - OVERLAP_SAMPLES;
+    for (int i = 0; i < OVERLAP_SAMPLES and start + i < length; i++)
+    {
+        float weight = (float)i/(float)OVERLAP_SAMPLES;
+        for (int ch = 0; ch < 2; ch++)
+        {
+            float tail = windowRendered[(size_t)(k-1)] ? tails.getSample(ch, (k-1)*OVERLAP_SAMPLES + i) : 0.0f;
+            float head = heads.getSample(ch, k*OVERLAP_SAMPLES + i);
+            destination.setSample(ch, (int)(start + i - destinationStart), windowRendered[(size_t)k] ? tail*(1.0f-weight) + head*weight : tail);
+        }
+    }
+}
+
+//==============================================================================
+class HARDDocumentController::RenderThread: public juce::Thread
+{
+public:
+    explicit RenderThread(HARDDocumentController& c)
+    :juce::Thread("ARARenderThread"), controller(c)
+    {
+    }
+
+    // Also terminates a window being rendered, so teardown does not wait for it
+    void stop()
+    {
+        signalThreadShouldExit();
+        {
+            const juce::SpinLock::ScopedLockType lock(engineLock);
+            if (engine != nullptr)
+            {
+                engine->cancelInference();
+            }
+        }
+        stopThread(ONNXMorpherInferenceThread::SHUTDOWN_TIMEOUT_MS);
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            if (!renderNextWindow())
+            {
+                wait(-1);
+            }
+        }
+    }
+
+private:
+    bool renderNextWindow()
+    {
+        auto regions = controller.getRenderedRegions();
+        const juce::int64 playhead = controller.getPlayhead();
+        std::stable_sort(regions.begin(), regions.end(), [playhead](const auto& a, const auto& b)
+        {
+            return a->getRenderPriority(playhead) < b->getRenderPriority(playhead);
+        });
+        std::vector<std::shared_ptr<ARARenderedRegion>> sidechains;
+        for (auto& region : regions)
+        {
+            if (region->isSidechain)
+            {
+                sidechains.push_back(region);
+            }
+        }
+
+        // Sidechain copies first, the morphed regions read from them
+        for (bool sidechainPass : {true, false})
+        {
+            for (auto& region : regions)
+            {
+                // Regions are rendered once a playback renderer has reported its fader values
+                if ((region->isSidechain != sidechainPass) or (!sidechainPass and ((region->harmony < 0.0f) or engineFailed)))
+                {
+                    continue;
+                }
+                int k = region->takeDirtyWindow(region->getWindowAt(playhead));
+                if (k < 0)
+                {
+                    continue;
+                }
+                if ((engine == nullptr) and !sidechainPass)
+                {
+                    // Same environment as the plugin instances, so the first one created decides its pools
+                    auto settings = WorkerPolicy::openUserSettings();
+                    MorpherModel::Options options;
+                    options.environment = OrtEnvironment::getShared(OrtEnvironment::Options::fromSettings(*settings, WorkerPolicy::fromSettings(*settings)));
+                    std::unique_ptr<ONNXMorpherInferenceThread> newEngine;
+                    try
+                    {
+                        newEngine = std::make_unique<ONNXMorpherInferenceThread>(std::make_shared<MorpherModel>(ModelSource::getDefault(), options), false);
+                    }
+                    catch (const std::exception& e)
+                    {
+                        // Morphed regions stay silent; sidechain copies still render
+                        engineFailed = true;
+                        RtLog::writeText(RtLog::Category::model, RtLog::Level::error, "ARA rendering stopped, the model failed to load: {s}.", juce::String(e.what()));
+                        continue;
+                    }
+                    const juce::SpinLock::ScopedLockType lock(engineLock);
+                    engine = std::move(newEngine);
+                }
+                controller.renderWindow(engine.get(), *region, k, sidechains);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    HARDDocumentController& controller;
+    juce::SharedResourcePointer<RtLog> rtLog;
+    juce::SpinLock engineLock;
+    std::unique_ptr<ONNXMorpherInferenceThread> engine;
+    bool engineFailed = false;
+};
+
+//==============================================================================
+HARDDocumentController::~HARDDocumentController()
+{
+    stopTimer();
+    if (renderThread != nullptr)
+    {
+        renderThread->stop();
+    }
+}
+
+juce::ARADocument* HARDDocumentController::doCreateDocument() noexcept
+{
+    auto* document = ARADocumentControllerSpecialisation::doCreateDocument();
+    document->addListener(this);
+    renderThread = std::make_unique<RenderThread>(*this);
+    renderThread->startThread();
+    return document;
+}
+
+juce::ARAPlaybackRenderer* HARDDocumentController::doCreatePlaybackRenderer() noexcept
+{
+    return new HARDPlaybackRenderer(getDocumentController());
+}
+
+bool HARDDocumentController::doRestoreObjectsFromStream(juce::ARAInputStream&, const juce::ARARestoreObjectsFilter*) noexcept
+{
+    // Nothing is archived, the rendered audio is recreated from the document
+    return true;
+}
+
+bool HARDDocumentController::doStoreObjectsToStream(juce::ARAOutputStream&, const juce::ARAStoreObjectsFilter*) noexcept
+{
+    return true;
+}
+
+void HARDDocumentController::didEndEditing(juce::ARADocument* document)
+{
+    updateRenderedRegions(document);
+}
+
+void HARDDocumentController::didAddAudioSourceToDocument(juce::ARADocument*, juce::ARAAudioSource* audioSource)
+{
+    audioSource->addListener(this);
+    auto reader = std::make_unique<juce::ARAAudioSourceReader>(audioSource);
+    const juce::ScopedLock lock(audioAccessLock);
+    contentVersions[audioSource] = 0;
+    readers[audioSource] = std::move(reader);
+}
+
+void HARDDocumentController::didUpdateAudioSourceContent(juce::ARAAudioSource* audioSource, juce::ARAContentUpdateScopes scopeFlags)
+{
+    if (!scopeFlags.affectSamples())
+    {
+        return;
+    }
+    {
+        const juce::ScopedLock lock(audioAccessLock);
+        contentVersions[audioSource]++;
+    }
+    updateRenderedRegions(getDocument());
+}
+
+void HARDDocumentController::willDestroyAudioSource(juce::ARAAudioSource* audioSource)
+{
+    audioSource->removeListener(this);
+    // Waits for a window that is reading from this source to finish
+    std::unique_ptr<juce::ARAAudioSourceReader> reader;
+    {
+        const juce::ScopedLock lock(audioAccessLock);
+        contentVersions.erase(audioSource);
+        auto found = readers.find(audioSource);
+        if (found != readers.end())
+        {
+            reader = std::move(found->second);
+            readers.erase(found);
+        }
+    }
+}
+
+void HARDDocumentController::timerCallback()
+{
+    // A count of one is retiredRegions' own reference; the region is no longer in regionMap,
+    // so no other thread can pick it up again
+    retiredRegions.erase(std::remove_if(retiredRegions.begin(), retiredRegions.end(), [](const auto& region)
+    {
+        return region.use_count() == 1;
+    }), retiredRegions.end());
+    if (retiredRegions.empty())
+    {
+        stopTimer();
+    }
+}
+
+void HARDDocumentController::updateRenderedRegions(juce::ARADocument* document)
+{
+    std::map<juce::ARAPlaybackRegion*, std::shared_ptr<ARARenderedRegion>> oldMap;
+    {
+        const juce::SpinLock::ScopedLockType lock(regionLock);
+        oldMap = regionMap;
+    }
+
+    std::map<juce::ARAPlaybackRegion*, std::shared_ptr<ARARenderedRegion>> newMap;
+    juce::Array<juce::Range<juce::int64>> changedSidechainRanges;
+    for (auto* sequence : document->getRegionSequences<juce::ARARegionSequence>())
+    {
+        const char* name = sequence->getName();
+        bool isSidechain = juce::String::fromUTF8(name != nullptr ? name : "").startsWithIgnoreCase("sidechain");
+        for (auto* playbackRegion : sequence->getPlaybackRegions<juce::ARAPlaybackRegion>())
+        {
+            auto region = std::make_shared<ARARenderedRegion>(playbackRegion, isSidechain);
+            {
+                const juce::ScopedLock lock(audioAccessLock);
+                region->contentVersion = contentVersions[region->audioSource];
+            }
+
+            auto old = oldMap.find(playbackRegion);
+            if ((old != oldMap.end()) and old->second->hasSamePlacement(*region))
+            {
+                newMap[playbackRegion] = old->second;
+                continue;
+            }
+
+            region->allocate();
+            if (old != oldMap.end())
+            {
+                region->setParameters(old->second->harmony, old->second->rhythm, old->second->sourceGain, old->second->sidechainGain);
+                if (old->second->isSidechain)
+                {
+                    changedSidechainRanges.add(old->second->getPlaybackRange());
+                }
+            }
+            if (isSidechain)
+            {
+                changedSidechainRanges.add(region->getPlaybackRange());
+            }
+            newMap[playbackRegion] = region;
+        }
+    }
+    for (auto& old : oldMap)
+    {
+        if (old.second->isSidechain and (newMap.find(old.first) == newMap.end()))
+        {
+            changedSidechainRanges.add(old.second->getPlaybackRange());
+        }
+    }
+
+    // Only the windows that hear a changed sidechain region are re-rendered
+    for (auto& entry : newMap)
+    {
+        ARARenderedRegion& region = *entry.second;
+        if (region.isSidechain)
+        {
+            continue;
+        }
+        for (int k = 0; k < region.getNumWindows(); k++)
+        {
+            for (auto& range : changedSidechainRanges)
+            {
+                if (range.intersects(region.getWindowInputRange(k)))
+                {
+                    region.markDirty(k, 1);
+                    break;
+                }
+            }
+        }
+    }
+
+    {
+        const juce::SpinLock::ScopedLockType lock(regionLock);
+        std::swap(regionMap, newMap);
+    }
+    // Regions that went away may still be held by a playback renderer or the render thread
+    for (auto& entry : newMap)
+    {
+        auto current = regionMap.find(entry.first);
+        if ((current == regionMap.end()) or (current->second != entry.second))
+        {
+            retiredRegions.push_back(entry.second);
+        }
+    }
+    newMap.clear();
+    if (!retiredRegions.empty())
+    {
+        timerCallback();
+        if (!retiredRegions.empty())
+        {
+            startTimer(500);
+        }
+    }
+    requestRender();
+}
+
+std::shared_ptr<ARARenderedRegion> HARDDocumentController::findRenderedRegion(juce::ARAPlaybackRegion* region)
+{
+    const juce::SpinLock::ScopedLockType lock(regionLock);
+    auto found = regionMap.find(region);
+    return found != regionMap.end() ? found->second : nullptr;
+}
+
+std::vector<std::shared_ptr<ARARenderedRegion>> HARDDocumentController::getRenderedRegions()
+{
+    std::vector<std::shared_ptr<ARARenderedRegion>> regions;
+    const juce::SpinLock::ScopedLockType lock(regionLock);
+    for (auto& entry : regionMap)
+    {
+        regions.push_back(entry.second);
+    }
+    return regions;
+}
+
+void HARDDocumentController::requestRender()
+{
+    if (renderThread != nullptr)
+    {
+        renderThread->notify();
+    }
+}
+
+void HARDDocumentController::renderWindow(ONNXMorpherInferenceThread* engine, ARARenderedRegion& region, int k, const std::vector<std::shared_ptr<ARARenderedRegion>>& sidechains)
+{
+    // Sidechain regions are played back unchanged; a morphed window reads its
+    // source, silent outside the region
+    const juce::int64 windowStart = region.isSidechain ? (juce::int64)k*ARARenderedRegion::HOP_SAMPLES
+                                                       : (juce::int64)k*ARARenderedRegion::HOP_SAMPLES - LEAD_IN_SAMPLES;
+    const juce::int64 windowLength = region.isSidechain ? ARARenderedRegion::HOP_SAMPLES : WINDOW_SAMPLES;
+    auto sourceRange = juce::Range<juce::int64>(0, region.length).getIntersectionWith({windowStart, windowStart + windowLength});
+    {
+        // Only across the host reads, so edits on the message thread do not wait for inference
+        const juce::ScopedLock lock(audioAccessLock);
+        auto found = readers.find(region.audioSource);
+        if ((found == readers.end()) or !region.audioSource->isSampleAccessEnabled())
+        {
+            // Rendered again once the host re-enables sample access and edits the document
+            return;
+        }
+        if (!sourceRange.isEmpty())
+        {
+            sourceScratch.setSize(2, (int)sourceRange.getLength(), false, false, true);
+            found->second->read(&sourceScratch, 0, (int)sourceRange.getLength(), region.sourceStart + sourceRange.getStart(), true, true);
+        }
+    }
+
+    if (region.isSidechain)
+    {
+        if (!sourceRange.isEmpty())
+        {
+            region.storeSamples(sourceRange.getStart(), sourceScratch, (int)sourceRange.getLength());
+        }
+        return;
+    }
+
+    std::fill(input1.begin(), input1.end(), stereo_float{0.0f, 0.0f});
+    if (!sourceRange.isEmpty())
+    {
+        int offset = (int)(sourceRange.getStart() - windowStart);
+        copyArrayMonoToStereo(sourceScratch.getWritePointer(0), sourceScratch.getWritePointer(1), &input1[offset], (int)sourceRange.getLength());
+    }
+
+    // Sidechain: everything on sidechain tracks at the same song position
+    std::fill(input2.begin(), input2.end(), stereo_float{0.0f, 0.0f});
+    auto songRange = region.getWindowInputRange(k);
+    for (auto& sidechain : sidechains)
+    {
+        sidechain->readRendered(songRange, input2.data());
+    }
+
+    engine->renderWindow(input1.data(), input2.data(), region.rhythm, region.harmony, region.sourceGain, region.sidechainGain, output.data());
+    region.storeWindow(k, output.data());
+}
+
+//==============================================================================
+void HARDPlaybackRenderer::setParameters(float harmony, float rhythm, float sourceGain, float sidechainGain)
+{
+    harmonyValue = harmony;
+    rhythmValue = rhythm;
+    sourceGainValue = sourceGain;
+    sidechainGainValue = sidechainGain;
+}
+
+bool HARDPlaybackRenderer::processBlock(juce::AudioBuffer<float>& buffer, juce::AudioProcessor::Realtime, const juce::AudioPlayHead::PositionInfo& positionInfo) noexcept
+{
+    buffer.clear();
+    auto* controller = juce::ARADocumentControllerSpecialisation::getSpecialisedDocumentController<HARDDocumentController>(getDocumentController());
+
+    auto timeInSamples = positionInfo.getTimeInSamples();
+    bool isPlaying = positionInfo.getIsPlaying() and timeInSamples.hasValue();
+    if (timeInSamples.hasValue())
+    {
+        controller->setPlayhead(*timeInSamples);
+    }
+
+    for (auto* playbackRegion : getPlaybackRegions())
+    {
+        auto region = controller->findRenderedRegion(playbackRegion);
+        if (region == nullptr)
+        {
+            continue;
+        }
+        // Fader values are tracked even while stopped, so re-rendering starts right away
+        if (!region->isSidechain and region->setParameters(harmonyValue, rhythmValue, sourceGainValue, sidechainGainValue))
+        {
+            controller->requestRender();
+        }
+        if (isPlaying)
+        {
+            region->readPlayback(buffer, *timeInSamples, buffer.getNumSamples());
+        }
+    }
+    return true;
+}
+
+//==============================================================================
+const ARA::ARAFactory* JUCE_CALLTYPE createARAFactory()
+{
+    return juce::ARADocumentControllerSpecialisation::createARAFactory<HARDDocumentController>();
+}
+
+#endif
@@ -0,0 +1,158 @@
+//
+//  ARADocumentController.h
+//  HARD
+//
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#if JucePlugin_Enable_ARA
+
+#include "ONNXInferenceThread.hpp"
+
+// Render-ahead for ARA hosts.
+//
+// With ARA the plugin sees whole clips, so instead of running the model in the
+// audio callback, HARDDocumentController renders every playback region in the
+// background into memory and HARDPlaybackRenderer just copies the result out at
+// zero latency.
+//
+// Regions on tracks (region sequences) whose name starts with "Sidechain" provide
+// the sidechain: they are played back unchanged and mixed as the sidechain input of
+// every other region at the same song position. Only windows whose source audio,
+// sidechain audio or placement changed are re-rendered; a fader change re-renders
+// the regions of that plugin instance.
+
+struct ARARenderedRegion
+{
+    static const int HOP_SAMPLES = ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES;
+    static const int OVERLAP_SAMPLES = ONNXMorpherInferenceThread::OVERLAP_SAMPLES;
+
+    ARARenderedRegion(juce::ARAPlaybackRegion* region, bool isSidechain);
+
+    // Playback/source placement, snapshotted on the message thread
+    juce::ARAPlaybackRegion* playbackRegion;
+    juce::ARAAudioSource* audioSource;
+    bool isSidechain;
+    juce::int64 playbackStart;
+    juce::int64 sourceStart;
+    juce::int64 length;
+    int contentVersion = 0;
+
+    bool hasSamePlacement(const ARARenderedRegion& other) const;
+    // Allocates the render buffers and marks everything dirty; snapshots that
+    // only serve as a comparison are never allocated.
+    void allocate();
+    juce::Range<juce::int64> getPlaybackRange() const {return {playbackStart, playbackStart + length};}
+    int getNumWindows() const {return (int)((length + HOP_SAMPLES - 1)/HOP_SAMPLES);}
+    // The window playing at playbackPosition, or 0 outside the region
+    int getWindowAt(juce::int64 playbackPosition) const;
+    // Orders regions for rendering: those at or after the playhead by how soon they play, then those behind it
+    juce::int64 getRenderPriority(juce::int64 playhead) const;
+    // Song time range whose sidechain audio affects window k
+    juce::Range<juce::int64> getWindowInputRange(int k) const;
+
+    void markDirty(int firstWindow, int numWindows);
+    void markAllDirty() {markDirty(0, getNumWindows());}
+    // Returns and clears the first dirty window from firstWindow on, wrapping around, or -1
+    int takeDirtyWindow(int firstWindow);
+    bool setParameters(float harmony, float rhythm, float sourceGain, float sidechainGain);
+
+    // Copies the rendered samples overlapping [blockStart, blockStart+numSamples) in playback time
+    void readPlayback(juce::AudioBuffer<float>& buffer, juce::int64 blockStart, int numSamples);
+    // Adds the rendered samples overlapping playbackRange to out, which starts at playbackRange.getStart().
+    // Render thread, which is the only writer, so it does not lock.
+    void readRendered(juce::Range<juce::int64> playbackRange, stereo_float out[]);
+    // Copies into rendered in slices of PUBLISH_SLICE_SAMPLES, each under its own short lock,
+    // so readPlayback on the audio thread never waits for a whole window
+    void storeSamples(juce::int64 start, const juce::AudioBuffer<float>& source, int numSamples);
+    // Stores the output of window k and re-blends the overlaps with its neighbours. The window is
+    // assembled in staging first, so only the copy into rendered holds the lock.
+    void storeWindow(int k, const stereo_float windowOut[]);
+    // Writes the crossfade before window k to destination, which starts at destinationStart
+    void blendBoundary(int k, juce::AudioBuffer<float>& destination, juce::int64 destinationStart);
+    static const int PUBLISH_SLICE_SAMPLES = 512;
+
+    std::unique_ptr<std::atomic<bool>[]> dirtyWindows;
+    std::atomic<bool> hasDirtyWindows{false};
+    std::atomic<float> harmony{-1.0f}, rhythm{-1.0f}, sourceGain{1.0f}, sidechainGain{1.0f};
+
+    juce::SpinLock bufferLock;
+    juce::AudioBuffer<float> rendered;
+    // Render thread only: un-blended window edges for the crossfades, and the window being stored
+    juce::AudioBuffer<float> heads;
+    juce::AudioBuffer<float> tails;
+    juce::AudioBuffer<float> staging;
+    std::vector<bool> windowRendered;
+};
+
+class HARDDocumentController: public juce::ARADocumentControllerSpecialisation,
+                              private juce::ARADocument::Listener,
+                              private juce::ARAAudioSource::Listener,
+                              private juce::Timer
+{
+public:
+    using ARADocumentControllerSpecialisation::ARADocumentControllerSpecialisation;
+    ~HARDDocumentController() override;
+
+    // Called from the audio thread by the playback renderers
+    std::shared_ptr<ARARenderedRegion> findRenderedRegion(juce::ARAPlaybackRegion* region);
+    void requestRender();
+    // Rendering starts from the window at the playhead
+    void setPlayhead(juce::int64 playbackPosition) {playhead.store(playbackPosition, std::memory_order_relaxed);}
+    juce::int64 getPlayhead() const {return playhead.load(std::memory_order_relaxed);}
+
+protected:
+    juce::ARADocument* doCreateDocument() noexcept override;
+    juce::ARAPlaybackRenderer* doCreatePlaybackRenderer() noexcept override;
+    bool doRestoreObjectsFromStream(juce::ARAInputStream& input, const juce::ARARestoreObjectsFilter* filter) noexcept override;
+    bool doStoreObjectsToStream(juce::ARAOutputStream& output, const juce::ARAStoreObjectsFilter* filter) noexcept override;
+
+private:
+    class RenderThread;
+
+    void didEndEditing(juce::ARADocument* document) override;
+    void didAddAudioSourceToDocument(juce::ARADocument* document, juce::ARAAudioSource* audioSource) override;
+    void didUpdateAudioSourceContent(juce::ARAAudioSource* audioSource, juce::ARAContentUpdateScopes scopeFlags) override;
+    void willDestroyAudioSource(juce::ARAAudioSource* audioSource) override;
+    // Releases retired regions nobody else holds any more
+    void timerCallback() override;
+
+    void updateRenderedRegions(juce::ARADocument* document);
+    std::vector<std::shared_ptr<ARARenderedRegion>> getRenderedRegions();
+    // Called on the render thread; engine may be null for sidechain regions
+    void renderWindow(ONNXMorpherInferenceThread* engine, ARARenderedRegion& region, int k, const std::vector<std::shared_ptr<ARARenderedRegion>>& sidechains);
+
+    // Guards regionMap against the audio thread, held only for lookups and swaps
+    juce::SpinLock regionLock;
+    std::map<juce::ARAPlaybackRegion*, std::shared_ptr<ARARenderedRegion>> regionMap;
+    // Regions replaced in regionMap, kept on the message thread until the audio and render
+    // threads have let go of them, so their buffers are never freed on the audio thread
+    std::vector<std::shared_ptr<ARARenderedRegion>> retiredRegions;
+    std::atomic<juce::int64> playhead{0};
+    std::map<juce::ARAAudioSource*, int> contentVersions;
+    // Created on the message thread when a source is added and reused by every window
+    std::map<juce::ARAAudioSource*, std::unique_ptr<juce::ARAAudioSourceReader>> readers;
+    // Held by the render thread while it reads host audio, so sources are not destroyed meanwhile
+    juce::CriticalSection audioAccessLock;
+    std::unique_ptr<RenderThread> renderThread;
+    
+    // Render thread scratch
+    juce::AudioBuffer<float> sourceScratch;
+    std::array<stereo_float, ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES+ONNXMorpherInferenceThread::DNN_INPUT_CACHE_SAMPLES> input1, input2, output;
+};
+
+class HARDPlaybackRenderer: public juce::ARAPlaybackRenderer
+{
+public:
+    using ARAPlaybackRenderer::ARAPlaybackRenderer;
+
+    void setParameters(float harmony, float rhythm, float sourceGain, float sidechainGain);
+    bool processBlock(juce::AudioBuffer<float>& buffer, juce::AudioProcessor::Realtime realtime, const juce::AudioPlayHead::PositionInfo& positionInfo) noexcept override;
+
+private:
+    std::atomic<float> harmonyValue{0.0f}, rhythmValue{0.0f}, sourceGainValue{1.0f}, sidechainGainValue{1.0f};
+};
+
+#endif
@@ -0,0 +1,215 @@
+//
+//  CallbackMonitor.cpp
+//  HARD
+//
+
+#include "CallbackMonitor.h"
+
+const char* CallbackMonitor::getStageName(int stage)
+{
+    switch (stage)
+    {
+        case input: return "input";
+        case request: return "request";
+        case spin: return "spin";
+        case output: return "output";
+        default: return "other";
+    }
+}
+
+CallbackMonitor::CallbackMonitor()
+    : msPerTick(1000.0/(double)juce::Time::getHighResolutionTicksPerSecond())
+{
+}
+
+CallbackMonitor::ScopedCallback::ScopedCallback(CallbackMonitor& m, int numSamples, double sampleRate)
+    : monitor(m), active(m.enabled.load(std::memory_order_relaxed) and (sampleRate > 0.0))
+{
+    if (!active)
+    {
+        return;
+    }
+    const juce::int64 now = juce::Time::getHighResolutionTicks();
+    monitor.currentDeadlineMs = numSamples*1000.0/sampleRate;
+    if (monitor.lastStartTicks != 0)
+    {
+        // A long gap is a stop or a disabled spell, not jitter
+        const double intervalMs = monitor.ticksToMs(now - monitor.lastStartTicks);
+        if (intervalMs < monitor.lastDeadlineMs*10.0)
+        {
+            monitor.jitter.record(std::abs(intervalMs - monitor.lastDeadlineMs));
+        }
+    }
+    monitor.lastStartTicks = now;
+    monitor.lastDeadlineMs = monitor.currentDeadlineMs;
+    monitor.startTicks = now;
+    monitor.markTicks = now;
+    monitor.lockWaitTicks = 0;
+    monitor.stageTicks.fill(0);
+    monitor.inCallback = true;
+}
+
+CallbackMonitor::ScopedCallback::~ScopedCallback()
+{
+    if (active)
+    {
+        mark(other);
+        monitor.finishCallback();
+    }
+}
+
+void CallbackMonitor::ScopedCallback::mark(Stage stage)
+{
+    if (!active)
+    {
+        return;
+    }
+    const juce::int64 now = juce::Time::getHighResolutionTicks();
+    monitor.stageTicks[(size_t)stage] += now - monitor.markTicks;
+    monitor.markTicks = now;
+}
+
+CallbackMonitor::ScopedTimedLock::ScopedTimedLock(const juce::CriticalSection& l, CallbackMonitor& monitor)
+    : lock(l)
+{
+    if (!monitor.inCallback)
+    {
+        lock.enter();
+        return;
+    }
+    const juce::int64 start = juce::Time::getHighResolutionTicks();
+    lock.enter();
+    monitor.lockWaitTicks += juce::Time::getHighResolutionTicks() - start;
+}
+
+void CallbackMonitor::finishCallback()
+{
+    inCallback = false;
+    const double durationMs = ticksToMs(markTicks - startTicks);
+    const double lockWaitMs = ticksToMs(lockWaitTicks);
+    duration.record(durationMs);
+    lockWait.record(lockWaitMs);
+    spinWait.record(ticksToMs(stageTicks[spin]));
+    deadlineMs.store(currentDeadlineMs, std::memory_order_relaxed);
+    const juce::int64 callback = numCallbacks.fetch_add(1, std::memory_order_relaxed);
+    if (durationMs > currentDeadlineMs)
+    {
+        numLate.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (durationMs <= currentDeadlineMs*budget.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    numOverruns.fetch_add(1, std::memory_order_relaxed);
+    if (overrunFifo.getFreeSpace() < 1)
+    {
+        numOverrunsDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    overrunFifo.write(1).forEach([&](int index)
+    {
+        Overrun& overrun = overrunSlots[(size_t)index];
+        overrun.callback = callback;
+        overrun.durationMs = durationMs;
+        overrun.deadlineMs = currentDeadlineMs;
+        overrun.lockWaitMs = lockWaitMs;
+        for (size_t s = 0; s < numStages; s++)
+        {
+            overrun.stageMs[s] = ticksToMs(stageTicks[s]);
+        }
+    });
+}
+
+void CallbackMonitor::drainOverruns()
+{
+    overrunFifo.read(overrunFifo.getNumReady()).forEach([this](int index)
+    {
+        overrunLog.add(overrunSlots[(size_t)index]);
+    });
+    if (overrunLog.size() > MAX_LOGGED_OVERRUNS)
+    {
+        overrunLog.removeRange(0, overrunLog.size() - MAX_LOGGED_OVERRUNS);
+    }
+}
+
+juce::Array<CallbackMonitor::Overrun> CallbackMonitor::getOverrunLog()
+{
+    const juce::ScopedLock sl(logLock);
+    drainOverruns();
+    return overrunLog;
+}
+
+CallbackMonitor::Snapshot CallbackMonitor::getSnapshot() const
+{
+    Snapshot snapshot;
+    snapshot.duration = duration.getSummary();
+    snapshot.lockWait = lockWait.getSummary();
+    snapshot.spin = spinWait.getSummary();
+    snapshot.jitter = jitter.getSummary();
+    snapshot.numCallbacks = numCallbacks;
+    snapshot.numOverruns = numOverruns;
+    snapshot.numLate = numLate;
+    snapshot.numOverrunsDropped = numOverrunsDropped;
+    snapshot.deadlineMs = deadlineMs;
+    return snapshot;
+}
+
+void CallbackMonitor::reset()
+{
+    const juce::ScopedLock sl(logLock);
+    drainOverruns();
+    overrunLog.clear();
+    duration.reset();
+    lockWait.reset();
+    spinWait.reset();
+    jitter.reset();
+    numCallbacks = 0;
+    numOverruns = 0;
+    numLate = 0;
+    numOverrunsDropped = 0;
+}
+
+int CallbackMonitor::Overrun::getSlowestStage() const
+{
+    return (int)(std::max_element(stageMs.begin(), stageMs.end()) - stageMs.begin());
+}
+
+juce::String CallbackMonitor::Overrun::toString() const
+{
+    juce::String text;
+    text << "callback " << callback << ": " << juce::String(durationMs, 2) << " of " << juce::String(deadlineMs, 2) << " ms, slowest "
+         << getStageName(getSlowestStage()) << " (";
+    for (int s = 0; s < numStages; s++)
+    {
+        text << (s > 0 ? ", " : "") << getStageName(s) << " " << juce::String(stageMs[(size_t)s], 2);
+    }
+    text << "; lock wait " << juce::String(lockWaitMs, 2) << ")";
+    return text;
+}
+
+juce::String CallbackMonitor::Snapshot::toString() const
+{
+    juce::String text;
+    text << "callbacks: " << numCallbacks << ", " << numOverruns << " over budget, " << numLate << " past the "
+         << juce::String(deadlineMs, 2) << " ms deadline\n";
+    text << "  duration    " << duration.toString() << "\n";
+    text << "  lock wait   " << lockWait.toString() << "\n";
+    text << "  spin        " << spin.toString() << "\n";
+    text << "  jitter      " << jitter.toString();
+    return text;
+}
+
+juce::var CallbackMonitor::Snapshot::toVar() const
+{
+    auto* object = new juce::DynamicObject();
+    object->setProperty("numCallbacks", numCallbacks);
+    object->setProperty("numOverruns", numOverruns);
+    object->setProperty("numLate", numLate);
+    object->setProperty("numOverrunsDropped", numOverrunsDropped);
+    object->setProperty("deadlineMs", deadlineMs);
+    object->setProperty("duration", duration.toVar());
+    object->setProperty("lockWait", lockWait.toVar());
+    object->setProperty("spin", spin.toVar());
+    object->setProperty("jitter", jitter.toVar());
+    return juce::var(object);
+}
@@ -0,0 +1,133 @@
+//
+//  CallbackMonitor.h
+//  HARD
+//
+
+#ifndef CallbackMonitor_h
+#define CallbackMonitor_h
+
+#include <JuceHeader.h>
+#include "InferenceTelemetry.h"
+
+// Times the audio callback against its deadline (numSamples / sampleRate):
+// its duration, the time spent waiting for locks and spinning on the worker,
+// and the jitter of its start against the host's block period. Callbacks that
+// take more than the budget are logged with the time of each stage, so a
+// dropout can be traced to the stage that was slow.
+//
+// Everything the audio thread does is real-time safe: high-resolution tick
+// reads, relaxed atomics and a fixed-size FIFO for the log. While disabled,
+// a callback costs one atomic load.
+class CallbackMonitor
+{
+public:
+    enum Stage
+    {
+        other = 0,      // transport, activity and control tracking
+        input,          // pushing the block into the input FIFOs
+        request,        // handing a window to the worker
+        spin,           // waiting for a window that is late
+        output,         // reading the output FIFOs
+        numStages
+    };
+    static const char* getStageName(int stage);
+
+    struct Overrun
+    {
+        juce::int64 callback = 0;           // callbacks since the monitor was reset
+        double durationMs = 0.0;
+        double deadlineMs = 0.0;
+        double lockWaitMs = 0.0;
+        std::array<double, numStages> stageMs{};
+        int getSlowestStage() const;
+        juce::String toString() const;
+    };
+
+    struct Snapshot
+    {
+        LatencyHistogram::Summary duration, lockWait, spin, jitter;
+        juce::int64 numCallbacks = 0;
+        juce::int64 numOverruns = 0;        // over budget
+        juce::int64 numLate = 0;            // over the deadline itself
+        juce::int64 numOverrunsDropped = 0; // not logged because the log was not read in time
+        double deadlineMs = 0.0;            // of the last callback
+        juce::String toString() const;
+        juce::var toVar() const;
+    };
+
+    CallbackMonitor();
+
+    void setEnabled(bool shouldBeEnabled) {enabled = shouldBeEnabled;}
+    bool isEnabled() const {return enabled;}
+    // Fraction of the deadline above which a callback is logged
+    void setBudget(double fractionOfDeadline) {budget = fractionOfDeadline;}
+
+    // Times one audio callback from construction to destruction. Audio thread.
+    class ScopedCallback
+    {
+    public:
+        ScopedCallback(CallbackMonitor& monitor, int numSamples, double sampleRate);
+        ~ScopedCallback();
+        // The time since the previous mark (or the start) was spent in stage
+        void mark(Stage stage);
+    private:
+        CallbackMonitor& monitor;
+        const bool active;
+        JUCE_DECLARE_NON_COPYABLE(ScopedCallback)
+    };
+
+    // A juce::ScopedLock that adds its wait to the current callback. Only for
+    // locks taken on the audio thread inside a ScopedCallback.
+    class ScopedTimedLock
+    {
+    public:
+        ScopedTimedLock(const juce::CriticalSection& lock, CallbackMonitor& monitor);
+        ~ScopedTimedLock() {lock.exit();}
+    private:
+        const juce::CriticalSection& lock;
+        JUCE_DECLARE_NON_COPYABLE(ScopedTimedLock)
+    };
+
+    Snapshot getSnapshot() const;
+    // Overruns logged since the monitor was created or reset, oldest first, up
+    // to MAX_LOGGED_OVERRUNS. Message thread.
+    juce::Array<Overrun> getOverrunLog();
+    void reset();
+
+    static const int MAX_LOGGED_OVERRUNS = 256;
+
+private:
+    double ticksToMs(juce::int64 ticks) const {return (double)ticks*msPerTick;}
+    void finishCallback();
+    // Moves overruns from the audio thread's FIFO to the log
+    void drainOverruns();
+
+    const double msPerTick;
+    std::atomic<bool> enabled{false};
+    std::atomic<double> budget{0.8};
+
+    // The callback in progress; audio thread
+    bool inCallback = false;
+    juce::int64 startTicks = 0;
+    juce::int64 markTicks = 0;
+    juce::int64 lastStartTicks = 0;
+    juce::int64 lockWaitTicks = 0;
+    double currentDeadlineMs = 0.0;
+    double lastDeadlineMs = 0.0;
+    std::array<juce::int64, numStages> stageTicks{};
+
+    LatencyHistogram duration, lockWait, spinWait, jitter;
+    std::atomic<juce::int64> numCallbacks{0};
+    std::atomic<juce::int64> numOverruns{0};
+    std::atomic<juce::int64> numLate{0};
+    std::atomic<juce::int64> numOverrunsDropped{0};
+    std::atomic<double> deadlineMs{0.0};
+
+    static const int OVERRUN_FIFO_SIZE = 32;
+    juce::AbstractFifo overrunFifo{OVERRUN_FIFO_SIZE};
+    std::array<Overrun, OVERRUN_FIFO_SIZE> overrunSlots;
+    juce::CriticalSection logLock;
+    juce::Array<Overrun> overrunLog;
+};
+
+#endif /* CallbackMonitor_h */
@@ -10,6 +10,7 @@
 
 #include <JuceHeader.h>
 #include <array>
+#include <vector>
 
 typedef struct stereo_float
 {
@@ -103,7 +104,7 @@ inline void copyArrayStereoToMono(stereo_float arr_stereo[], float arr_l[], floa
 struct FifoBuffer
 {
     static const unsigned int BUFFER_SIZE = 65536;
-    std::array<stereo_float, BUFFER_SIZE> buffer={0.0};
+    std::vector<stereo_float> buffer = std::vector<stereo_float>(BUFFER_SIZE);
     juce::AbstractFifo abstractFifo{BUFFER_SIZE};
     
     void clearBuffer()
@@ -111,10 +112,29 @@ struct FifoBuffer
         abstractFifo.reset();
     }
     
+    // Frees the storage of an idle FIFO. It must be restored before the next push or read.
+    void releaseStorage()
+    {
+        abstractFifo.reset();
+        std::vector<stereo_float>().swap(buffer);
+    }
+    
+    void restoreStorage()
+    {
+        buffer.assign(BUFFER_SIZE, {0.0f, 0.0f});
+    }
+    
     void fillZeros(int numData)
     {
-        stereo_float zeros[BUFFER_SIZE] = {0.0,0.0};
-        pushData(zeros, numData);
+        // Pushed in small chunks so this is safe on threads with a small stack
+        static const int ZERO_CHUNK_SIZE = 1024;
+        const stereo_float zeros[ZERO_CHUNK_SIZE] = {0.0,0.0};
+        while (numData > 0)
+        {
+            int numChunk = juce::jmin(numData, ZERO_CHUNK_SIZE);
+            pushData(zeros, numChunk);
+            numData -= numChunk;
+        }
     }
     
     void pushDataOverlap(stereo_float data[], int numData)
@@ -237,6 +257,11 @@ struct FifoBuffer
     {
         return abstractFifo.getNumReady();
     }
+    
+    int getFreeSpace()
+    {
+        return abstractFifo.getFreeSpace();
+    }
 };
 
 
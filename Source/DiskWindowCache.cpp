@@ -0,0 +1,398 @@
+//
+//  DiskWindowCache.cpp
+//  HARD
+//
+
+#include "DiskWindowCache.h"
+#include "WindowCache.h"
+
+#define CACHE_ENTRY_EXTENSION ".hwc"
+#define CACHE_NAMESPACE_INFO "namespace.txt"
+
+static const unsigned int WINDOW_SAMPLES = WindowCache::WINDOW_SAMPLES;
+
+// Native byte order; the cache is local to one machine
+struct EntryHeader
+{
+    char magic[4];
+    juce::uint8 encoding;
+    juce::uint8 numChannels;
+    juce::uint16 reserved;
+    juce::uint32 numSamples;
+    juce::uint32 payloadBytes;
+};
+
+static const char ENTRY_MAGIC[4] = {'H', 'W', 'C', '1'};
+
+static juce::uint16 floatToHalf(float value)
+{
+    juce::uint32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    juce::uint32 sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    juce::uint32 mantissa = bits & 0x7fffff;
+
+    if (exponent <= 0)
+    {
+        // Subnormal, or too small to represent
+        if (exponent < -10)
+        {
+            return (juce::uint16)sign;
+        }
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        juce::uint32 half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+        {
+            half++;
+        }
+        return (juce::uint16)(sign | half);
+    }
+    if (exponent >= 31)
+    {
+        return (juce::uint16)(sign | 0x7c00);
+    }
+    juce::uint32 half = sign | ((juce::uint32)exponent << 10) | (mantissa >> 13);
+    // Round to nearest; a carry into the exponent is still correct
+    if (mantissa & 0x1000)
+    {
+        half++;
+    }
+    return (juce::uint16)half;
+}
+
+static float halfToFloat(juce::uint16 half)
+{
+    juce::uint32 sign = (juce::uint32)(half & 0x8000) << 16;
+    int exponent = (half >> 10) & 0x1f;
+    juce::uint32 mantissa = half & 0x3ff;
+
+    if (exponent == 0)
+    {
+        float value = std::ldexp((float)mantissa, -24);
+        return sign != 0 ? -value : value;
+    }
+    juce::uint32 bits = (exponent == 31) ? (sign | 0x7f800000 | (mantissa << 13))
+                                         : (sign | ((juce::uint32)(exponent - 15 + 127) << 23) | (mantissa << 13));
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+DiskWindowCache::DiskWindowCache(const Options& o, const juce::String& modelHash)
+:juce::Thread("HARD disk cache"), options(o)
+{
+    for (int i = 0; i < MAX_PENDING_WRITES; i++)
+    {
+        slots[(size_t)i].output.resize(WINDOW_SAMPLES);
+        freeSlots.add(i);
+    }
+
+    // Everything that changes what a window renders to, besides the key itself
+    const juce::String geometry = "window=" + juce::String(WINDOW_SAMPLES)
+                                + " channels=2 steps=" + juce::String(WindowCache::PARAMETER_STEPS);
+    const juce::String description = "model=" + modelHash + " " + geometry;
+    juce::uint64 namespaceHash = WindowCache::hashBytes(description.toRawUTF8(), description.getNumBytesAsUTF8(), 0);
+    namespaceDirectory = options.directory.getChildFile(juce::String::toHexString((juce::int64)namespaceHash).paddedLeft('0', 16));
+
+    if (namespaceDirectory.createDirectory().wasOk())
+    {
+        auto info = namespaceDirectory.getChildFile(CACHE_NAMESPACE_INFO);
+        if (!info.existsAsFile())
+        {
+            info.replaceWithText(description);
+        }
+    }
+    startThread(juce::Thread::Priority::low);
+}
+
+DiskWindowCache::~DiskWindowCache()
+{
+    signalThreadShouldExit();
+    notify();
+    stopThread(-1);
+    writePending();
+}
+
+juce::File DiskWindowCache::getDefaultDirectory()
+{
+    return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory).getChildFile("HARD/RenderCache");
+}
+
+juce::File DiskWindowCache::getEntryFile(juce::uint64 key) const
+{
+    return namespaceDirectory.getChildFile(juce::String::toHexString((juce::int64)key).paddedLeft('0', 16) + CACHE_ENTRY_EXTENSION);
+}
+
+bool DiskWindowCache::hasKey(juce::uint64 key)
+{
+    const juce::SpinLock::ScopedLockType sl(keysLock);
+    return keysListed and (keys.count(key) > 0);
+}
+
+void DiskWindowCache::setHasKey(juce::uint64 key, bool hasEntry)
+{
+    const juce::SpinLock::ScopedLockType sl(keysLock);
+    if (hasEntry)
+    {
+        keys.insert(key);
+    }
+    else
+    {
+        keys.erase(key);
+    }
+}
+
+void DiskWindowCache::listKeys()
+{
+    std::unordered_set<juce::uint64> listed;
+    for (const auto& entry : namespaceDirectory.findChildFiles(juce::File::findFiles, false, "*" CACHE_ENTRY_EXTENSION))
+    {
+        listed.insert((juce::uint64)entry.getFileNameWithoutExtension().getHexValue64());
+    }
+    const juce::SpinLock::ScopedLockType sl(keysLock);
+    // Keys written meanwhile are kept
+    keys.insert(listed.begin(), listed.end());
+    keysListed = true;
+}
+
+bool DiskWindowCache::load(juce::uint64 key, stereo_float output[])
+{
+    if (!hasKey(key))
+    {
+        return false;
+    }
+    const juce::File file = getEntryFile(key);
+    juce::MemoryMappedFile mapped(file, juce::MemoryMappedFile::readOnly);
+    if ((mapped.getData() == nullptr) or (mapped.getSize() < sizeof(EntryHeader)))
+    {
+        // Pruned, possibly by another process
+        setHasKey(key, false);
+        return false;
+    }
+
+    EntryHeader header;
+    memcpy(&header, mapped.getData(), sizeof(header));
+    if ((memcmp(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) != 0) or (header.numChannels != 2)
+        or (header.numSamples != WINDOW_SAMPLES) or (mapped.getSize() < sizeof(EntryHeader) + header.payloadBytes))
+    {
+        return false;
+    }
+    const char* payload = static_cast<const char*>(mapped.getData()) + sizeof(EntryHeader);
+
+    if (header.encoding == (juce::uint8)Encoding::float16)
+    {
+        if (header.payloadBytes != WINDOW_SAMPLES*2*sizeof(juce::uint16))
+        {
+            return false;
+        }
+        for (unsigned int i = 0; i < WINDOW_SAMPLES; i++)
+        {
+            juce::uint16 half[2];
+            memcpy(half, payload + i*sizeof(half), sizeof(half));
+            output[i].l = halfToFloat(half[0]);
+            output[i].r = halfToFloat(half[1]);
+        }
+    }
+    else if (header.encoding == (juce::uint8)Encoding::deflate)
+    {
+        juce::MemoryInputStream compressed(payload, header.payloadBytes, false);
+        juce::GZIPDecompressorInputStream decompressor(compressed);
+        const int numBytes = (int)(sizeof(stereo_float)*WINDOW_SAMPLES);
+        if (decompressor.read(output, numBytes) != numBytes)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    // Modification time doubles as the last use for pruning
+    file.setLastModificationTime(juce::Time::getCurrentTime());
+    return true;
+}
+
+void DiskWindowCache::store(juce::uint64 key, const stereo_float output[])
+{
+    int slot = -1;
+    {
+        const juce::ScopedLock sl(queueLock);
+        if (!freeSlots.isEmpty())
+        {
+            slot = freeSlots.removeAndReturn(freeSlots.size() - 1);
+        }
+    }
+    if (slot < 0)
+    {
+        numDroppedWrites++;
+        return;
+    }
+    PendingWrite& pending = slots[(size_t)slot];
+    pending.key = key;
+    std::copy(output, output + WINDOW_SAMPLES, pending.output.begin());
+    {
+        const juce::ScopedLock sl(queueLock);
+        pendingSlots.add(slot);
+    }
+    notify();
+}
+
+void DiskWindowCache::run()
+{
+    listKeys();
+    while (!threadShouldExit())
+    {
+        wait(-1);
+        writePending();
+    }
+}
+
+void DiskWindowCache::writePending()
+{
+    for (;;)
+    {
+        int slot = -1;
+        {
+            const juce::ScopedLock sl(queueLock);
+            if (pendingSlots.isEmpty())
+            {
+                return;
+            }
+            slot = pendingSlots.removeAndReturn(0);
+        }
+        write(slots[(size_t)slot].key, slots[(size_t)slot].output.data());
+        const juce::ScopedLock sl(queueLock);
+        freeSlots.add(slot);
+    }
+}
+
+void DiskWindowCache::write(juce::uint64 key, const stereo_float output[])
+{
+    const juce::File file = getEntryFile(key);
+    if (file.existsAsFile())
+    {
+        setHasKey(key, true);
+        return;
+    }
+
+    EntryHeader header;
+    memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+    header.encoding = (juce::uint8)options.encoding;
+    header.numChannels = 2;
+    header.reserved = 0;
+    header.numSamples = WINDOW_SAMPLES;
+
+    encoded.setSize(sizeof(EntryHeader));
+    if (options.encoding == Encoding::float16)
+    {
+        encoded.setSize(sizeof(EntryHeader) + WINDOW_SAMPLES*2*sizeof(juce::uint16));
+        char* payload = static_cast<char*>(encoded.getData()) + sizeof(EntryHeader);
+        for (unsigned int i = 0; i < WINDOW_SAMPLES; i++)
+        {
+            const juce::uint16 half[2] = {floatToHalf(output[i].l), floatToHalf(output[i].r)};
+            memcpy(payload + i*sizeof(half), half, sizeof(half));
+        }
+    }
+    else
+    {
+        juce::MemoryOutputStream stream(encoded, true);
+        stream.setPosition(sizeof(EntryHeader));
+        {
+            juce::GZIPCompressorOutputStream compressor(stream, 9);
+            compressor.write(output, sizeof(stereo_float)*WINDOW_SAMPLES);
+        }
+        stream.flush();
+        encoded.setSize(stream.getDataSize());
+    }
+    header.payloadBytes = (juce::uint32)(encoded.getSize() - sizeof(EntryHeader));
+    memcpy(encoded.getData(), &header, sizeof(header));
+
+    // Written next to the entry and renamed, so readers never see a partial file
+    juce::TemporaryFile temporary(file);
+    if (!temporary.getFile().replaceWithData(encoded.getData(), encoded.getSize())
+        or !temporary.overwriteTargetFileWithTemporary())
+    {
+        return;
+    }
+    setHasKey(key, true);
+
+    if (totalBytes < 0)
+    {
+        totalBytes = 0;
+        for (const auto& summary : inspect(options.directory))
+        {
+            totalBytes += summary.numBytes;
+        }
+    }
+    else
+    {
+        totalBytes += (juce::int64)encoded.getSize();
+    }
+    if (totalBytes > options.maxBytes)
+    {
+        // Prune below the limit so this does not run on every store
+        const juce::int64 target = options.maxBytes - options.maxBytes/10;
+        totalBytes -= prune(options.directory, target);
+    }
+}
+
+juce::Array<DiskWindowCache::Summary> DiskWindowCache::inspect(const juce::File& directory)
+{
+    juce::Array<Summary> summaries;
+    for (const auto& namespaceDir : directory.findChildFiles(juce::File::findDirectories, false))
+    {
+        Summary summary;
+        summary.name = namespaceDir.getFileName();
+        summary.description = namespaceDir.getChildFile(CACHE_NAMESPACE_INFO).loadFileAsString().trim();
+        for (const auto& entry : namespaceDir.findChildFiles(juce::File::findFiles, false, "*" CACHE_ENTRY_EXTENSION))
+        {
+            juce::Time modified = entry.getLastModificationTime();
+            if ((summary.numEntries == 0) or (modified < summary.oldest))
+            {
+                summary.oldest = modified;
+            }
+            if ((summary.numEntries == 0) or (modified > summary.newest))
+            {
+                summary.newest = modified;
+            }
+            summary.numEntries++;
+            summary.numBytes += entry.getSize();
+        }
+        summaries.add(summary);
+    }
+    return summaries;
+}
+
+juce::int64 DiskWindowCache::prune(const juce::File& directory, juce::int64 maxBytes)
+{
+    struct Entry
+    {
+        juce::File file;
+        juce::Time modified;
+        juce::int64 size;
+    };
+    std::vector<Entry> entries;
+    juce::int64 total = 0;
+    for (const auto& file : directory.findChildFiles(juce::File::findFiles, true, "*" CACHE_ENTRY_EXTENSION))
+    {
+        entries.push_back({file, file.getLastModificationTime(), file.getSize()});
+        total += entries.back().size;
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {return a.modified < b.modified;});
+
+    juce::int64 numDeleted = 0;
+    for (const auto& entry : entries)
+    {
+        if (total - numDeleted <= maxBytes)
+        {
+            break;
+        }
+        if (entry.file.deleteFile())
+        {
+            numDeleted += entry.size;
+        }
+    }
+    return numDeleted;
+}
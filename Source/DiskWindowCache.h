@@ -0,0 +1,115 @@
+//
+//  DiskWindowCache.h
+//  HARD
+//
+
+#ifndef DiskWindowCache_h
+#define DiskWindowCache_h
+
+#include <JuceHeader.h>
+#include "DataStructure.h"
+#include "ModelSource.h"
+#include <array>
+#include <unordered_set>
+
+// Content-addressed store of model output windows on the local disk, shared by
+// all plugin instances and the offline renderer across sessions.
+//
+// Entries live in <directory>/<namespace>/<key>.hwc, where the namespace is a
+// hash of the model file and the window geometry, and the key is the
+// WindowCache key (input windows plus quantized fader/gain values). Each entry
+// is a small header followed by the interleaved stereo window, either as raw
+// float16 (read straight from a memory-mapped file) or deflated float32
+// (lossless). The least recently used entries are deleted once the directory
+// grows past maxBytes.
+//
+// store() only copies the window into one of MAX_PENDING_WRITES preallocated
+// slots; a low-priority writer thread encodes, writes and prunes, so the
+// inference worker never waits for the disk. When every slot is taken the
+// window is not cached. The writer also lists the namespace's keys once, and
+// load() only opens a file for a key in that list, so a miss never touches
+// the disk; until the list is read, every lookup misses.
+class DiskWindowCache: private juce::Thread
+{
+public:
+    enum class Encoding
+    {
+        float16 = 1,
+        deflate = 2
+    };
+
+    struct Options
+    {
+        juce::File directory = getDefaultDirectory();
+        juce::int64 maxBytes = (juce::int64)1 << 30;
+        Encoding encoding = Encoding::float16;
+    };
+
+    struct Summary
+    {
+        juce::String name;
+        juce::String description;       // model hash and geometry of the namespace
+        int numEntries = 0;
+        juce::int64 numBytes = 0;
+        juce::Time oldest;
+        juce::Time newest;
+    };
+
+    DiskWindowCache(const Options& options, const juce::String& modelHash);
+    // Writes the windows still pending
+    ~DiskWindowCache() override;
+
+    // ~/Library/Application Support/HARD/RenderCache on macOS
+    static juce::File getDefaultDirectory();
+
+    bool load(juce::uint64 key, stereo_float output[]);
+    void store(juce::uint64 key, const stereo_float output[]);
+    // Windows not cached because the writer was behind
+    juce::int64 getNumDroppedWrites() const {return numDroppedWrites;}
+
+    static const int MAX_PENDING_WRITES = 32;
+
+    static juce::Array<Summary> inspect(const juce::File& directory);
+    // Deletes the least recently used entries until at most maxBytes remain.
+    // Returns the number of bytes deleted.
+    static juce::int64 prune(const juce::File& directory, juce::int64 maxBytes);
+
+private:
+    struct PendingWrite
+    {
+        juce::uint64 key = 0;
+        std::vector<stereo_float> output;
+    };
+
+    juce::File getEntryFile(juce::uint64 key) const;
+    void run() override;
+    // Writer thread, or the destructor once it has stopped
+    void writePending();
+    void write(juce::uint64 key, const stereo_float output[]);
+    void listKeys();
+    bool hasKey(juce::uint64 key);
+    void setHasKey(juce::uint64 key, bool hasEntry);
+
+    const Options options;
+    juce::File namespaceDirectory;
+
+    // Slots are filled outside the lock; it only guards the two lists
+    juce::CriticalSection queueLock;
+    std::array<PendingWrite, MAX_PENDING_WRITES> slots;
+    juce::Array<int> freeSlots;
+    juce::Array<int> pendingSlots;
+    std::atomic<juce::int64> numDroppedWrites{0};
+
+    // Keys with an entry on disk; filled by the writer thread
+    juce::SpinLock keysLock;
+    std::unordered_set<juce::uint64> keys;
+    bool keysListed = false;
+
+    // Writer thread
+    juce::int64 totalBytes = -1;        // scanned on the first write
+    juce::MemoryBlock encoded;
+
+    JUCE_DECLARE_NON_COPYABLE(DiskWindowCache)
+};
+
+#endif /* DiskWindowCache_h */
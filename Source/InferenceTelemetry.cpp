@@ -0,0 +1,219 @@
+//
+//  InferenceTelemetry.cpp
+//  HARD
+//
+
+#include "InferenceTelemetry.h"
+
+int LatencyHistogram::getBucket(double ms)
+{
+    if (!(ms > MIN_MS))
+    {
+        return 0;
+    }
+    int bucket = (int)std::ceil(std::log2(ms/MIN_MS)*BUCKETS_PER_OCTAVE);
+    return juce::jlimit(0, NUM_BUCKETS-1, bucket);
+}
+
+double LatencyHistogram::getBucketMs(int bucket)
+{
+    return MIN_MS*std::exp2((double)bucket/BUCKETS_PER_OCTAVE);
+}
+
+void LatencyHistogram::record(double ms)
+{
+    ms = juce::jmax(0.0, ms);
+    buckets[(size_t)getBucket(ms)].fetch_add(1, std::memory_order_relaxed);
+    juce::int64 microseconds = (juce::int64)(ms*1000.0);
+    totalMicroseconds.fetch_add(microseconds, std::memory_order_relaxed);
+    juce::int64 max = maxMicroseconds.load(std::memory_order_relaxed);
+    while ((microseconds > max) and !maxMicroseconds.compare_exchange_weak(max, microseconds, std::memory_order_relaxed))
+    {
+    }
+    count.fetch_add(1, std::memory_order_release);
+}
+
+double LatencyHistogram::getPercentile(double fraction, juce::int64 total) const
+{
+    juce::int64 rank = juce::jmax((juce::int64)1, (juce::int64)std::ceil(fraction*(double)total));
+    juce::int64 seen = 0;
+    for (int b = 0; b < NUM_BUCKETS; b++)
+    {
+        seen += buckets[(size_t)b].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            return getBucketMs(b);
+        }
+    }
+    return getBucketMs(NUM_BUCKETS-1);
+}
+
+LatencyHistogram::Summary LatencyHistogram::getSummary() const
+{
+    Summary summary;
+    summary.count = count.load(std::memory_order_acquire);
+    if (summary.count == 0)
+    {
+        return summary;
+    }
+    summary.maxMs = (double)maxMicroseconds.load(std::memory_order_relaxed)/1000.0;
+    summary.meanMs = (double)totalMicroseconds.load(std::memory_order_relaxed)/1000.0/(double)summary.count;
+    // A bucket's upper edge can lie above the largest value recorded in it
+    summary.p1Ms = juce::jmin(summary.maxMs, getPercentile(0.01, summary.count));
+    summary.p50Ms = juce::jmin(summary.maxMs, getPercentile(0.50, summary.count));
+    summary.p95Ms = juce::jmin(summary.maxMs, getPercentile(0.95, summary.count));
+    summary.p99Ms = juce::jmin(summary.maxMs, getPercentile(0.99, summary.count));
+    return summary;
+}
+
+void LatencyHistogram::reset()
+{
+    count = 0;
+    for (auto& bucket : buckets)
+    {
+        bucket = 0;
+    }
+    totalMicroseconds = 0;
+    maxMicroseconds = 0;
+}
+
+juce::String LatencyHistogram::Summary::toString() const
+{
+    if (count == 0)
+    {
+        return "-";
+    }
+    return "p50 " + juce::String(p50Ms, 2) + " p95 " + juce::String(p95Ms, 2) + " p99 " + juce::String(p99Ms, 2)
+         + " max " + juce::String(maxMs, 2) + " ms (n=" + juce::String(count) + ")";
+}
+
+juce::var LatencyHistogram::Summary::toVar() const
+{
+    auto* object = new juce::DynamicObject();
+    object->setProperty("count", count);
+    object->setProperty("meanMs", meanMs);
+    object->setProperty("p1Ms", p1Ms);
+    object->setProperty("p50Ms", p50Ms);
+    object->setProperty("p95Ms", p95Ms);
+    object->setProperty("p99Ms", p99Ms);
+    object->setProperty("maxMs", maxMs);
+    return juce::var(object);
+}
+
+void InferenceTelemetry::recordWindow(const WindowTimes& times)
+{
+    queueWait.record(times.queueWaitMs);
+    if (times.runMs >= 0.0)
+    {
+        pack.record(times.packMs);
+        run.record(times.runMs);
+        windowsProcessed++;
+    }
+    else
+    {
+        windowsSkipped++;
+    }
+    push.record(times.pushMs);
+    if (!std::isnan(times.slackMs))
+    {
+        slack.record(times.slackMs);
+        if (times.slackMs < 0.0)
+        {
+            deadlineMisses++;
+        }
+    }
+}
+
+void InferenceTelemetry::recordMemory(juce::int64 weights, juce::int64 peakRun, juce::int64 peakArena)
+{
+    // Peaks are the allocator's own, so they are only replaced, not accumulated
+    weightBytes = weights;
+    peakRunBytes = peakRun;
+    peakArenaBytes = peakArena;
+}
+
+InferenceTelemetry::Snapshot InferenceTelemetry::getSnapshot() const
+{
+    Snapshot snapshot;
+    snapshot.queueWait = queueWait.getSummary();
+    snapshot.pack = pack.getSummary();
+    snapshot.run = run.getSummary();
+    snapshot.push = push.getSummary();
+    snapshot.slack = slack.getSummary();
+    snapshot.windowsProcessed = windowsProcessed;
+    snapshot.windowsSkipped = windowsSkipped;
+    snapshot.windowsCancelled = windowsCancelled;
+    snapshot.windowsBypassed = windowsBypassed;
+    snapshot.deadlineMisses = deadlineMisses;
+    snapshot.underruns = underruns;
+    snapshot.weightBytes = weightBytes;
+    snapshot.peakRunBytes = peakRunBytes;
+    snapshot.peakArenaBytes = peakArenaBytes;
+    snapshot.seconds = (juce::Time::getMillisecondCounterHiRes() - startMs)/1000.0;
+    return snapshot;
+}
+
+void InferenceTelemetry::reset()
+{
+    queueWait.reset();
+    pack.reset();
+    run.reset();
+    push.reset();
+    slack.reset();
+    windowsProcessed = 0;
+    windowsSkipped = 0;
+    windowsCancelled = 0;
+    windowsBypassed = 0;
+    deadlineMisses = 0;
+    underruns = 0;
+    startMs = juce::Time::getMillisecondCounterHiRes();
+}
+
+bool InferenceTelemetry::dump(const juce::File& file) const
+{
+    return file.replaceWithText(getSnapshot().toJson());
+}
+
+juce::String InferenceTelemetry::Snapshot::toString() const
+{
+    juce::String text;
+    text << "windows: " << windowsProcessed << " processed, " << windowsSkipped << " skipped, " << windowsCancelled << " cancelled, "
+         << windowsBypassed << " bypassed in " << juce::String(seconds, 1) << " s\n";
+    text << "underruns: " << underruns << ", deadline misses: " << deadlineMisses << "\n";
+    if (peakArenaBytes > 0)
+    {
+        text << "memory: " << juce::String(weightBytes/1048576.0, 1) << " MB weights, " << juce::String(peakRunBytes/1048576.0, 1)
+             << " MB peak during runs, " << juce::String(peakArenaBytes/1048576.0, 1) << " MB shared arena peak\n";
+    }
+    text << "  queue wait  " << queueWait.toString() << "\n";
+    text << "  pack        " << pack.toString() << "\n";
+    text << "  run         " << run.toString() << "\n";
+    text << "  push        " << push.toString() << "\n";
+    text << "  slack       " << slack.toString();
+    if (slack.count > 0)
+    {
+        text << ", p1 " << juce::String(slack.p1Ms, 2) << " ms";
+    }
+    return text;
+}
+
+juce::var InferenceTelemetry::Snapshot::toVar() const
+{
+    auto* object = new juce::DynamicObject();
+    object->setProperty("seconds", seconds);
+    object->setProperty("windowsProcessed", windowsProcessed);
+    object->setProperty("windowsSkipped", windowsSkipped);
+    object->setProperty("windowsCancelled", windowsCancelled);
+    object->setProperty("windowsBypassed", windowsBypassed);
+    object->setProperty("deadlineMisses", deadlineMisses);
+    object->setProperty("underruns", underruns);
+    object->setProperty("weightBytes", weightBytes);
+    object->setProperty("peakRunBytes", peakRunBytes);
+    object->setProperty("peakArenaBytes", peakArenaBytes);
+    object->setProperty("queueWait", queueWait.toVar());
+    object->setProperty("pack", pack.toVar());
+    object->setProperty("run", run.toVar());
+    object->setProperty("push", push.toVar());
+    object->setProperty("slack", slack.toVar());
+    return juce::var(object);
+}
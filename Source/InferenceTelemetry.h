@@ -0,0 +1,125 @@
+//
+//  InferenceTelemetry.h
+//  HARD
+//
+
+#ifndef InferenceTelemetry_h
+#define InferenceTelemetry_h
+
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+#include <limits>
+
+// Distribution of durations in milliseconds. Recording is wait-free and can
+// happen on any thread, including the audio thread; reads are approximate
+// while records come in. Buckets are spaced BUCKETS_PER_OCTAVE to an octave
+// from MIN_MS, so a percentile is within about 9% of the true value.
+class LatencyHistogram
+{
+public:
+    static constexpr double MIN_MS = 1.0/64.0;
+    static const int BUCKETS_PER_OCTAVE = 8;
+    static const int NUM_BUCKETS = BUCKETS_PER_OCTAVE*24;     // up to about 4 minutes
+
+    struct Summary
+    {
+        juce::int64 count = 0;
+        double meanMs = 0.0;
+        double p1Ms = 0.0;          // the low tail, for slack
+        double p50Ms = 0.0;
+        double p95Ms = 0.0;
+        double p99Ms = 0.0;
+        double maxMs = 0.0;
+        juce::String toString() const;
+        juce::var toVar() const;
+    };
+
+    // Negative values are recorded as 0
+    void record(double ms);
+    Summary getSummary() const;
+    void reset();
+
+private:
+    static int getBucket(double ms);
+    // Upper edge of the bucket
+    static double getBucketMs(int bucket);
+    double getPercentile(double fraction, juce::int64 total) const;
+
+    std::array<std::atomic<juce::int64>, NUM_BUCKETS> buckets{};
+    std::atomic<juce::int64> count{0};
+    std::atomic<juce::int64> totalMicroseconds{0};
+    std::atomic<juce::int64> maxMicroseconds{0};
+};
+
+// Per-instance record of where each window's time goes. The engine records
+// the stages of every window it processes; the audio thread counts bypassed
+// windows and underruns. Everything is lock-free, so it can be read at any
+// time from the editor or a dump while playback goes on.
+class InferenceTelemetry
+{
+public:
+    // One window, in milliseconds. runMs is negative for windows that were
+    // served without running the model (dry mix or window cache).
+    struct WindowTimes
+    {
+        double queueWaitMs = 0.0;       // from the request until the worker picked it up
+        double packMs = 0.0;
+        double runMs = -1.0;
+        double pushMs = 0.0;            // unpacking and the crossfade into the output FIFOs
+        // Time left until the output would have run short, when it arrived;
+        // negative for a late window. NaN if the requester set no deadline.
+        double slackMs = std::numeric_limits<double>::quiet_NaN();
+    };
+
+    struct Snapshot
+    {
+        LatencyHistogram::Summary queueWait, pack, run, push, slack;
+        juce::int64 windowsProcessed = 0;   // ran the model
+        juce::int64 windowsSkipped = 0;     // dry mix or cache hit
+        juce::int64 windowsCancelled = 0;
+        juce::int64 windowsBypassed = 0;    // hops spent bypassed or hibernating
+        juce::int64 deadlineMisses = 0;
+        juce::int64 underruns = 0;          // blocks that found the output FIFO short
+        // From the shared allocator, 0 without one
+        juce::int64 weightBytes = 0;        // the session's weights
+        juce::int64 peakRunBytes = 0;       // the session's peak during runs, on top of the weights
+        juce::int64 peakArenaBytes = 0;     // the process-wide arena's peak
+        double seconds = 0.0;               // since the last reset
+        // One line per histogram
+        juce::String toString() const;
+        juce::var toVar() const;
+        juce::String toJson() const {return juce::JSON::toString(toVar());}
+    };
+
+    InferenceTelemetry() {reset();}
+
+    // Worker thread
+    void recordWindow(const WindowTimes& times);
+    void countCancelled() {windowsCancelled++;}
+    void recordMemory(juce::int64 weightBytes, juce::int64 peakRunBytes, juce::int64 peakArenaBytes);
+    // Audio thread
+    void countBypassed(juce::int64 numWindows) {windowsBypassed += numWindows;}
+    void countUnderrun() {underruns++;}
+
+    Snapshot getSnapshot() const;
+    // Not synchronised with recording; a window recorded meanwhile may be split
+    void reset();
+    // Writes the snapshot as JSON
+    bool dump(const juce::File& file) const;
+
+private:
+    LatencyHistogram queueWait, pack, run, push, slack;
+    std::atomic<juce::int64> windowsProcessed{0};
+    std::atomic<juce::int64> windowsSkipped{0};
+    std::atomic<juce::int64> windowsCancelled{0};
+    std::atomic<juce::int64> windowsBypassed{0};
+    std::atomic<juce::int64> deadlineMisses{0};
+    std::atomic<juce::int64> underruns{0};
+    std::atomic<juce::int64> weightBytes{0};
+    std::atomic<juce::int64> peakRunBytes{0};
+    std::atomic<juce::int64> peakArenaBytes{0};
+    std::atomic<double> startMs{0.0};
+};
+
+#endif /* InferenceTelemetry_h */
@@ -0,0 +1,128 @@
+//
+//  ModelLoader.cpp
+//  HARD
+//
+
+#include "ModelLoader.h"
+#include "RtLog.h"
+
+static const int WARMUP_RUNS = 3;
+
+ModelLoader::ModelLoader(const MorpherModel::Options& o, size_t cacheBytes, bool diskCache)
+:juce::Thread("ModelLoaderThread"), options(o), windowCacheBytes(cacheBytes), diskWindowCache(diskCache)
+{
+    startThread(juce::Thread::Priority::low);
+}
+
+ModelLoader::~ModelLoader()
+{
+    // A session being created cannot be interrupted
+    signalThreadShouldExit();
+    notify();
+    stopThread(-1);
+}
+
+void ModelLoader::load(const ModelSource& newSource)
+{
+    {
+        const juce::ScopedLock sl(lock);
+        generation++;
+        pendingSource = newSource;
+        hasPendingSource = true;
+        loading = true;
+        result.reset();
+    }
+    notify();
+}
+
+void ModelLoader::cancel()
+{
+    const juce::ScopedLock sl(lock);
+    generation++;
+    hasPendingSource = false;
+    loading = false;
+    result.reset();
+}
+
+bool ModelLoader::isStale(int loadGeneration) const
+{
+    const juce::ScopedLock sl(lock);
+    return loadGeneration != generation;
+}
+
+bool ModelLoader::takeResult(Result& taken)
+{
+    std::unique_ptr<Result> finished;
+    {
+        const juce::ScopedLock sl(lock);
+        std::swap(finished, result);
+        if ((finished != nullptr) and (finished->generation != generation))
+        {
+            // Cancelled or replaced after it was stored
+            finished.reset();
+        }
+    }
+    if (finished == nullptr)
+    {
+        return false;
+    }
+    taken = std::move(*finished);
+    return true;
+}
+
+void ModelLoader::run()
+{
+    while (!threadShouldExit())
+    {
+        wait(-1);
+        auto loaded = std::make_unique<Result>();
+        {
+            const juce::ScopedLock sl(lock);
+            if (!hasPendingSource)
+            {
+                continue;
+            }
+            hasPendingSource = false;
+            loaded->source = pendingSource;
+            loaded->generation = generation;
+        }
+        try
+        {
+            loaded->model = std::make_shared<MorpherModel>(loaded->source, options);
+            RtLog::writeText(RtLog::Category::model, RtLog::Level::info, "Model loaded in the background: {s}.", loaded->model->getLoadInfo().toString());
+            if (isStale(loaded->generation))
+            {
+                continue;
+            }
+            // The first runs allocate, so only the last one is timed
+            loaded->model->warmup(WARMUP_RUNS - 1);
+            const double start = juce::Time::getMillisecondCounterHiRes();
+            loaded->model->warmup(1);
+            loaded->windowMs = juce::Time::getMillisecondCounterHiRes() - start;
+            
+            loaded->windowCache = std::make_shared<WindowCache>(windowCacheBytes);
+            if (diskWindowCache)
+            {
+                loaded->windowCache->setBackingStore(std::make_shared<DiskWindowCache>(DiskWindowCache::Options(), loaded->source.getContentHash()));
+            }
+        }
+        catch (const std::exception& e)
+        {
+            loaded->model.reset();
+            loaded->error = e.what();
+            RtLog::writeText(RtLog::Category::model, RtLog::Level::error, "Background model load failed: {s}.", loaded->error);
+        }
+        {
+            const juce::ScopedLock sl(lock);
+            if (loaded->generation != generation)
+            {
+                // Released below, on this thread
+                continue;
+            }
+            std::swap(result, loaded);
+            // A load() that came in meanwhile keeps it set
+            loading = hasPendingSource;
+        }
+        sendChangeMessage();
+    }
+}
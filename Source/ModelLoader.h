@@ -0,0 +1,65 @@
+//
+//  ModelLoader.h
+//  HARD
+//
+
+#ifndef ModelLoader_h
+#define ModelLoader_h
+
+#include <JuceHeader.h>
+#include "MorpherModel.h"
+#include "WindowCache.h"
+
+// Loads and warms up a model on a background thread while the current one keeps
+// running, so an engine can hot-swap to it (ONNXMorpherInferenceThread::swapModel).
+// The model comes with its own window cache, backed by the disk cache of that
+// model. A change message is sent when a load has finished or failed.
+//
+// Nothing here waits for the loading thread: a session being created cannot be
+// interrupted, so a cancelled or replaced load runs to its end in the
+// background and its result is dropped there.
+class ModelLoader: public juce::ChangeBroadcaster,
+                   private juce::Thread
+{
+public:
+    struct Result
+    {
+        ModelSource source;
+        std::shared_ptr<MorpherModel> model;            // nullptr if loading failed
+        std::shared_ptr<WindowCache> windowCache;
+        double windowMs = 0.0;                          // one window, after warmup
+        juce::String error;
+        int generation = 0;                             // the load() call it answers
+    };
+
+    // Each loaded model gets a window cache, backed by a DiskWindowCache if diskWindowCache
+    ModelLoader(const MorpherModel::Options& options, size_t windowCacheBytes, bool diskWindowCache = false);
+    ~ModelLoader() override;
+
+    // Message thread. Replaces a load in progress.
+    void load(const ModelSource& source);
+    // Drops a load in progress and its result, without waiting for it
+    void cancel();
+    bool isLoading() const {return loading;}
+    // Message thread; hands out each finished load of the latest load() once
+    bool takeResult(Result& result);
+
+private:
+    void run() override;
+    bool isStale(int loadGeneration) const;
+
+    const MorpherModel::Options options;
+    const size_t windowCacheBytes;
+    const bool diskWindowCache;
+
+    juce::CriticalSection lock;
+    ModelSource pendingSource;
+    bool hasPendingSource = false;
+    int generation = 0;
+    std::atomic<bool> loading{false};
+    std::unique_ptr<Result> result;
+
+    JUCE_DECLARE_NON_COPYABLE(ModelLoader)
+};
+
+#endif /* ModelLoader_h */
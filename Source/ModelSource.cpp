@@ -0,0 +1,167 @@
+//
+//  ModelSource.cpp
+//  HARD
+//
+
+#include "ModelSource.h"
+#include "WindowCache.h"
+#include "WorkerPolicy.h"
+#include <map>
+#include <mutex>
+
+#if defined(HARD_EMBEDDED_MODEL)
+ #include "BinaryData.h"
+#endif
+
+// An ORT-format model is a flatbuffer with this file identifier after the root offset
+static const char ORT_IDENTIFIER[] = {'O', 'R', 'T', 'M'};
+static const size_t ORT_IDENTIFIER_OFFSET = 4;
+
+bool ModelSource::hasOrtIdentifier(const void* bytes, size_t numBytes)
+{
+    return (numBytes >= ORT_IDENTIFIER_OFFSET + sizeof(ORT_IDENTIFIER))
+        and (memcmp(static_cast<const char*>(bytes) + ORT_IDENTIFIER_OFFSET, ORT_IDENTIFIER, sizeof(ORT_IDENTIFIER)) == 0);
+}
+
+ModelSource ModelSource::fromFile(const juce::File& file)
+{
+    ModelSource source;
+    source.file = file;
+    source.name = file.getFullPathName();
+    source.ortFormat = file.hasFileExtension(".ort");
+    if (!source.ortFormat)
+    {
+        char header[ORT_IDENTIFIER_OFFSET + sizeof(ORT_IDENTIFIER)] = {};
+        juce::FileInputStream stream(file);
+        source.ortFormat = stream.openedOk() and (stream.read(header, (int)sizeof(header)) == (int)sizeof(header))
+                           and hasOrtIdentifier(header, sizeof(header));
+    }
+    return source;
+}
+
+ModelSource ModelSource::fromMemory(const void* data, size_t size, const juce::String& name)
+{
+    ModelSource source;
+    source.data = data;
+    source.size = size;
+    source.name = name;
+    source.ortFormat = hasOrtIdentifier(data, size);
+    return source;
+}
+
+ModelSource ModelSource::mapFile(const juce::File& file)
+{
+    auto mapped = std::make_shared<const juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+    if (mapped->getData() == nullptr)
+    {
+        return fromFile(file);
+    }
+    ModelSource source = fromMemory(mapped->getData(), mapped->getSize(), file.getFullPathName());
+    source.file = file;
+    source.mapping = std::move(mapped);
+    source.ortFormat = source.ortFormat or file.hasFileExtension(".ort");
+    return source;
+}
+
+// ORT format before ONNX, in each folder
+static juce::File findModelIn(const juce::File& directory)
+{
+    for (const char* filename : {ModelSource::ORT_FILENAME, ModelSource::ONNX_FILENAME})
+    {
+        const juce::File file = directory.getChildFile(filename);
+        if (file.existsAsFile())
+        {
+            return file;
+        }
+    }
+    return {};
+}
+
+ModelSource ModelSource::getDefault()
+{
+    const juce::String overridePath = juce::SystemStats::getEnvironmentVariable("HARD_MODEL", {});
+    if (overridePath.isNotEmpty())
+    {
+        return fromFile(juce::File::getCurrentWorkingDirectory().getChildFile(overridePath));
+    }
+    const juce::String settingsPath = WorkerPolicy::openUserSettings()->getValue("modelPath");
+    if (settingsPath.isNotEmpty())
+    {
+        return fromFile(juce::File(settingsPath));
+    }
+
+   #if defined(HARD_EMBEDDED_MODEL)
+    int embeddedSize = 0;
+    if (const char* embedded = BinaryData::getNamedResource(HARD_EMBEDDED_MODEL, embeddedSize))
+    {
+        return fromMemory(embedded, (size_t)embeddedSize, juce::String("embedded ") + HARD_EMBEDDED_MODEL);
+    }
+   #endif
+
+    // The plugin's binary, or the renderer's executable
+    const juce::File application = juce::File::getSpecialLocation(juce::File::currentApplicationFile);
+    juce::Array<juce::File> directories;
+   #if JUCE_MAC
+    directories.add(application.getChildFile("Contents/Resources"));
+   #endif
+    directories.add(application.isDirectory() ? application : application.getParentDirectory());
+    directories.add(juce::File::getSpecialLocation(juce::File::currentExecutableFile).getParentDirectory());
+    directories.add(juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory).getChildFile("HARD"));
+    for (const auto& directory : directories)
+    {
+        const juce::File file = findModelIn(directory);
+        if (file != juce::File())
+        {
+            return fromFile(file);
+        }
+    }
+    // Not found: where it is expected, for the error message
+    return fromFile(directories.getFirst().getChildFile(ONNX_FILENAME));
+}
+
+juce::String ModelSource::getDescription() const
+{
+    return name + (ortFormat ? " (ORT format" : " (ONNX") + (isMapped() ? ", mapped)" : ")");
+}
+
+bool ModelSource::readBytes(const std::function<void(const void*, size_t)>& function) const
+{
+    if (isInMemory())
+    {
+        function(data, size);
+        return true;
+    }
+    juce::MemoryMappedFile mapped(file, juce::MemoryMappedFile::readOnly);
+    if (mapped.getData() == nullptr)
+    {
+        return false;
+    }
+    function(mapped.getData(), mapped.getSize());
+    return true;
+}
+
+juce::String ModelSource::getContentHash() const
+{
+    static std::mutex mutex;
+    static std::map<juce::String, juce::String> hashes;
+    const juce::String key = getDescription() + " " + juce::String((juce::int64)getSize())
+                           + (isInMemory() ? " " + juce::String::toHexString((juce::pointer_sized_int)data)
+                                           : " " + juce::String(file.getLastModificationTime().toMilliseconds()));
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        auto found = hashes.find(key);
+        if (found != hashes.end())
+        {
+            return found->second;
+        }
+    }
+    juce::uint64 hash = 0;
+    if (!readBytes([&hash](const void* bytes, size_t numBytes) {hash = WindowCache::hashBytes(bytes, numBytes, 0);}))
+    {
+        return {};
+    }
+    const juce::String hex = juce::String::toHexString((juce::int64)hash).paddedLeft('0', 16);
+    const std::lock_guard<std::mutex> lock(mutex);
+    hashes[key] = hex;
+    return hex;
+}
@@ -0,0 +1,70 @@
+//
+//  ModelSource.h
+//  HARD
+//
+
+#ifndef ModelSource_h
+#define ModelSource_h
+
+#include <JuceHeader.h>
+
+// Where a MorpherModel is loaded from: a file, or bytes already in memory (e.g.
+// compiled in with BinaryData). Either can be an ONNX model or a pre-optimized
+// ORT-format model (.ort), which loads much faster because it skips the
+// protobuf parsing and graph optimization.
+class ModelSource
+{
+public:
+    // Model files are looked for under these names, the ORT format first
+    static constexpr const char* ORT_FILENAME = "morpher.ort";
+    static constexpr const char* ONNX_FILENAME = "morpher.onnx";
+
+    ModelSource() = default;
+    static ModelSource fromFile(const juce::File& file);
+    // The bytes are not copied and must outlive every model loaded from them
+    static ModelSource fromMemory(const void* data, size_t size, const juce::String& name);
+    // The file mapped read-only, so every process mapping it shares the same
+    // pages. The mapping lives as long as any copy of the source. Falls back to
+    // fromFile() if the file cannot be mapped.
+    static ModelSource mapFile(const juce::File& file);
+
+    // The first of:
+    //  - the HARD_MODEL environment variable (a path),
+    //  - modelPath in HARD.settings,
+    //  - the model compiled in as BinaryData, if built with HARD_EMBEDDED_MODEL
+    //    set to its resource name (e.g. HARD_EMBEDDED_MODEL="morpher_ort"),
+    //  - the plugin bundle's Resources folder (macOS),
+    //  - the folder of the plugin or executable, then HARD's application data folder.
+    static ModelSource getDefault();
+
+    bool isValid() const {return isInMemory() or file.existsAsFile();}
+    bool isInMemory() const {return data != nullptr;}
+    bool isMapped() const {return mapping != nullptr;}
+    bool isOrtFormat() const {return ortFormat;}
+    const juce::File& getFile() const {return file;}
+    const void* getData() const {return data;}
+    // For a file, its length
+    size_t getSize() const {return isInMemory() ? size : (size_t)file.getSize();}
+    // Path or resource name, and format, for logs
+    juce::String getDescription() const;
+
+    // Calls function(data, size) with the model bytes, memory-mapped for a file.
+    // Returns false if they could not be read.
+    bool readBytes(const std::function<void(const void*, size_t)>& function) const;
+    // Hash of the model bytes as 16 hex digits, empty if they could not be read.
+    // Remembered per file path, size and modification time (or per buffer), so
+    // only the first call for a model reads it. Thread safe.
+    juce::String getContentHash() const;
+
+private:
+    static bool hasOrtIdentifier(const void* data, size_t size);
+
+    juce::File file;
+    std::shared_ptr<const juce::MemoryMappedFile> mapping;
+    const void* data = nullptr;
+    size_t size = 0;
+    juce::String name;
+    bool ortFormat = false;
+};
+
+#endif /* ModelSource_h */
@@ -0,0 +1,325 @@
+//
+//  MorpherModel.cpp
+//  HARD
+//
+
+#include "MorpherModel.h"
+#include <onnxruntime_session_options_config_keys.h>
+#include "OptimizedModelCache.h"
+#include "OrtAutotuner.h"
+
+#if JUCE_WINDOWS
+ #include <windows.h>
+#else
+ #include <dlfcn.h>
+#endif
+
+// Part of an optimized model's cache key
+static const GraphOptimizationLevel OPTIMIZATION_LEVEL = ORT_ENABLE_ALL;
+static const char* const OPTIMIZATION_KEY = "optimization all";
+
+// oneDNN has no generic entry point in this API version; its provider library exports this
+typedef OrtStatus* (*AppendDnnlFunction)(OrtSessionOptions*, int useArena);
+
+static AppendDnnlFunction findAppendDnnl()
+{
+   #if JUCE_WINDOWS
+    HMODULE library = GetModuleHandleA("onnxruntime.dll");
+    return library != nullptr ? (AppendDnnlFunction)GetProcAddress(library, "OrtSessionOptionsAppendExecutionProvider_Dnnl") : nullptr;
+   #else
+    return (AppendDnnlFunction)dlsym(RTLD_DEFAULT, "OrtSessionOptionsAppendExecutionProvider_Dnnl");
+   #endif
+}
+
+void MorpherModel::appendExecutionProvider(Ort::SessionOptions& options, const juce::String& provider, int numThreads)
+{
+    if (provider == "XNNPACK")
+    {
+        std::unordered_map<std::string, std::string> providerOptions;
+        if (numThreads > 0)
+        {
+            providerOptions["intra_op_num_threads"] = std::to_string(numThreads);
+        }
+        options.AppendExecutionProvider("XNNPACK", providerOptions);
+    }
+    else if (provider == "DNNL")
+    {
+        AppendDnnlFunction appendDnnl = findAppendDnnl();
+        if (appendDnnl == nullptr)
+        {
+            throw std::runtime_error("ONNX Runtime was built without oneDNN");
+        }
+        Ort::ThrowOnError(appendDnnl(options, 1));
+    }
+    else if (provider.isNotEmpty())
+    {
+        throw std::runtime_error(("Unknown execution provider " + provider).toStdString());
+    }
+}
+
+MorpherModel::MorpherModel(const ModelSource& source, const Options& options)
+:environment(options.environment != nullptr ? options.environment : OrtEnvironment::getShared({}))
+{
+    int intraOpThreads = options.intraOpThreads;
+    executionProvider = options.executionProvider;
+    if (options.autotuned)
+    {
+        const OrtAutotuner::Configuration tuned = OrtAutotuner::findStored(source);
+        if (tuned.isValid())
+        {
+            intraOpThreads = tuned.intraOpThreads;
+            executionProvider = tuned.executionProvider;
+        }
+    }
+    
+    if (environment->hasGlobalThreadPools() and !options.perSessionThreads)
+    {
+        session_options.DisablePerSessionThreads();
+    }
+    else
+    {
+        if (intraOpThreads > 0)
+        {
+            session_options.SetIntraOpNumThreads(intraOpThreads);
+        }
+        // The session's own pool threads also charge their allocations to it
+        if ((options.threadPolicy != nullptr) or (environment->getSharedAllocator() != nullptr))
+        {
+            poolThreads = std::make_unique<OrtPoolThreads>(options.threadPolicy, &memoryUsage);
+            poolThreads->install(session_options);
+        }
+        if ((options.threadPolicy != nullptr) and options.threadPolicy->flushDenormals)
+        {
+            session_options.AddConfigEntry(kOrtSessionOptionsConfigSetDenormalAsZero, "1");
+        }
+    }
+    
+    // Shapes are fixed, so the first run's allocation plan is reused for every later one
+    session_options.EnableMemPattern();
+    session_options.EnableCpuMemArena();
+    session_options.SetGraphOptimizationLevel(OPTIMIZATION_LEVEL);
+    if (environment->getSharedAllocator() != nullptr)
+    {
+        session_options.AddConfigEntry(kOrtSessionOptionsConfigUseEnvAllocators, "1");
+    }
+    appendExecutionProvider(session_options, executionProvider, intraOpThreads);
+    optimizationKey = juce::String(OPTIMIZATION_KEY) + (executionProvider.isNotEmpty() ? ", " + executionProvider : juce::String());
+    
+    loadInfo.source = source.getDescription();
+    loadInfo.executionProvider = executionProvider;
+    const double start = juce::Time::getMillisecondCounterHiRes();
+    {
+        OrtSharedAllocator::ScopedSession scope(memoryUsage);
+        createSession(source);
+    }
+    loadInfo.milliseconds = juce::Time::getMillisecondCounterHiRes() - start;
+    weightBytes = memoryUsage.currentBytes;
+    
+    auto inputDims = session_.GetInputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+    dynamicBatch = !inputDims.empty() and (inputDims[0] < 0);
+}
+
+void MorpherModel::createSession(const ModelSource& source)
+{
+    const juce::File& cacheDirectory = environment->getOptions().optimizedModelDirectory;
+    if ((cacheDirectory == juce::File()) or source.isOrtFormat())
+    {
+        openSession(source, session_options);
+        return;
+    }
+    
+    OptimizedModelCache cache(cacheDirectory);
+    const OptimizedModelCache::Entry entry = cache.find(source, optimizationKey);
+    if (entry.file == juce::File())
+    {
+        openSession(source, session_options);
+        return;
+    }
+    if (entry.isValid)
+    {
+        try
+        {
+            // Already optimized for this machine
+            Ort::SessionOptions cachedOptions = session_options.Clone();
+            cachedOptions.SetGraphOptimizationLevel(ORT_DISABLE_ALL);
+            openSession(ModelSource::fromFile(entry.file), cachedOptions);
+            loadInfo.fromOptimizedCache = true;
+            return;
+        }
+        catch (const Ort::Exception&)
+        {
+            cache.remove(entry);
+        }
+    }
+    
+    // Optimizes as usual and saves the result for the next session
+    const juce::File writtenFile = cache.createTemporaryFile(entry);
+    try
+    {
+        Ort::SessionOptions savingOptions = session_options.Clone();
+        juce::String written_path = writtenFile.getFullPathName();
+        savingOptions.SetOptimizedModelFilePath(written_path.getCharPointer());
+        savingOptions.AddConfigEntry(kOrtSessionOptionsConfigSaveModelFormat, "ORT");
+        openSession(source, savingOptions);
+        cache.store(entry, writtenFile);
+    }
+    catch (const Ort::Exception&)
+    {
+        writtenFile.deleteFile();
+        openSession(source, session_options);
+    }
+}
+
+void MorpherModel::openSession(const ModelSource& source, const Ort::SessionOptions& options)
+{
+    Ort::SessionOptions sessionOptions = options.Clone();
+    ModelSource loaded = source;
+    bool weightsInPlace = false;
+    if (source.isOrtFormat())
+    {
+        sessionOptions.AddConfigEntry(kOrtSessionOptionsConfigLoadModelFormat, "ORT");
+        if (environment->getOptions().sharedWeights)
+        {
+            // Initializers point into the flatbuffer instead of being copied to the
+            // heap. ONNX models are parsed into copies whatever their bytes are.
+            if (!source.isInMemory())
+            {
+                loaded = ModelSource::mapFile(source.getFile());
+            }
+            if (loaded.isInMemory())
+            {
+                sessionOptions.AddConfigEntry(kOrtSessionOptionsConfigUseORTModelBytesDirectly, "1");
+                sessionOptions.AddConfigEntry(kOrtSessionOptionsConfigUseORTModelBytesForInitializers, "1");
+                weightsInPlace = true;
+            }
+        }
+    }
+    
+    OrtPrepackedWeightsContainer* prepackedWeights = environment->getPrepackedWeights();
+    if (loaded.isInMemory())
+    {
+        session_ = prepackedWeights != nullptr
+            ? Ort::Session(environment->getEnv(), loaded.getData(), loaded.getSize(), sessionOptions, prepackedWeights)
+            : Ort::Session(environment->getEnv(), loaded.getData(), loaded.getSize(), sessionOptions);
+    }
+    else
+    {
+        juce::String model_path = loaded.getFile().getFullPathName();
+        session_ = prepackedWeights != nullptr
+            ? Ort::Session(environment->getEnv(), model_path.getCharPointer(), sessionOptions, prepackedWeights)
+            : Ort::Session(environment->getEnv(), model_path.getCharPointer(), sessionOptions);
+    }
+    // Keeps a mapping alive for as long as the session uses it
+    modelBytes = loaded;
+    loadInfo.mappedWeights = weightsInPlace and loaded.isMapped();
+}
+
+juce::String MorpherModel::LoadInfo::toString() const
+{
+    return source + " in " + juce::String(milliseconds, 1) + " ms" + (fromOptimizedCache ? ", optimized copy" : "")
+         + (mappedWeights ? ", mapped weights" : "") + (executionProvider.isNotEmpty() ? ", " + executionProvider : juce::String());
+}
+
+MorpherModel::PoolThreadStatus MorpherModel::getPoolThreadStatus() const
+{
+    if (environment->hasGlobalThreadPools())
+    {
+        return environment->getPoolThreadStatus();
+    }
+    return poolThreads != nullptr ? poolThreads->getStatus() : PoolThreadStatus();
+}
+
+MorpherModel::MemoryStats MorpherModel::getMemoryStats() const
+{
+    MemoryStats stats;
+    stats.weightBytes = weightBytes;
+    stats.peakRunBytes = juce::jmax((juce::int64)0, memoryUsage.peakBytes - weightBytes);
+    return stats;
+}
+
+OrtSharedAllocator::Stats MorpherModel::getSharedArenaStats() const
+{
+    auto* allocator = environment->getSharedAllocator();
+    return allocator != nullptr ? allocator->getStats() : OrtSharedAllocator::Stats();
+}
+
+void MorpherModel::run(float input[], float output[])
+{
+    run(input, output, Ort::RunOptions{nullptr});
+}
+
+void MorpherModel::run(float input[], float output[], const Ort::RunOptions& runOptions)
+{
+    auto memory_info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+    std::vector<Ort::Value> ort_inputs;
+    ort_inputs.emplace_back(Ort::Value::CreateTensor<float>(memory_info, input, NUM_INPUT_CHANNELS*WINDOW_SAMPLES, inputShape.data(), inputShape.size()));
+    
+    std::vector<Ort::Value> ort_outputs;
+    ort_outputs.emplace_back(Ort::Value::CreateTensor<float>(memory_info, output, NUM_OUTPUT_CHANNELS*WINDOW_SAMPLES, outputShape.data(), outputShape.size()));
+    
+    OrtSharedAllocator::ScopedSession scope(memoryUsage);
+    session_.Run(runOptions, dnnInputNames.data(), ort_inputs.data(), 1, dnnOutputNames.data(), ort_outputs.data(), 1);
+}
+
+void MorpherModel::runBatch(float input[], float output[], int batchSize)
+{
+    runBatch(input, output, batchSize, Ort::RunOptions{nullptr});
+}
+
+void MorpherModel::runBatch(float input[], float output[], int batchSize, const Ort::RunOptions& runOptions)
+{
+    if (!dynamicBatch or (batchSize == 1))
+    {
+        for (int b = 0; b < batchSize; b++)
+        {
+            run(input + (size_t)b*NUM_INPUT_CHANNELS*WINDOW_SAMPLES, output + (size_t)b*NUM_OUTPUT_CHANNELS*WINDOW_SAMPLES, runOptions);
+        }
+        return;
+    }
+    
+    const std::array<int64_t, 3> batchInputShape = {batchSize, NUM_INPUT_CHANNELS, WINDOW_SAMPLES};
+    const std::array<int64_t, 3> batchOutputShape = {batchSize, NUM_OUTPUT_CHANNELS, WINDOW_SAMPLES};
+    auto memory_info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+    std::vector<Ort::Value> ort_inputs;
+    ort_inputs.emplace_back(Ort::Value::CreateTensor<float>(memory_info, input, (size_t)batchSize*NUM_INPUT_CHANNELS*WINDOW_SAMPLES, batchInputShape.data(), batchInputShape.size()));
+    
+    std::vector<Ort::Value> ort_outputs;
+    ort_outputs.emplace_back(Ort::Value::CreateTensor<float>(memory_info, output, (size_t)batchSize*NUM_OUTPUT_CHANNELS*WINDOW_SAMPLES, batchOutputShape.data(), batchOutputShape.size()));
+    
+    OrtSharedAllocator::ScopedSession scope(memoryUsage);
+    session_.Run(runOptions, dnnInputNames.data(), ort_inputs.data(), 1, dnnOutputNames.data(), ort_outputs.data(), 1);
+}
+
+void MorpherModel::warmup(int n_iter)
+{
+    std::vector<float> input(NUM_INPUT_CHANNELS*WINDOW_SAMPLES, 0.0f);
+    std::vector<float> output(NUM_OUTPUT_CHANNELS*WINDOW_SAMPLES, 0.0f);
+    for(int i=0;i<n_iter;i++)
+    {
+        run(input.data(), output.data());
+    }
+}
+
+MorpherModel::WindowTiming MorpherModel::getWindowTiming()
+{
+    const std::lock_guard<std::mutex> lock(timingMutex);
+    if (windowTiming.maxMs > 0.0)
+    {
+        return windowTiming;
+    }
+    std::vector<float> input(NUM_INPUT_CHANNELS*WINDOW_SAMPLES, 0.0f);
+    std::vector<float> output(NUM_OUTPUT_CHANNELS*WINDOW_SAMPLES, 0.0f);
+    // The first run allocates its buffers
+    run(input.data(), output.data());
+    std::vector<double> times;
+    for (int i = 0; i < WindowTiming::NUM_RUNS; i++)
+    {
+        const double start = juce::Time::getMillisecondCounterHiRes();
+        run(input.data(), output.data());
+        times.push_back(juce::Time::getMillisecondCounterHiRes() - start);
+    }
+    std::sort(times.begin(), times.end());
+    windowTiming.medianMs = times[times.size()/2];
+    windowTiming.maxMs = times.back();
+    return windowTiming;
+}
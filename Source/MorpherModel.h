@@ -0,0 +1,134 @@
+//
+//  MorpherModel.h
+//  HARD
+//
+
+#ifndef MorpherModel_h
+#define MorpherModel_h
+
+#include <JuceHeader.h>
+#include <onnxruntime_cxx_api.h>
+#include <array>
+#include <mutex>
+#include "OrtEnvironment.h"
+#include "ModelSource.h"
+
+// Owns the ONNX Runtime session for the morpher model. Session::Run is thread safe,
+// so one model can be shared by any number of inference threads or render jobs;
+// each caller keeps its own tensor buffers.
+class MorpherModel
+{
+public:
+    static const unsigned int WINDOW_SAMPLES = 16384;
+    static const unsigned int NUM_INPUT_CHANNELS = 6;
+    static const unsigned int NUM_OUTPUT_CHANNELS = 2;
+    
+    struct Options
+    {
+        int intraOpThreads = 0;     // 0 lets ONNX Runtime decide
+        // Applied to each intra-op pool thread as it starts. Denormals are also
+        // flushed inside the kernels if the policy asks for it.
+        std::shared_ptr<const WorkerPolicy> threadPolicy;
+        // Defaults to OrtEnvironment::getShared({}). If it has global thread
+        // pools, the session uses them and the two options above are ignored.
+        std::shared_ptr<OrtEnvironment> environment;
+        // A pool of the session's own even if the environment has global ones
+        bool perSessionThreads = false;
+        // "XNNPACK" or "DNNL" (oneDNN), if this ONNX Runtime build has it; empty
+        // for the default CPU provider. Unsupported nodes fall back to it.
+        juce::String executionProvider;
+        // Takes the provider and thread count OrtAutotuner stored for this
+        // machine and model instead of the two options above, if there is one
+        bool autotuned = false;
+    };
+    
+    using PoolThreadStatus = OrtPoolThreads::Status;
+    
+    // Only tracked when the environment has a shared allocator
+    struct MemoryStats
+    {
+        juce::int64 weightBytes = 0;        // allocated while loading: initializers and prepacked weights
+        juce::int64 peakRunBytes = 0;       // most allocated at once during runs, on top of the weights
+    };
+    
+    struct LoadInfo
+    {
+        juce::String source;                // ModelSource::getDescription()
+        double milliseconds = 0.0;          // session creation, including graph optimization for ONNX
+        bool fromOptimizedCache = false;    // loaded the environment's optimized copy instead
+        bool mappedWeights = false;         // weights are used in place from the mapped file
+        juce::String executionProvider;     // empty for the default CPU provider
+        
+        // For logs, e.g. "morpher.onnx (ONNX) in 85.2 ms, optimized copy"
+        juce::String toString() const;
+    };
+    
+    // Run time of single windows on the calling thread, after the warmup. Too
+    // few runs for a percentile above the median; maxMs is the slowest of them.
+    struct WindowTiming
+    {
+        static const int NUM_RUNS = 10;
+        double medianMs = 0.0;
+        double maxMs = 0.0;
+    };
+    
+    explicit MorpherModel(const ModelSource& source, const Options& options = {});
+    
+    
+    // input holds NUM_INPUT_CHANNELS planar channels of WINDOW_SAMPLES,
+    // output receives NUM_OUTPUT_CHANNELS planar channels of WINDOW_SAMPLES.
+    void run(float input[], float output[]);
+    // Same, but can be stopped from another thread with runOptions.SetTerminate(),
+    // in which case Ort::Exception is thrown
+    void run(float input[], float output[], const Ort::RunOptions& runOptions);
+    // Runs batchSize windows stacked back to back in input/output. Uses one
+    // batched Run when the model's batch dimension is dynamic, otherwise
+    // batchSize separate runs.
+    void runBatch(float input[], float output[], int batchSize);
+    void runBatch(float input[], float output[], int batchSize, const Ort::RunOptions& runOptions);
+    bool hasDynamicBatch() const {return dynamicBatch;}
+    bool usesGlobalThreadPools() const {return environment->hasGlobalThreadPools();}
+    void warmup(int n_iter);
+    // Times WindowTiming::NUM_RUNS windows on the first call and returns that
+    // result from then on, for every user of the model. Thread safe.
+    WindowTiming getWindowTiming();
+    // The session's own pool threads, or the environment's shared ones. Each
+    // thread reports in as it starts, shortly after the pool is created.
+    PoolThreadStatus getPoolThreadStatus() const;
+    MemoryStats getMemoryStats() const;
+    const LoadInfo& getLoadInfo() const {return loadInfo;}
+    const juce::String& getExecutionProvider() const {return executionProvider;}
+    // Throws Ort::Exception or std::runtime_error if the provider is not available
+    static void appendExecutionProvider(Ort::SessionOptions& options, const juce::String& provider, int numThreads);
+    // The process-wide arena all sessions allocate from; empty without a shared allocator
+    OrtSharedAllocator::Stats getSharedArenaStats() const;
+    
+private:
+    void createSession(const ModelSource& source);
+    void openSession(const ModelSource& source, const Ort::SessionOptions& options);
+    
+    // Declared before the session, which must be destroyed first
+    std::shared_ptr<OrtEnvironment> environment;
+    std::unique_ptr<OrtPoolThreads> poolThreads;
+    OrtSharedAllocator::SessionUsage memoryUsage;
+    juce::int64 weightBytes = 0;
+    LoadInfo loadInfo;
+    ModelSource modelBytes;
+    juce::String executionProvider;
+    // Optimized models differ by provider
+    juce::String optimizationKey;
+    Ort::SessionOptions session_options;
+    Ort::Session session_{nullptr};
+    bool dynamicBatch = false;
+    std::mutex timingMutex;
+    WindowTiming windowTiming;
+    
+    const std::array<int64_t, 3> inputShape = {1, NUM_INPUT_CHANNELS, WINDOW_SAMPLES};
+    const std::array<int64_t, 3> outputShape = {1, NUM_OUTPUT_CHANNELS, WINDOW_SAMPLES};
+    const std::array<const char*, 1> dnnInputNames = {"input"};
+    const std::array<const char*, 1> dnnOutputNames = {"output"};
+    
+    JUCE_DECLARE_NON_COPYABLE(MorpherModel)
+};
+
+#endif /* MorpherModel_h */
@@ -6,27 +6,52 @@
 //
 
 #include "ONNXInferenceThread.hpp"
-#define ONNX_FILENAME "morpher.onnx"
 
-#define PERFORMANCE_COUNT_START()    static juce::PerformanceCounter    performanceCounter ("MORPHING", 1); \
-performanceCounter.start();
-#define PERFORMANCE_COUNT_END()    performanceCounter.stop();
+static_assert(ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES+ONNXMorpherInferenceThread::DNN_INPUT_CACHE_SAMPLES == MorpherModel::WINDOW_SAMPLES,
+              "Inference window must match the model input shape");
 
-ONNXMorpherInferenceThread::ONNXMorpherInferenceThread()
-:juce::Thread("InferenceThread")
+static MorpherModel::Options getModelOptions(const WorkerPolicy& policy, std::shared_ptr<OrtEnvironment> environment)
 {
-    const juce::File dir = juce::File::getSpecialLocation(juce::File::currentApplicationFile).getChildFile("Contents/Resources");
-    juce::String model_path = dir.getChildFile(ONNX_FILENAME).getFullPathName();
-    
-    session_ = Ort::Session(env, model_path.getCharPointer(), session_options);
+    MorpherModel::Options options;
+    options.threadPolicy = std::make_shared<const WorkerPolicy>(policy);
+    options.autotuned = (environment != nullptr) and environment->getOptions().autotune;
+    options.environment = std::move(environment);
+    return options;
+}
+
+ONNXMorpherInferenceThread::ONNXMorpherInferenceThread(const WorkerPolicy& policy, std::shared_ptr<OrtEnvironment> environment, const ModelSource& source)
+:juce::Thread("InferenceThread"), workerPolicy(policy)
+{
+    model = std::make_shared<MorpherModel>(source, getModelOptions(policy, std::move(environment)));
+    RtLog::writeText(RtLog::Category::model, RtLog::Level::info, "Model loaded: {s}.", model->getLoadInfo().toString());
     run_warmup(3);
-    isInferring = false;
     startThread();
 }
 
+ONNXMorpherInferenceThread::ONNXMorpherInferenceThread(std::shared_ptr<MorpherModel> sharedModel, bool startWorker, const WorkerPolicy& policy)
+:juce::Thread("InferenceThread"), model(std::move(sharedModel)), workerPolicy(policy)
+{
+    if (startWorker)
+    {
+        startThread();
+    }
+}
+
 ONNXMorpherInferenceThread::~ONNXMorpherInferenceThread()
 {
-    stopThread(2000);
+    shutdown();
+}
+
+bool ONNXMorpherInferenceThread::shutdown()
+{
+    // Set the exit flag before waking the worker, so it cannot go back to wait(-1)
+    signalThreadShouldExit();
+    cancelInference();
+    notify();
+    bool stopped = stopThread(SHUTDOWN_TIMEOUT_MS);
+    // So getModel() returns the model the engine would have continued with
+    applyPendingSwap();
+    return stopped;
 }
 
 void ONNXMorpherInferenceThread::requestInference(stereo_float input1[], stereo_float input2[], float rhythmFader,float harmonyFader,float sourceGainFader, float sidechainGainFader, FifoBuffer *outputBuffer)
@@ -38,10 +63,102 @@ void ONNXMorpherInferenceThread::requestInference(stereo_float input1[], stereo_
     sourceGain = sourceGainFader;
     sidechainGain = sidechainGainFader;
     pOutputBuffer = outputBuffer;
+    stampRequest();
+    // A cancel that arrived after the previous window finished must not stop this one
+    cancelRequested = false;
+    runOptions.UnsetTerminate();
+    lastWindowCancelled = false;
     isInferring = true;
     notify();
 }
 
+std::shared_ptr<MorpherModel> ONNXMorpherInferenceThread::getModel() const
+{
+    const juce::ScopedLock lock(critical);
+    return model;
+}
+
+void ONNXMorpherInferenceThread::swapModel(std::shared_ptr<MorpherModel> newModel, std::shared_ptr<WindowCache> newCache)
+{
+    std::shared_ptr<MorpherModel> replacedModel;
+    std::shared_ptr<WindowCache> replacedCache;
+    {
+        const juce::ScopedLock lock(critical);
+        replacedModel = std::exchange(pendingModel, std::move(newModel));
+        replacedCache = std::exchange(pendingCache, std::move(newCache));
+    }
+    if (!isThreadRunning())
+    {
+        // Synchronous use through renderWindow()
+        applyPendingSwap();
+    }
+}
+
+bool ONNXMorpherInferenceThread::isSwapPending() const
+{
+    const juce::ScopedLock lock(critical);
+    return pendingModel != nullptr;
+}
+
+void ONNXMorpherInferenceThread::applyPendingSwap()
+{
+    std::shared_ptr<MorpherModel> oldModel;
+    std::shared_ptr<WindowCache> oldCache;
+    {
+        const juce::ScopedLock lock(critical);
+        if (pendingModel == nullptr)
+        {
+            return;
+        }
+        oldModel = std::exchange(model, std::move(pendingModel));
+        oldCache = std::exchange(windowCache, std::move(pendingCache));
+    }
+    RtLog::writeText(RtLog::Category::model, RtLog::Level::info, "Swapped model: {s}.", model->getLoadInfo().source);
+}
+
+int ONNXMorpherInferenceThread::takeDelayShift()
+{
+    int shift = juce::jlimit(-MAX_DELAY_SHIFT_SAMPLES, MAX_DELAY_SHIFT_SAMPLES, pendingDelayShift.load());
+    pendingDelayShift -= shift;
+    return shift;
+}
+
+void ONNXMorpherInferenceThread::pushWindow(FifoBuffer& fifo, stereo_float window[], int delayShift)
+{
+    // A later start repeats delayShift samples, an earlier one skips them
+    const int start = DNN_OUTPUT_DROP_HEAD_SAMPLES - delayShift;
+    fifo.pushDataOverlap(&window[start], OVERLAP_SAMPLES);
+    fifo.pushData(&window[start+OVERLAP_SAMPLES], DNN_INPUT_SAMPLES + delayShift);
+}
+
+WorkerPolicy::Status ONNXMorpherInferenceThread::getWorkerPolicyStatus() const
+{
+    const juce::ScopedLock lock(critical);
+    return workerPolicyStatus;
+}
+
+void ONNXMorpherInferenceThread::cancelInference()
+{
+    cancelRequested = true;
+    runOptions.SetTerminate();
+}
+
+void ONNXMorpherInferenceThread::renderWindow(const stereo_float input1[], const stereo_float input2[], float rhythmFader, float harmonyFader, float sourceGainFader, float sidechainGainFader, stereo_float output[])
+{
+    // The member buffers are shared with run(), so this must not be mixed with requestInference().
+    jassert(!isThreadRunning());
+    memcpy(inputWav1.data(), input1, sizeof(stereo_float)*(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES));
+    memcpy(inputWav2.data(), input2, sizeof(stereo_float)*(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES));
+    rhythmFaderValue = rhythmFader;
+    harmonyFaderValue = harmonyFader;
+    sourceGain = sourceGainFader;
+    sidechainGain = sidechainGainFader;
+    cancelRequested = false;
+    runOptions.UnsetTerminate();
+    inferWindow();
+    memcpy(output, outputWav.data(), sizeof(stereo_float)*(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES));
+}
+
 bool ONNXMorpherInferenceThread::inputIsEmpty()
 {
     for(int i=0; i < DNN_INPUT_SAMPLES; i++)
@@ -53,76 +170,292 @@ bool ONNXMorpherInferenceThread::inputIsEmpty()
 
 void ONNXMorpherInferenceThread::run_warmup(int n_iter)
 {
-    for(int i=0;i<n_iter;i++)
+    model->warmup(n_iter);
+}
+
+bool ONNXMorpherInferenceThread::inferWindow()
+{
+    float faderSum = rhythmFaderValue + harmonyFaderValue;
+    
+    if ((faderSum==0.0) or (faderSum==2.0) or (inputIsEmpty()))
     {
-        auto memory_info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
-        std::vector<Ort::Value> ort_inputs;
-        ort_inputs.emplace_back(Ort::Value::CreateTensor<float>(memory_info, inputWavArray.data(), 6*(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES), inputShape.data(), inputShape.size()));
+        for(int i=0;i<DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES;i++)
+        {
+            float weight = (faderSum)/2.0f;
+            outputWav[i] = (inputWav1[i]*(1.0f-weight)*sourceGain) + (inputWav2[i]*weight*sidechainGain);
+        }
+    }
+    else
+    {
+        juce::uint64 cacheKey = 0;
+        if (windowCache != nullptr)
+        {
+            rhythmFaderValue = WindowCache::quantize(rhythmFaderValue);
+            harmonyFaderValue = WindowCache::quantize(harmonyFaderValue);
+            sourceGain = WindowCache::quantize(sourceGain);
+            sidechainGain = WindowCache::quantize(sidechainGain);
+            cacheKey = WindowCache::makeKey(inputWav1.data(), inputWav2.data(), rhythmFaderValue, harmonyFaderValue, sourceGain, sidechainGain);
+            if (windowCache->lookup(cacheKey, outputWav.data()))
+            {
+                return true;
+            }
+        }
         
-        std::vector<Ort::Value> ort_outputs;
-        ort_outputs.emplace_back(Ort::Value::CreateTensor<float>(memory_info, outputWavArray.data(), 2*(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES), outputShape.data(), outputShape.size()));
+        double packStartMs = juce::Time::getMillisecondCounterHiRes();
+        packInput(inputWavArray.data(), harmonyFaderValue, rhythmFaderValue);
+        double startMs = juce::Time::getMillisecondCounterHiRes();
+        windowTimes.packMs = startMs - packStartMs;
+        try
+        {
+            model->run(inputWavArray.data(), outputWavArray.data(), runOptions);
+        }
+        catch (const Ort::Exception&)
+        {
+            if (!cancelRequested)
+            {
+                throw;
+            }
+        }
+        if (cancelRequested)
+        {
+            return false;
+        }
+        double unpackStartMs = juce::Time::getMillisecondCounterHiRes();
+        windowTimes.runMs = unpackStartMs - startMs;
+        float elapsedMs = (float)windowTimes.runMs;
+        averageInferenceMs = (averageInferenceMs == 0.0f) ? elapsedMs : averageInferenceMs*0.8f + elapsedMs*0.2f;
+        unpackOutput(outputWavArray.data(), outputWav.data());
+        windowTimes.pushMs = juce::Time::getMillisecondCounterHiRes() - unpackStartMs;
         
-        session_.Run(Ort::RunOptions{nullptr}, dnnInputNames.data(), ort_inputs.data(), 1, dnnOutputNames.data(), ort_outputs.data(), 1);
+        if (windowCache != nullptr)
+        {
+            windowCache->store(cacheKey, outputWav.data());
+        }
+    }
+    return true;
+}
+
+void ONNXMorpherInferenceThread::packInput(float dest[], float harmony, float rhythm)
+{
+    int ch = DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES;
+    for(int i=0; i<(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES); i++)
+    {
+        dest[0*ch+i] = inputWav1[i].l * sourceGain;
+        dest[1*ch+i] = inputWav1[i].r * sourceGain;
+        dest[2*ch+i] = inputWav2[i].l * sidechainGain;
+        dest[3*ch+i] = inputWav2[i].r * sidechainGain;
+        dest[4*ch+i] = harmony;
+        dest[5*ch+i] = rhythm;
+    }
+}
+
+void ONNXMorpherInferenceThread::unpackOutput(const float src[], stereo_float dest[])
+{
+    for(int i=0;i<DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES;i++)
+    {
+        dest[i].l = src[i];
+        dest[i].r = src[DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES+i];
+    }
+}
+
+void ONNXMorpherInferenceThread::setFaderGrid(int numPointsPerAxis)
+{
+    gridPointsPerAxis = (numPointsPerAxis >= 2) ? numPointsPerAxis : 0;
+    size_t numPoints = (size_t)(gridPointsPerAxis*gridPointsPerAxis);
+    gridInputArray.resize(numPoints*MorpherModel::NUM_INPUT_CHANNELS*MorpherModel::WINDOW_SAMPLES);
+    gridOutputArray.resize(numPoints*MorpherModel::NUM_OUTPUT_CHANNELS*MorpherModel::WINDOW_SAMPLES);
+    gridOutputWav.resize(numPoints*MorpherModel::WINDOW_SAMPLES);
+    gridCacheKeys.resize(numPoints);
+    gridBatchPoints.reserve(numPoints);
+}
+
+void ONNXMorpherInferenceThread::requestGridInference(stereo_float input1[], stereo_float input2[], float sourceGainFader, float sidechainGainFader, FifoBuffer outputBuffers[])
+{
+    jassert(gridPointsPerAxis > 0);
+    memcpy(inputWav1.data(), input1, sizeof(stereo_float)*(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES));
+    memcpy(inputWav2.data(), input2, sizeof(stereo_float)*(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES));
+    sourceGain = sourceGainFader;
+    sidechainGain = sidechainGainFader;
+    pOutputBuffer = nullptr;
+    pGridOutputBuffers = outputBuffers;
+    stampRequest();
+    cancelRequested = false;
+    runOptions.UnsetTerminate();
+    lastWindowCancelled = false;
+    isInferring = true;
+    notify();
+}
+
+bool ONNXMorpherInferenceThread::inferGrid()
+{
+    const int numPoints = gridPointsPerAxis*gridPointsPerAxis;
+    const int window = DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES;
+    const bool isEmpty = inputIsEmpty();
+    if (windowCache != nullptr)
+    {
+        sourceGain = WindowCache::quantize(sourceGain);
+        sidechainGain = WindowCache::quantize(sidechainGain);
+    }
+    
+    // Points that are neither a dry mix nor cached go into one batch
+    double packStartMs = juce::Time::getMillisecondCounterHiRes();
+    gridBatchPoints.clear();
+    for (int p = 0; p < numPoints; p++)
+    {
+        float harmony = (float)(p/gridPointsPerAxis)/(float)(gridPointsPerAxis-1);
+        float rhythm = (float)(p%gridPointsPerAxis)/(float)(gridPointsPerAxis-1);
+        stereo_float* pointOutput = &gridOutputWav[(size_t)(p*window)];
+        float faderSum = harmony + rhythm;
+        if ((faderSum==0.0) or (faderSum==2.0) or isEmpty)
+        {
+            float weight = faderSum/2.0f;
+            for(int i=0;i<window;i++)
+            {
+                pointOutput[i] = (inputWav1[i]*(1.0f-weight)*sourceGain) + (inputWav2[i]*weight*sidechainGain);
+            }
+            continue;
+        }
+        if (windowCache != nullptr)
+        {
+            gridCacheKeys[(size_t)p] = WindowCache::makeKey(inputWav1.data(), inputWav2.data(), rhythm, harmony, sourceGain, sidechainGain);
+            if (windowCache->lookup(gridCacheKeys[(size_t)p], pointOutput))
+            {
+                continue;
+            }
+        }
+        packInput(&gridInputArray[gridBatchPoints.size()*MorpherModel::NUM_INPUT_CHANNELS*window], harmony, rhythm);
+        gridBatchPoints.push_back(p);
+    }
+    if (gridBatchPoints.empty())
+    {
+        return true;
     }
     
+    double startMs = juce::Time::getMillisecondCounterHiRes();
+    windowTimes.packMs = startMs - packStartMs;
+    try
+    {
+        model->runBatch(gridInputArray.data(), gridOutputArray.data(), (int)gridBatchPoints.size(), runOptions);
+    }
+    catch (const Ort::Exception&)
+    {
+        if (!cancelRequested)
+        {
+            throw;
+        }
+    }
+    if (cancelRequested)
+    {
+        return false;
+    }
+    double unpackStartMs = juce::Time::getMillisecondCounterHiRes();
+    windowTimes.runMs = unpackStartMs - startMs;
+    for (size_t b = 0; b < gridBatchPoints.size(); b++)
+    {
+        int p = gridBatchPoints[b];
+        stereo_float* pointOutput = &gridOutputWav[(size_t)(p*window)];
+        unpackOutput(&gridOutputArray[b*MorpherModel::NUM_OUTPUT_CHANNELS*window], pointOutput);
+        if (windowCache != nullptr)
+        {
+            windowCache->store(gridCacheKeys[(size_t)p], pointOutput);
+        }
+    }
+    windowTimes.pushMs = juce::Time::getMillisecondCounterHiRes() - unpackStartMs;
+    return true;
+}
+
+void ONNXMorpherInferenceThread::stampRequest()
+{
+    requestMs = juce::Time::getMillisecondCounterHiRes();
+    deadlineMs = nextDeadlineMs;
+    nextDeadlineMs = std::numeric_limits<double>::quiet_NaN();
+}
+
+void ONNXMorpherInferenceThread::recordWindow(bool completed, double pushStartMs)
+{
+    if (telemetry == nullptr)
+    {
+        return;
+    }
+    if (!completed)
+    {
+        telemetry->countCancelled();
+        return;
+    }
+    double doneMs = juce::Time::getMillisecondCounterHiRes();
+    windowTimes.pushMs += doneMs - pushStartMs;
+    windowTimes.slackMs = deadlineMs - (doneMs - requestMs);
+    telemetry->recordWindow(windowTimes);
+    if (windowTimes.runMs >= 0.0)
+    {
+        const MorpherModel::MemoryStats memory = model->getMemoryStats();
+        telemetry->recordMemory(memory.weightBytes, memory.peakRunBytes, model->getSharedArenaStats().peakReservedBytes);
+    }
 }
 
 void ONNXMorpherInferenceThread::run()
 {
+    WorkerPolicy::Status status = workerPolicy.applyToCurrentThread();
+    {
+        const juce::ScopedLock lock(critical);
+        workerPolicyStatus = status;
+    }
+    RtLog::writeText(RtLog::Category::scheduling, status.wasApplied() ? RtLog::Level::info : RtLog::Level::error,
+                     status.wasApplied() ? "Worker policy applied: {s}." : "Worker policy NOT fully applied: {s}.", status.description);
+    
     while (!threadShouldExit())
     {
-        while(!isInferring)
+        while(!isInferring and !threadShouldExit())
         {
             // Wait for inference request
             wait(-1);
         }
-        printf("Inference start. \n");
-        float faderSum = rhythmFaderValue + harmonyFaderValue;
-        
-        if ((faderSum==0.0) or (faderSum==2.0) or (inputIsEmpty()))
+        if (threadShouldExit())
         {
-            for(int i=0;i<DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES;i++)
-            {
-                float weight = (faderSum)/2.0f;
-                outputWav[i] = (inputWav1[i]*(1.0f-weight)*sourceGain) + (inputWav2[i]*weight*sidechainGain);
-            }
+            break;
         }
-        else
+        RtLog::write(RtLog::Category::engine, RtLog::Level::debug, "Inference start.");
+        windowTimes = InferenceTelemetry::WindowTimes();
+        windowTimes.queueWaitMs = juce::Time::getMillisecondCounterHiRes() - requestMs;
+        // Window boundary
+        applyPendingSwap();
+        if (pGridOutputBuffers != nullptr)
         {
-            PERFORMANCE_COUNT_START()
-            int ch = DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES;
-            for(int i=0; i<(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES); i++)
-            {
-                inputWavArray[0*ch+i] = inputWav1[i].l * sourceGain;
-                inputWavArray[1*ch+i] = inputWav1[i].r * sourceGain;
-                inputWavArray[2*ch+i] = inputWav2[i].l * sidechainGain;
-                inputWavArray[3*ch+i] = inputWav2[i].r * sidechainGain;
-                inputWavArray[4*ch+i] = harmonyFaderValue;
-                inputWavArray[5*ch+i] = rhythmFaderValue;
-            }
-            auto memory_info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
-            std::vector<Ort::Value> ort_inputs;
-            ort_inputs.emplace_back(Ort::Value::CreateTensor<float>(memory_info, inputWavArray.data(), 6*(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES), inputShape.data(), inputShape.size()));
-            
-            std::vector<Ort::Value> ort_outputs;
-            ort_outputs.emplace_back(Ort::Value::CreateTensor<float>(memory_info, outputWavArray.data(), 2*(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES), outputShape.data(), outputShape.size()));
-            
-            session_.Run(Ort::RunOptions{nullptr}, dnnInputNames.data(), ort_inputs.data(), 1, dnnOutputNames.data(), ort_outputs.data(), 1);
+            bool completed = inferGrid();
             
-            for(int i=0;i<DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES;i++)
+            const juce::ScopedLock lock(critical);
+            double pushStartMs = juce::Time::getMillisecondCounterHiRes();
+            const int window = DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES;
+            const int delayShift = completed ? takeDelayShift() : 0;
+            for (int p = 0; completed and (p < gridPointsPerAxis*gridPointsPerAxis); p++)
             {
-                outputWav[i].l = outputWavArray[i];
-                outputWav[i].r = outputWavArray[DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES+i];
+                pushWindow(pGridOutputBuffers[p], &gridOutputWav[(size_t)(p*window)], delayShift);
             }
-            PERFORMANCE_COUNT_END()
+            pGridOutputBuffers = nullptr;
+            recordWindow(completed, pushStartMs);
+            RtLog::write(RtLog::Category::engine, RtLog::Level::debug, completed ? "Grid inference complete." : "Grid inference cancelled.");
+            lastWindowCancelled = !completed;
+            isInferring = false;
+            continue;
         }
+        bool completed = inferWindow();
         
         {
             // oush outputWav into outout buffer
             const juce::ScopedLock lock(critical);
-            pOutputBuffer->pushDataOverlap(&outputWav[DNN_OUTPUT_DROP_HEAD_SAMPLES], OVERLAP_SAMPLES);
-            pOutputBuffer->pushData(&outputWav[DNN_OUTPUT_DROP_HEAD_SAMPLES+OVERLAP_SAMPLES], DNN_INPUT_SAMPLES);
-            printf("Inference complete. \n");
+            double pushStartMs = juce::Time::getMillisecondCounterHiRes();
+            if (completed)
+            {
+                pushWindow(*pOutputBuffer, outputWav.data(), takeDelayShift());
+                numWindowsCompleted++;
+                RtLog::write(RtLog::Category::engine, RtLog::Level::debug, "Inference {} complete in {} ms.", numWindowsCompleted.load(), windowTimes.runMs);
+            }
+            else
+            {
+                RtLog::write(RtLog::Category::engine, RtLog::Level::debug, "Inference cancelled.");
+            }
+            recordWindow(completed, pushStartMs);
+            lastWindowCancelled = !completed;
             // Wait for next inference request
             isInferring = false;
         }
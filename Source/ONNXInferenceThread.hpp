@@ -10,32 +10,135 @@
 
 #include <JuceHeader.h>
 #include "DataStructure.h"
-#include <onnxruntime_cxx_api.h>
+#include "MorpherModel.h"
+#include "WindowCache.h"
+#include "InferenceTelemetry.h"
+#include "RtLog.h"
 #include <array>
 
 class ONNXMorpherInferenceThread: public juce::Thread
 {
 public:
-    ONNXMorpherInferenceThread();
+    static const unsigned int DNN_INPUT_SAMPLES = 8192;
+    static const unsigned int DNN_INPUT_CACHE_SAMPLES = 8192;
+    static const unsigned int OVERLAP_SAMPLES = 1024;
+    static const unsigned int DNN_OUTPUT_DROP_HEAD_SAMPLES = 3072;
+    // Upper bound on the destructor. A running window is terminated, which takes
+    // at most one graph node; the thread is killed only if that hangs.
+    static const int SHUTDOWN_TIMEOUT_MS = 2000;
+    // Most a single window moves its output alignment by for shiftOutputDelay()
+    static const int MAX_DELAY_SHIFT_SAMPLES = DNN_OUTPUT_DROP_HEAD_SAMPLES;
+    
+    // Loads the model from source; the policy applies to the worker and the model's pool
+    // threads, unless the environment has global pools with a policy of their own
+    explicit ONNXMorpherInferenceThread(const WorkerPolicy& policy = WorkerPolicy(), std::shared_ptr<OrtEnvironment> environment = nullptr,
+                                        const ModelSource& source = ModelSource::getDefault());
+    // Uses an already loaded (possibly shared) model. The worker thread is only
+    // started if startWorker is true; otherwise use renderWindow() synchronously.
+    ONNXMorpherInferenceThread(std::shared_ptr<MorpherModel> sharedModel, bool startWorker, const WorkerPolicy& policy = WorkerPolicy());
     ~ONNXMorpherInferenceThread() override;
     void run() override;
     void run_warmup(int n_iter);
     bool threadIsInferring(){return isInferring;}
     void requestInference(stereo_float input1[], stereo_float input2[], float rhythmFader, float harmonyFader, float sourceGainFader, float sidechainGainFader, FifoBuffer* outputBuffer);
+    // Runs one window on the calling thread and writes the full model output
+    // (DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES samples) to output.
+    void renderWindow(const stereo_float input1[], const stereo_float input2[], float rhythmFader, float harmonyFader, float sourceGainFader, float sidechainGainFader, stereo_float output[]);
+    // Windows that were rendered before are then served from the cache. With a cache,
+    // fader and gain values are quantized to WindowCache::PARAMETER_STEPS.
+    // Set it before the first inference request.
+    void setWindowCache(std::shared_ptr<WindowCache> cache) {windowCache = std::move(cache);}
+    // The worker records the stage times of every window there. Set it before
+    // the first inference request.
+    void setTelemetry(std::shared_ptr<InferenceTelemetry> newTelemetry) {telemetry = std::move(newTelemetry);}
+    // How many ms after the next request its output is needed, for the window's
+    // slack in the telemetry. Call it right before requesting.
+    void setDeadline(double ms) {nextDeadlineMs = ms;}
+    
+    // Stops the window being inferred (safe from any thread). Its output is
+    // dropped, and wasCancelled() is true once threadIsInferring() turns false.
+    void cancelInference();
+    // Cancels the running window and stops the worker; returns false if it had
+    // to be killed after SHUTDOWN_TIMEOUT_MS. A pending swap is applied.
+    // Called by the destructor.
+    bool shutdown();
+    bool wasCancelled() const {return lastWindowCancelled;}
+    // Moving average of the model run time
+    float getAverageInferenceMs() const {return averageInferenceMs;}
+    // What the worker thread runs with, once it has started
+    WorkerPolicy::Status getWorkerPolicyStatus() const;
+    MorpherModel::PoolThreadStatus getPoolThreadStatus() const {return getModel()->getPoolThreadStatus();}
+    MorpherModel::MemoryStats getMemoryStats() const {return getModel()->getMemoryStats();}
+    OrtSharedAllocator::Stats getSharedArenaStats() const {return getModel()->getSharedArenaStats();}
+    juce::int64 getNumWindowsCompleted() const {return numWindowsCompleted;}
+    std::shared_ptr<MorpherModel> getModel() const;
+    
+    // Hot swap: the worker switches to newModel and its window cache when it starts
+    // the next window, so that window's head crossfades with the old model's tail
+    // in pushDataOverlap(). The old model is released on the worker thread.
+    // Message thread; a swap that has not been picked up yet is replaced.
+    void swapModel(std::shared_ptr<MorpherModel> newModel, std::shared_ptr<WindowCache> newCache);
+    bool isSwapPending() const;
+    // Lengthens (positive) or shortens the queued output by numSamples. Each window
+    // takes its output up to MAX_DELAY_SHIFT_SAMPLES earlier or later than usual,
+    // and the jump is hidden in its overlap crossfade, so there is no gap.
+    void shiftOutputDelay(int numSamples) {pendingDelayShift += numSamples;}
+    int getPendingDelayShift() const {return pendingDelayShift;}
+    // When the output FIFOs are reset anyway. Only while no window is in flight.
+    void cancelDelayShift() {pendingDelayShift = 0;}
+    
+    // Fader grid: each window is rendered at numPointsPerAxis x numPointsPerAxis
+    // harmony/rhythm settings in one batched run, so the output stage can
+    // interpolate between them as the faders move. Point p has harmony
+    // (p / numPointsPerAxis) and rhythm (p % numPointsPerAxis), scaled to 0..1.
+    // Allocates the grid buffers, so call it once up front, and never while a
+    // grid inference is in flight.
+    void setFaderGrid(int numPointsPerAxis);
+    int getFaderGridPointsPerAxis() const {return gridPointsPerAxis;}
+    // outputBuffers holds one FIFO per grid point
+    void requestGridInference(stereo_float input1[], stereo_float input2[], float sourceGainFader, float sidechainGainFader, FifoBuffer outputBuffers[]);
 private:
-    bool isInferring;
+    std::atomic<bool> isInferring{false};
     juce::CriticalSection critical;
     
-    Ort::Env env;
-    Ort::SessionOptions session_options;
-    Ort::Session session_{nullptr};
+    std::shared_ptr<MorpherModel> model;
+    std::shared_ptr<WindowCache> windowCache;
+    std::shared_ptr<InferenceTelemetry> telemetry;
+    // Set by the requester before isInferring, read by the worker
+    double requestMs = 0.0;
+    double deadlineMs = std::numeric_limits<double>::quiet_NaN();
+    double nextDeadlineMs = std::numeric_limits<double>::quiet_NaN();
+    // The window being processed; worker thread
+    InferenceTelemetry::WindowTimes windowTimes;
+    // Guarded by critical
+    std::shared_ptr<MorpherModel> pendingModel;
+    std::shared_ptr<WindowCache> pendingCache;
+    std::atomic<int> pendingDelayShift{0};
     
-    bool inputIsEmpty();
+    const WorkerPolicy workerPolicy;
+    WorkerPolicy::Status workerPolicyStatus;
     
-    static const unsigned int DNN_INPUT_SAMPLES = 8192;
-    static const unsigned int DNN_INPUT_CACHE_SAMPLES = 8192;
-    static const unsigned int OVERLAP_SAMPLES = 1024;
-    static const unsigned int DNN_OUTPUT_DROP_HEAD_SAMPLES = 3072;
+    Ort::RunOptions runOptions;
+    std::atomic<bool> cancelRequested{false};
+    std::atomic<bool> lastWindowCancelled{false};
+    std::atomic<float> averageInferenceMs{0.0f};
+    std::atomic<juce::int64> numWindowsCompleted{0};
+    
+    bool inputIsEmpty();
+    // Returns false if the window was cancelled
+    bool inferWindow();
+    bool inferGrid();
+    // Takes the request time and deadline of the window just requested
+    void stampRequest();
+    // Records the window that just finished, or was cancelled, in the telemetry
+    void recordWindow(bool completed, double pushStartMs);
+    void packInput(float dest[], float harmony, float rhythm);
+    void unpackOutput(const float src[], stereo_float dest[]);
+    void applyPendingSwap();
+    // The part of this window's delay shift that can be applied, removed from the pending shift
+    int takeDelayShift();
+    // Crossfades a window's output into the FIFO, shifted later by delayShift samples
+    static void pushWindow(FifoBuffer& fifo, stereo_float window[], int delayShift);
     
     std::array<stereo_float, DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES> inputWav1 = {0.0};
     std::array<stereo_float, DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES> inputWav2 = {0.0};
@@ -44,11 +147,6 @@ private:
     std::array<float,(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES)*6> inputWavArray={0.0};
     std::array<float,(DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES)*2> outputWavArray={0.0};
     
-    const std::array<int64_t, 3> inputShape = {1, 6, DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES};
-    const std::array<int64_t, 3> outputShape = {1, 2, DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES};
-    const std::array<const char*, 1> dnnInputNames = {"input"};
-    const std::array<const char*, 1> dnnOutputNames = {"output"};
-    
     float faderValue;
     float rhythmFaderValue;
     float harmonyFaderValue;
@@ -56,6 +154,14 @@ private:
     float sidechainGain;
     FifoBuffer* pOutputBuffer;
     
+    int gridPointsPerAxis = 0;
+    FifoBuffer* pGridOutputBuffers = nullptr;
+    std::vector<float> gridInputArray;
+    std::vector<float> gridOutputArray;
+    std::vector<stereo_float> gridOutputWav;
+    std::vector<juce::uint64> gridCacheKeys;
+    std::vector<int> gridBatchPoints;
+    
 };
 
 #endif /* ProcessThread_hpp */
@@ -0,0 +1,131 @@
+//
+//  OfflineRenderer.cpp
+//  HARD
+//
+
+#include "OfflineRenderer.h"
+
+// Leading zeros fed to the model so that the first sample kept after
+// DNN_OUTPUT_DROP_HEAD_SAMPLES and the overlap is the first input sample.
+static const int LEAD_IN_SAMPLES = ONNXMorpherInferenceThread::DNN_OUTPUT_DROP_HEAD_SAMPLES + ONNXMorpherInferenceThread::OVERLAP_SAMPLES;
+static const int OVERLAP_SAMPLES = ONNXMorpherInferenceThread::OVERLAP_SAMPLES;
+static const int DROP_HEAD_SAMPLES = ONNXMorpherInferenceThread::DNN_OUTPUT_DROP_HEAD_SAMPLES;
+
+OfflineMorpherRenderer::OfflineMorpherRenderer(ONNXMorpherInferenceThread& e)
+:engine(e)
+{
+    reset();
+}
+
+void OfflineMorpherRenderer::reset()
+{
+    const juce::ScopedLock lock(outputLock);
+    fifoBufferIn1.clearBuffer();
+    fifoBufferIn2.clearBuffer();
+    fifoBufferOut.clearBuffer();
+    fifoBufferIn1.fillZeros(LEAD_IN_SAMPLES);
+    fifoBufferIn2.fillZeros(LEAD_IN_SAMPLES);
+    // The first window crossfades into these; they are dropped afterwards
+    fifoBufferOut.fillZeros(OVERLAP_SAMPLES);
+
+    inputFinished = false;
+    numInputSamples = 0;
+    numOutputFinal = 0;
+    numOutputRead = 0;
+    numWindowsRendered = 0;
+}
+
+void OfflineMorpherRenderer::setParameters(float harmony, float rhythm, float sourceGain, float sidechainGain)
+{
+    harmonyValue = harmony;
+    rhythmValue = rhythm;
+    sourceGainValue = sourceGain;
+    sidechainGainValue = sidechainGain;
+}
+
+int OfflineMorpherRenderer::getInputFreeSpace()
+{
+    return juce::jmin(fifoBufferIn1.getFreeSpace(), fifoBufferIn2.getFreeSpace());
+}
+
+void OfflineMorpherRenderer::pushInput(const float sourceL[], const float sourceR[], const float sidechainL[], const float sidechainR[], int numSamples)
+{
+    jassert(!inputFinished);
+    fifoBufferIn1.pushData(sourceL, sourceR, numSamples);
+    fifoBufferIn2.pushData(sidechainL, sidechainR, numSamples);
+    numInputSamples += numSamples;
+}
+
+void OfflineMorpherRenderer::finishInput()
+{
+    inputFinished = true;
+}
+
+bool OfflineMorpherRenderer::canRenderWindow()
+{
+    if (inputFinished and (numOutputFinal >= numInputSamples))
+    {
+        return false;
+    }
+
+    bool inputReady = inputFinished
+                   or (juce::jmin(fifoBufferIn1.getBufferSize(), fifoBufferIn2.getBufferSize()) >= WINDOW_SAMPLES);
+    return inputReady and (fifoBufferOut.getFreeSpace() >= HOP_SAMPLES);
+}
+
+void OfflineMorpherRenderer::renderNextWindow()
+{
+    jassert(canRenderWindow());
+
+    if (inputFinished)
+    {
+        // Pad the tail with silence so every input sample gets rendered
+        fifoBufferIn1.fillZeros(juce::jmax(0, WINDOW_SAMPLES - fifoBufferIn1.getBufferSize()));
+        fifoBufferIn2.fillZeros(juce::jmax(0, WINDOW_SAMPLES - fifoBufferIn2.getBufferSize()));
+    }
+
+    fifoBufferIn1.readData(window1.data(), WINDOW_SAMPLES, HOP_SAMPLES);
+    fifoBufferIn2.readData(window2.data(), WINDOW_SAMPLES, HOP_SAMPLES);
+
+    engine.renderWindow(window1.data(), window2.data(), rhythmValue, harmonyValue, sourceGainValue, sidechainGainValue, windowOut.data());
+
+    const juce::ScopedLock lock(outputLock);
+    fifoBufferOut.pushDataOverlap(&windowOut[DROP_HEAD_SAMPLES], OVERLAP_SAMPLES);
+    fifoBufferOut.pushData(&windowOut[DROP_HEAD_SAMPLES+OVERLAP_SAMPLES], HOP_SAMPLES);
+    if (numWindowsRendered == 0)
+    {
+        // Drop the zeros from reset(), window1 is free to use as scratch here
+        fifoBufferOut.readData(window1.data(), OVERLAP_SAMPLES, OVERLAP_SAMPLES);
+    }
+    numWindowsRendered++;
+    // The last OVERLAP_SAMPLES are still blended with the next window
+    numOutputFinal = (juce::int64)numWindowsRendered*HOP_SAMPLES - OVERLAP_SAMPLES;
+}
+
+int OfflineMorpherRenderer::getNumOutputReady()
+{
+    const juce::ScopedLock lock(outputLock);
+    if (numWindowsRendered == 0)
+    {
+        return 0;
+    }
+
+    juce::int64 numReady = numOutputFinal - numOutputRead;
+    if (inputFinished)
+    {
+        numReady = juce::jmin(numReady, numInputSamples - numOutputRead);
+    }
+    return (int)juce::jmax((juce::int64)0, numReady);
+}
+
+void OfflineMorpherRenderer::readOutput(float outL[], float outR[], int numSamples)
+{
+    const juce::ScopedLock lock(outputLock);
+    fifoBufferOut.readData(outL, outR, numSamples, numSamples);
+    numOutputRead += numSamples;
+}
+
+bool OfflineMorpherRenderer::isFinished()
+{
+    return inputFinished and (numOutputRead >= numInputSamples);
+}
@@ -0,0 +1,70 @@
+//
+//  OfflineRenderer.h
+//  HARD
+//
+
+#ifndef OfflineRenderer_h
+#define OfflineRenderer_h
+
+#include <JuceHeader.h>
+#include "DataStructure.h"
+#include "ONNXInferenceThread.hpp"
+
+// Runs the same windowing as HARDAudioProcessor::processBlock, but driven by
+// the caller instead of the audio callback and without the plugin's output delay:
+// the n-th sample read from the output is aligned with the n-th input sample.
+//
+// Memory use is constant (three FifoBuffers and one window of scratch).
+// Input, rendering and output may run on three different threads: the input
+// FIFOs have a single producer and a single consumer, and the output FIFO is
+// guarded by a lock because pushDataOverlap() rewrites its unread tail.
+class OfflineMorpherRenderer
+{
+public:
+    static const int WINDOW_SAMPLES = ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES + ONNXMorpherInferenceThread::DNN_INPUT_CACHE_SAMPLES;
+    static const int HOP_SAMPLES = ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES;
+
+    explicit OfflineMorpherRenderer(ONNXMorpherInferenceThread& engine);
+
+    void reset();
+    void setParameters(float harmony, float rhythm, float sourceGain, float sidechainGain);
+
+    // Input side
+    int getInputFreeSpace();
+    void pushInput(const float sourceL[], const float sourceR[], const float sidechainL[], const float sidechainR[], int numSamples);
+    void finishInput();
+
+    // Rendering side
+    bool canRenderWindow();
+    void renderNextWindow();
+
+    // Output side
+    int getNumOutputReady();
+    void readOutput(float outL[], float outR[], int numSamples);
+    bool isFinished();
+
+private:
+    ONNXMorpherInferenceThread& engine;
+    juce::CriticalSection outputLock;
+
+    FifoBuffer fifoBufferIn1;
+    FifoBuffer fifoBufferIn2;
+    FifoBuffer fifoBufferOut;
+
+    std::array<stereo_float, WINDOW_SAMPLES> window1;
+    std::array<stereo_float, WINDOW_SAMPLES> window2;
+    std::array<stereo_float, WINDOW_SAMPLES> windowOut;
+
+    std::atomic<float> harmonyValue{0.0f};
+    std::atomic<float> rhythmValue{0.0f};
+    std::atomic<float> sourceGainValue{1.0f};
+    std::atomic<float> sidechainGainValue{1.0f};
+
+    std::atomic<bool> inputFinished{false};
+    std::atomic<juce::int64> numInputSamples{0};
+    std::atomic<juce::int64> numOutputFinal{0};
+    std::atomic<juce::int64> numOutputRead{0};
+    int numWindowsRendered = 0;
+};
+
+#endif /* OfflineRenderer_h */
@@ -0,0 +1,72 @@
+//
+//  OptimizedModelCache.cpp
+//  HARD
+//
+
+#include "OptimizedModelCache.h"
+#include "WindowCache.h"
+#include <onnxruntime_cxx_api.h>
+
+static juce::String toHex(juce::uint64 hash)
+{
+    return juce::String::toHexString((juce::int64)hash).paddedLeft('0', 16);
+}
+
+OptimizedModelCache::OptimizedModelCache(const juce::File& d)
+:directory(d)
+{
+    directory.createDirectory();
+}
+
+juce::File OptimizedModelCache::getDefaultDirectory()
+{
+    return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory).getChildFile("HARD/ModelCache");
+}
+
+juce::File OptimizedModelCache::getKeyFile(const juce::File& file)
+{
+    return file.withFileExtension(".key");
+}
+
+OptimizedModelCache::Entry OptimizedModelCache::find(const ModelSource& source, const juce::String& optionsKey) const
+{
+    Entry entry;
+    // Hashed once per model, not per session
+    const juce::String modelHash = source.getContentHash();
+    if (modelHash.isEmpty())
+    {
+        return entry;
+    }
+    // One entry per model and options, e.g. per execution provider
+    const juce::String name = (source.getFile() != juce::File() ? source.getFile().getFullPathName() : source.getDescription()) + "\n" + optionsKey;
+    entry.file = directory.getChildFile(toHex(WindowCache::hashBytes(name.toRawUTF8(), name.getNumBytesAsUTF8(), 0)) + ".ort");
+    entry.key = "model " + modelHash
+              + "\nonnxruntime " + OrtGetApiBase()->GetVersionString()
+              + "\ncpu " + juce::SystemStats::getCpuVendor() + " " + juce::SystemStats::getCpuModel()
+              + "\n" + optionsKey + "\n";
+    entry.isValid = entry.file.existsAsFile() and (getKeyFile(entry.file).loadFileAsString() == entry.key);
+    return entry;
+}
+
+juce::File OptimizedModelCache::createTemporaryFile(const Entry& entry) const
+{
+    // Unique, as several instances can be starting at once
+    return entry.file.getSiblingFile(entry.file.getFileNameWithoutExtension() + "-" + juce::Uuid().toString() + ".tmp");
+}
+
+bool OptimizedModelCache::store(const Entry& entry, const juce::File& writtenFile) const
+{
+    // A reader in between sees the old key and rewrites the entry, which is harmless
+    if (!writtenFile.existsAsFile() or !writtenFile.moveFileTo(entry.file))
+    {
+        writtenFile.deleteFile();
+        return false;
+    }
+    return getKeyFile(entry.file).replaceWithText(entry.key);
+}
+
+void OptimizedModelCache::remove(const Entry& entry) const
+{
+    getKeyFile(entry.file).deleteFile();
+    entry.file.deleteFile();
+}
@@ -0,0 +1,47 @@
+//
+//  OptimizedModelCache.h
+//  HARD
+//
+
+#ifndef OptimizedModelCache_h
+#define OptimizedModelCache_h
+
+#include <JuceHeader.h>
+#include "ModelSource.h"
+
+// ONNX models as ONNX Runtime has optimized them, saved in ORT format so later
+// sessions load them with graph optimizations disabled. The fully optimized
+// graph is specific to the CPU, ONNX Runtime version and optimization options,
+// so an entry is only used if its key (those plus the model's hash) still
+// matches; otherwise it is replaced. There is one entry per model source.
+class OptimizedModelCache
+{
+public:
+    struct Entry
+    {
+        juce::File file;
+        juce::String key;
+        bool isValid = false;       // file exists and was written for key
+    };
+
+    explicit OptimizedModelCache(const juce::File& directory);
+
+    // ~/Library/Application Support/HARD/ModelCache on macOS
+    static juce::File getDefaultDirectory();
+
+    // Entry for source, with the given optimization options as part of the key
+    Entry find(const ModelSource& source, const juce::String& optionsKey) const;
+    // A file for ONNX Runtime to write the optimized model to
+    juce::File createTemporaryFile(const Entry& entry) const;
+    // Moves the written file into place, then records the key
+    bool store(const Entry& entry, const juce::File& writtenFile) const;
+    // Deletes an entry that could not be loaded
+    void remove(const Entry& entry) const;
+
+private:
+    static juce::File getKeyFile(const juce::File& file);
+
+    juce::File directory;
+};
+
+#endif /* OptimizedModelCache_h */
@@ -0,0 +1,241 @@
+//
+//  OrtAutotuner.cpp
+//  HARD
+//
+
+#include "OrtAutotuner.h"
+#include "RtLog.h"
+#include "WindowCache.h"
+#include "WorkerPolicy.h"
+
+#define AUTOTUNE_KEY "autotune."
+
+static juce::String getMachineKey()
+{
+    return juce::SystemStats::getCpuVendor() + " " + juce::SystemStats::getCpuModel()
+         + ", " + juce::String(juce::SystemStats::getNumCpus()) + " cores, onnxruntime " + OrtGetApiBase()->GetVersionString();
+}
+
+static juce::String getSettingsKey(const juce::String& modelHash)
+{
+    const juce::String key = getMachineKey() + "\n" + modelHash;
+    return AUTOTUNE_KEY + juce::String::toHexString((juce::int64)WindowCache::hashBytes(key.toRawUTF8(), key.getNumBytesAsUTF8(), 0)).paddedLeft('0', 16);
+}
+
+juce::String OrtAutotuner::Configuration::toString() const
+{
+    return (executionProvider.isNotEmpty() ? executionProvider : juce::String("CPU")) + ", "
+         + (intraOpThreads > 0 ? juce::String(intraOpThreads) + " threads" : juce::String("default threads"))
+         + ": " + juce::String(windowMs, 1) + " ms per window";
+}
+
+juce::StringArray OrtAutotuner::getCandidateProviders()
+{
+    juce::StringArray candidates {""};
+    for (const auto& provider : Ort::GetAvailableProviders())
+    {
+        if (provider == "XnnpackExecutionProvider")
+        {
+            candidates.add("XNNPACK");
+        }
+        else if (provider == "DnnlExecutionProvider")
+        {
+            candidates.add("DNNL");
+        }
+    }
+    return candidates;
+}
+
+static double timeConfiguration(const ModelSource& source, const OrtAutotuner::Configuration& configuration, int iterations,
+                                const Ort::RunOptions& runOptions)
+{
+    MorpherModel::Options options;
+    options.environment = OrtEnvironment::getShared({});
+    options.perSessionThreads = true;
+    options.intraOpThreads = configuration.intraOpThreads;
+    options.executionProvider = configuration.executionProvider;
+    MorpherModel model(source, options);
+    std::vector<float> input(MorpherModel::NUM_INPUT_CHANNELS*MorpherModel::WINDOW_SAMPLES, 0.0f);
+    std::vector<float> output(MorpherModel::NUM_OUTPUT_CHANNELS*MorpherModel::WINDOW_SAMPLES, 0.0f);
+    for (int i = 0; i < 2; i++)
+    {
+        model.run(input.data(), output.data(), runOptions);
+    }
+    std::vector<double> times;
+    for (int i = 0; i < iterations; i++)
+    {
+        const double start = juce::Time::getMillisecondCounterHiRes();
+        model.run(input.data(), output.data(), runOptions);
+        times.push_back(juce::Time::getMillisecondCounterHiRes() - start);
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size()/2];
+}
+
+OrtAutotuner::Configuration OrtAutotuner::tune(const ModelSource& source, const Options& options)
+{
+    juce::Array<int> threadCounts = options.threadCounts;
+    if (threadCounts.isEmpty())
+    {
+        const int numCores = juce::SystemStats::getNumPhysicalCpus();
+        for (int n = 1; n < numCores; n *= 2)
+        {
+            threadCounts.add(n);
+        }
+        threadCounts.add(numCores);
+    }
+    
+    Configuration fastest;
+    for (const auto& provider : getCandidateProviders())
+    {
+        for (int numThreads : threadCounts)
+        {
+            if ((options.shouldStop != nullptr) and options.shouldStop())
+            {
+                return {};
+            }
+            Configuration candidate;
+            candidate.executionProvider = provider;
+            candidate.intraOpThreads = numThreads;
+            try
+            {
+                candidate.windowMs = timeConfiguration(source, candidate, juce::jmax(1, options.iterations),
+                                                       options.runOptions != nullptr ? *options.runOptions : Ort::RunOptions{nullptr});
+            }
+            catch (const std::exception& e)
+            {
+                if ((options.shouldStop != nullptr) and options.shouldStop())
+                {
+                    // Terminated rather than failed
+                    return {};
+                }
+                if (options.verbose)
+                {
+                    std::printf("  %-8s %2d threads  failed: %s\n", provider.isNotEmpty() ? provider.toRawUTF8() : "CPU", numThreads, e.what());
+                }
+                break;
+            }
+            if (options.verbose)
+            {
+                std::printf("  %-8s %2d threads  %8.1f ms\n", provider.isNotEmpty() ? provider.toRawUTF8() : "CPU", numThreads, candidate.windowMs);
+            }
+            if (!fastest.isValid() or (candidate.windowMs < fastest.windowMs))
+            {
+                fastest = candidate;
+            }
+        }
+    }
+    if (fastest.isValid())
+    {
+        store(source, fastest);
+    }
+    return fastest;
+}
+
+OrtAutotuner::Configuration OrtAutotuner::findStored(const ModelSource& source)
+{
+    Configuration configuration;
+    const juce::String modelHash = source.getContentHash();
+    if (modelHash.isEmpty())
+    {
+        return configuration;
+    }
+    // "<provider or CPU> <threads> <ms>"
+    const juce::StringArray fields = juce::StringArray::fromTokens(WorkerPolicy::openUserSettings()->getValue(getSettingsKey(modelHash)), false);
+    if (fields.size() == 3)
+    {
+        configuration.executionProvider = fields[0] == "CPU" ? juce::String() : fields[0];
+        configuration.intraOpThreads = fields[1].getIntValue();
+        configuration.windowMs = fields[2].getDoubleValue();
+    }
+    return configuration;
+}
+
+void OrtAutotuner::store(const ModelSource& source, const Configuration& configuration)
+{
+    const juce::String modelHash = source.getContentHash();
+    if (modelHash.isEmpty())
+    {
+        return;
+    }
+    auto settings = WorkerPolicy::openUserSettings();
+    settings->setValue(getSettingsKey(modelHash), (configuration.executionProvider.isNotEmpty() ? configuration.executionProvider : juce::String("CPU"))
+                                                  + " " + juce::String(configuration.intraOpThreads) + " " + juce::String(configuration.windowMs, 2));
+    settings->saveIfNeeded();
+}
+
+AutotuneThread::AutotuneThread()
+:juce::Thread("AutotuneThread")
+{
+}
+
+AutotuneThread::~AutotuneThread()
+{
+    // A session being created cannot be interrupted
+    stopThread(-1);
+}
+
+void AutotuneThread::startIfNeeded(const ModelSource& newSource)
+{
+    {
+        const juce::ScopedLock sl(lock);
+        if (!awakeInstances.isEmpty() or isThreadRunning() or finishedModels.contains(newSource.getDescription()))
+        {
+            return;
+        }
+    }
+    if (OrtAutotuner::findStored(newSource).isValid())
+    {
+        return;
+    }
+    // A stopped run has exited or is about to
+    stopThread(-1);
+    const juce::ScopedLock sl(lock);
+    if (!awakeInstances.isEmpty())
+    {
+        return;
+    }
+    source = newSource;
+    runOptions.UnsetTerminate();
+    startThread();
+}
+
+void AutotuneThread::stopSoon()
+{
+    signalThreadShouldExit();
+    runOptions.SetTerminate();
+}
+
+void AutotuneThread::setInstanceAwake(const void* instance, bool isAwake)
+{
+    const juce::ScopedLock sl(lock);
+    if (isAwake)
+    {
+        awakeInstances.addIfNotAlreadyThere(instance);
+        stopSoon();
+    }
+    else
+    {
+        awakeInstances.removeFirstMatchingValue(instance);
+    }
+}
+
+void AutotuneThread::run()
+{
+    OrtAutotuner::Options options;
+    options.shouldStop = [this]{return threadShouldExit();};
+    options.runOptions = &runOptions;
+    const OrtAutotuner::Configuration fastest = OrtAutotuner::tune(source, options);
+    if (threadShouldExit())
+    {
+        // Runs again the next time instances are idle
+        return;
+    }
+    if (fastest.isValid())
+    {
+        RtLog::writeText(RtLog::Category::scheduling, RtLog::Level::info, "Autotuned {s}.", source.getDescription() + ": " + fastest.toString());
+    }
+    // Also when nothing could be timed, so it is not retried in this process
+    const juce::ScopedLock sl(lock);
+    finishedModels.add(source.getDescription());
+}
@@ -0,0 +1,90 @@
+//
+//  OrtAutotuner.h
+//  HARD
+//
+
+#ifndef OrtAutotuner_h
+#define OrtAutotuner_h
+
+#include <JuceHeader.h>
+#include "MorpherModel.h"
+
+// Finds the fastest ONNX Runtime configuration for a model on this machine:
+// every CPU execution provider this ONNX Runtime build has (the default one,
+// XNNPACK, oneDNN) at several intra-op thread counts, timed on the model's
+// real window shape. The winner is stored in HARD.settings per machine (CPU,
+// core count, ONNX Runtime version) and model hash, and sessions created with
+// MorpherModel::Options::autotuned use it.
+//
+// ONNX Runtime has one environment per process, so a thread count is timed on
+// a session pool of that size, standing in for a shared pool of that size.
+// Sessions on the environment's shared pool take only the provider; the
+// plugin sizes that pool from the stored thread count when it is created.
+class OrtAutotuner
+{
+public:
+    struct Configuration
+    {
+        juce::String executionProvider;     // empty for the default CPU provider
+        int intraOpThreads = 0;
+        double windowMs = 0.0;              // median of the timed runs; 0 if not tuned
+
+        bool isValid() const {return windowMs > 0.0;}
+        // e.g. "XNNPACK, 4 threads: 21.3 ms per window"
+        juce::String toString() const;
+    };
+
+    struct Options
+    {
+        // Powers of two up to the core count, and the core count, if empty
+        juce::Array<int> threadCounts;
+        int iterations = 5;
+        // Checked between configurations; a stopped run stores nothing
+        std::function<bool()> shouldStop;
+        // For the timed runs, so SetTerminate() stops the one in progress
+        const Ort::RunOptions* runOptions = nullptr;
+        // Prints each configuration as it is timed
+        bool verbose = false;
+    };
+
+    // Of "", "XNNPACK" and "DNNL", those this ONNX Runtime build lists
+    static juce::StringArray getCandidateProviders();
+    // Times every candidate on source and stores the fastest. Returns it,
+    // or an invalid configuration if stopped or nothing could be timed.
+    static Configuration tune(const ModelSource& source, const Options& options);
+
+    static Configuration findStored(const ModelSource& source);
+    static void store(const ModelSource& source, const Configuration& configuration);
+};
+
+// Tunes the model in the background, once per process and model, unless a
+// configuration is stored already. Meant to be held through a
+// juce::SharedResourcePointer. The timings compete with anything else running,
+// so it only runs while no instance in the process is awake.
+class AutotuneThread: private juce::Thread
+{
+public:
+    AutotuneThread();
+    ~AutotuneThread() override;
+
+    // Does nothing while an instance is awake
+    void startIfNeeded(const ModelSource& source);
+    // Does not wait; the run being timed is terminated and a session being
+    // created is finished first
+    void stopSoon();
+    // An instance that wakes, or starts loading to wake, stops the tuning
+    void setInstanceAwake(const void* instance, bool isAwake);
+
+private:
+    void run() override;
+
+    ModelSource source;
+    Ort::RunOptions runOptions;
+    juce::CriticalSection lock;
+    juce::StringArray finishedModels;
+    juce::Array<const void*> awakeInstances;
+
+    JUCE_DECLARE_NON_COPYABLE(AutotuneThread)
+};
+
+#endif /* OrtAutotuner_h */
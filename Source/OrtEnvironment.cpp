@@ -0,0 +1,320 @@
+//
+//  OrtEnvironment.cpp
+//  HARD
+//
+
+#include "OrtEnvironment.h"
+#include "OptimizedModelCache.h"
+#include "RtLog.h"
+#include <thread>
+
+// ONNX Runtime's own CPU allocator aligns to 64 bytes
+static const size_t BLOCK_ALIGNMENT = 64;
+// Rounding makes near-identical requests share free blocks
+static const size_t BLOCK_GRANULARITY = 4096;
+
+// The session whose allocations the calling thread makes
+static thread_local OrtSessionUsage* currentSession = nullptr;
+
+OrtPoolThreads::OrtPoolThreads(std::shared_ptr<const WorkerPolicy> p, OrtSessionUsage* s)
+:policy(std::move(p)), session(s)
+{
+}
+
+void OrtPoolThreads::install(Ort::SessionOptions& sessionOptions)
+{
+    sessionOptions.SetCustomCreateThreadFn(create);
+    sessionOptions.SetCustomThreadCreationOptions(this);
+    sessionOptions.SetCustomJoinThreadFn(join);
+}
+
+void OrtPoolThreads::install(OrtThreadingOptions* threadingOptions)
+{
+    const OrtApi& api = Ort::GetApi();
+    Ort::ThrowOnError(api.SetGlobalCustomCreateThreadFn(threadingOptions, create));
+    Ort::ThrowOnError(api.SetGlobalCustomThreadCreationOptions(threadingOptions, this));
+    Ort::ThrowOnError(api.SetGlobalCustomJoinThreadFn(threadingOptions, join));
+}
+
+OrtPoolThreads::Status OrtPoolThreads::getStatus() const
+{
+    const juce::ScopedLock sl(lock);
+    return status;
+}
+
+OrtCustomThreadHandle OrtPoolThreads::create(void* options, OrtThreadWorkerFn workerFn, void* workerParam)
+{
+    auto* self = static_cast<OrtPoolThreads*>(options);
+    auto* thread = new std::thread([self, workerFn, workerParam]
+    {
+        currentSession = self->session;
+        WorkerPolicy::Status applied;
+        if (self->policy != nullptr)
+        {
+            applied = self->policy->applyToCurrentThread();
+        }
+        {
+            const juce::ScopedLock sl(self->lock);
+            self->status.numThreads++;
+            self->status.numNotApplied += applied.wasApplied() ? 0 : 1;
+            self->status.lastDescription = applied.description;
+        }
+        workerFn(workerParam);
+    });
+    return reinterpret_cast<OrtCustomThreadHandle>(thread);
+}
+
+void OrtPoolThreads::join(OrtCustomThreadHandle handle)
+{
+    auto* thread = reinterpret_cast<std::thread*>(const_cast<OrtCustomHandleType*>(handle));
+    thread->join();
+    delete thread;
+}
+
+//==============================================================================
+// Stored in front of each block; the block itself starts at the next alignment boundary
+struct BlockHeader
+{
+    void* base;
+    size_t size;
+    OrtSharedAllocator::SessionUsage* session;
+};
+
+static BlockHeader* getHeader(void* pointer)
+{
+    return reinterpret_cast<BlockHeader*>(static_cast<char*>(pointer) - sizeof(BlockHeader));
+}
+
+OrtSharedAllocator::ScopedSession::ScopedSession(SessionUsage& usage)
+:previous(currentSession)
+{
+    currentSession = &usage;
+}
+
+OrtSharedAllocator::ScopedSession::~ScopedSession()
+{
+    currentSession = previous;
+}
+
+OrtSharedAllocator::OrtSharedAllocator(juce::int64 limitBytes)
+{
+    version = ORT_API_VERSION;
+    Alloc = [](OrtAllocator* self, size_t size) {return static_cast<OrtSharedAllocator*>(self)->allocate(size);};
+    Free = [](OrtAllocator* self, void* pointer) {static_cast<OrtSharedAllocator*>(self)->release(pointer);};
+    Info = [](const OrtAllocator* self) {return static_cast<const OrtMemoryInfo*>(static_cast<const OrtSharedAllocator*>(self)->memoryInfo);};
+    memoryInfo = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeDefault);
+    stats.limitBytes = limitBytes;
+}
+
+OrtSharedAllocator::~OrtSharedAllocator()
+{
+    // Sessions have released everything by now
+    jassert(stats.inUseBytes == 0);
+    releaseFreeBlocks();
+}
+
+void* OrtSharedAllocator::allocate(size_t requested)
+{
+    const size_t size = ((requested + BLOCK_GRANULARITY - 1)/BLOCK_GRANULARITY)*BLOCK_GRANULARITY;
+    void* pointer = nullptr;
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        auto found = freeBlocks.find(size);
+        if ((found != freeBlocks.end()) and !found->second.empty())
+        {
+            pointer = found->second.back();
+            found->second.pop_back();
+        }
+        else
+        {
+            if (stats.reservedBytes + (juce::int64)size > stats.limitBytes)
+            {
+                releaseFreeBlocks();
+            }
+            stats.reservedBytes += (juce::int64)size;
+            stats.peakReservedBytes = juce::jmax(stats.peakReservedBytes, stats.reservedBytes);
+        }
+        stats.inUseBytes += (juce::int64)size;
+    }
+
+    if (pointer == nullptr)
+    {
+        void* base = std::malloc(size + sizeof(BlockHeader) + BLOCK_ALIGNMENT);
+        if (base == nullptr)
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            stats.reservedBytes -= (juce::int64)size;
+            stats.inUseBytes -= (juce::int64)size;
+            return nullptr;
+        }
+        auto address = reinterpret_cast<juce::pointer_sized_uint>(base) + sizeof(BlockHeader);
+        address = (address + BLOCK_ALIGNMENT - 1) & ~(juce::pointer_sized_uint)(BLOCK_ALIGNMENT - 1);
+        pointer = reinterpret_cast<void*>(address);
+        getHeader(pointer)->base = base;
+        getHeader(pointer)->size = size;
+    }
+
+    BlockHeader* header = getHeader(pointer);
+    header->session = currentSession != nullptr ? currentSession : &poolUsage;
+    juce::int64 current = header->session->currentBytes += (juce::int64)size;
+    juce::int64 peak = header->session->peakBytes;
+    while ((current > peak) and !header->session->peakBytes.compare_exchange_weak(peak, current)) {}
+    return pointer;
+}
+
+void OrtSharedAllocator::release(void* pointer)
+{
+    if (pointer == nullptr)
+    {
+        return;
+    }
+    BlockHeader* header = getHeader(pointer);
+    header->session->currentBytes -= (juce::int64)header->size;
+
+    const std::lock_guard<std::mutex> lock(mutex);
+    stats.inUseBytes -= (juce::int64)header->size;
+    if (stats.reservedBytes > stats.limitBytes)
+    {
+        stats.reservedBytes -= (juce::int64)header->size;
+        stats.numOverLimit++;
+        std::free(header->base);
+        return;
+    }
+    freeBlocks[header->size].push_back(pointer);
+}
+
+void OrtSharedAllocator::releaseFreeBlocks()
+{
+    for (auto& sizeAndBlocks : freeBlocks)
+    {
+        for (void* pointer : sizeAndBlocks.second)
+        {
+            stats.reservedBytes -= (juce::int64)sizeAndBlocks.first;
+            std::free(getHeader(pointer)->base);
+        }
+    }
+    freeBlocks.clear();
+}
+
+OrtSharedAllocator::Stats OrtSharedAllocator::getStats() const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    Stats copy = stats;
+    copy.poolBytes = poolUsage.currentBytes;
+    copy.peakPoolBytes = poolUsage.peakBytes;
+    return copy;
+}
+
+//==============================================================================
+OrtEnvironment::Options OrtEnvironment::Options::fromSettings(const juce::PropertySet& settings, const WorkerPolicy& workerPolicy)
+{
+    Options options;
+    options.globalThreadPools = settings.getBoolValue("sharedThreadPool", true);
+    options.intraOpThreads = juce::jmax(0, settings.getIntValue("poolThreads", 0));
+    options.allowSpinning = settings.getBoolValue("poolSpinning", false);
+    options.sharedAllocator = settings.getBoolValue("sharedAllocator", true);
+    options.allocatorLimitBytes = (juce::int64)juce::jmax(1, settings.getIntValue("arenaLimitMB", (int)(options.allocatorLimitBytes >> 20))) << 20;
+    options.sharedWeights = settings.getBoolValue("sharedWeights", true);
+    options.autotune = settings.getBoolValue("autotune", true);
+    if (settings.getBoolValue("optimizedModelCache", true))
+    {
+        options.optimizedModelDirectory = OptimizedModelCache::getDefaultDirectory();
+    }
+
+    WorkerPolicy poolPolicy = workerPolicy;
+    if (settings.containsKey("poolCores") or settings.containsKey("poolExcludedCores"))
+    {
+        poolPolicy.cores = WorkerPolicy::parseCoreList(settings.getValue("poolCores"));
+        poolPolicy.excludedCores = WorkerPolicy::parseCoreList(settings.getValue("poolExcludedCores"));
+    }
+    options.threadPolicy = std::make_shared<const WorkerPolicy>(poolPolicy);
+    return options;
+}
+
+std::shared_ptr<OrtEnvironment> OrtEnvironment::getShared(const Options& options)
+{
+    static std::mutex mutex;
+    static std::weak_ptr<OrtEnvironment> shared;
+
+    const std::lock_guard<std::mutex> lock(mutex);
+    auto environment = shared.lock();
+    if (environment == nullptr)
+    {
+        environment.reset(new OrtEnvironment(options));
+        shared = environment;
+    }
+    return environment;
+}
+
+OrtEnvironment::OrtEnvironment(const Options& o)
+:options(o)
+{
+    if (options.globalThreadPools)
+    {
+        createWithGlobalThreadPools();
+    }
+    else
+    {
+        env = Ort::Env();
+    }
+    if (options.sharedAllocator)
+    {
+        allocator = std::make_unique<OrtSharedAllocator>(options.allocatorLimitBytes);
+        if (OrtStatus* status = Ort::GetApi().RegisterAllocator(env, allocator.get()))
+        {
+            // Sessions fall back to arenas of their own
+            RtLog::writeText(RtLog::Category::model, RtLog::Level::error, "Shared allocator not registered: {s}", Ort::GetApi().GetErrorMessage(status));
+            Ort::GetApi().ReleaseStatus(status);
+            allocator.reset();
+        }
+    }
+    if (options.sharedWeights)
+    {
+        OrtPrepackedWeightsContainer* container = nullptr;
+        Ort::ThrowOnError(Ort::GetApi().CreatePrepackedWeightsContainer(&container));
+        prepackedWeights = {container, Ort::GetApi().ReleasePrepackedWeightsContainer};
+    }
+}
+
+void OrtEnvironment::createWithGlobalThreadPools()
+{
+    const OrtApi& api = Ort::GetApi();
+    OrtThreadingOptions* threadingOptions = nullptr;
+    Ort::ThrowOnError(api.CreateThreadingOptions(&threadingOptions));
+    std::unique_ptr<OrtThreadingOptions, decltype(api.ReleaseThreadingOptions)> scopedOptions(threadingOptions, api.ReleaseThreadingOptions);
+
+    Ort::ThrowOnError(api.SetGlobalIntraOpNumThreads(threadingOptions, options.intraOpThreads));
+    // Sessions run their graph sequentially, so the inter-op pool would only sit idle
+    Ort::ThrowOnError(api.SetGlobalInterOpNumThreads(threadingOptions, 1));
+    Ort::ThrowOnError(api.SetGlobalSpinControl(threadingOptions, options.allowSpinning ? 1 : 0));
+    if (options.threadPolicy != nullptr)
+    {
+        if (options.threadPolicy->flushDenormals)
+        {
+            Ort::ThrowOnError(api.SetGlobalDenormalAsZero(threadingOptions));
+        }
+        poolThreads = std::make_unique<OrtPoolThreads>(options.threadPolicy);
+        poolThreads->install(threadingOptions);
+    }
+    env = Ort::Env(threadingOptions);
+    globalThreadPools = true;
+}
+
+OrtEnvironment::~OrtEnvironment()
+{
+    if (allocator != nullptr)
+    {
+        // A failure is ignored this late, but its status still has to be released
+        if (OrtStatus* status = Ort::GetApi().UnregisterAllocator(env, allocator->getMemoryInfo()))
+        {
+            Ort::GetApi().ReleaseStatus(status);
+        }
+    }
+    // Joins the global pool threads while poolThreads still exists
+    env = Ort::Env(nullptr);
+}
+
+OrtPoolThreads::Status OrtEnvironment::getPoolThreadStatus() const
+{
+    return poolThreads != nullptr ? poolThreads->getStatus() : OrtPoolThreads::Status();
+}
@@ -0,0 +1,179 @@
+//
+//  OrtEnvironment.h
+//  HARD
+//
+
+#ifndef OrtEnvironment_h
+#define OrtEnvironment_h
+
+#include <JuceHeader.h>
+#include <onnxruntime_cxx_api.h>
+#include "WorkerPolicy.h"
+#include <map>
+#include <mutex>
+
+struct OrtSessionUsage;
+
+// Creates ONNX Runtime's pool threads through its custom thread hooks, so each
+// one runs with a WorkerPolicy, and counts what the OS granted them. The pool
+// threads of a single session also charge their allocations to it.
+class OrtPoolThreads
+{
+public:
+    struct Status
+    {
+        int numThreads = 0;
+        int numNotApplied = 0;      // threads where the OS refused part of the policy
+        juce::String lastDescription;
+    };
+
+    // policy may be null; session is only given for a session's own pool
+    explicit OrtPoolThreads(std::shared_ptr<const WorkerPolicy> policy, OrtSessionUsage* session = nullptr);
+
+    // Per-session pools
+    void install(Ort::SessionOptions& sessionOptions);
+    // The environment's global pools
+    void install(OrtThreadingOptions* threadingOptions);
+    Status getStatus() const;
+
+private:
+    static OrtCustomThreadHandle create(void* options, OrtThreadWorkerFn workerFn, void* workerParam);
+    static void join(OrtCustomThreadHandle handle);
+
+    std::shared_ptr<const WorkerPolicy> policy;
+    OrtSessionUsage* const session;
+    juce::CriticalSection lock;
+    Status status;
+
+    JUCE_DECLARE_NON_COPYABLE(OrtPoolThreads)
+};
+
+// CPU allocator registered in the environment and used by every session in it
+// (session.use_env_allocators), instead of an arena per session sized for that
+// session's peak. ONNX Runtime 1.13's own arena reports no statistics, so this
+// is a small arena of its own: with memory-pattern planning and fixed shapes a
+// run asks for the same few block sizes every time, and freed blocks are kept
+// per size for the next run. Blocks are attributed to the session whose thread
+// allocates them, for telemetry: the thread calling Run, and the session's own
+// pool threads. The global pool's threads work for every session at once, so
+// what they allocate is counted as the pool's.
+//
+// It is registered as an OrtDeviceAllocator, the only type ONNX Runtime accepts
+// from outside, even though it caches blocks like an arena.
+struct OrtSessionUsage
+{
+    std::atomic<juce::int64> currentBytes{0};
+    std::atomic<juce::int64> peakBytes{0};
+};
+
+class OrtSharedAllocator: public OrtAllocator
+{
+public:
+    using SessionUsage = OrtSessionUsage;
+
+    struct Stats
+    {
+        juce::int64 inUseBytes = 0;
+        juce::int64 reservedBytes = 0;          // in use plus free blocks kept for reuse
+        juce::int64 peakReservedBytes = 0;
+        juce::int64 limitBytes = 0;
+        juce::int64 numOverLimit = 0;           // allocations that were not cached because of the limit
+        juce::int64 poolBytes = 0;              // in use by allocations of the global pool's threads
+        juce::int64 peakPoolBytes = 0;
+    };
+
+    // Allocations on the calling thread count towards usage while this is in scope
+    class ScopedSession
+    {
+    public:
+        explicit ScopedSession(SessionUsage& usage);
+        ~ScopedSession();
+    private:
+        SessionUsage* previous;
+    };
+
+    // The arena never holds more than limitBytes: beyond it, blocks are freed
+    // instead of kept, and allocations still succeed rather than fail a run
+    explicit OrtSharedAllocator(juce::int64 limitBytes);
+    ~OrtSharedAllocator();
+
+    Stats getStats() const;
+    const OrtMemoryInfo* getMemoryInfo() const {return memoryInfo;}
+
+private:
+    void* allocate(size_t size);
+    void release(void* pointer);
+    void releaseFreeBlocks();
+
+    Ort::MemoryInfo memoryInfo{nullptr};
+    mutable std::mutex mutex;
+    std::map<size_t, std::vector<void*>> freeBlocks;
+    Stats stats;
+    // Blocks allocated outside any session's threads
+    SessionUsage poolUsage;
+
+    JUCE_DECLARE_NON_COPYABLE(OrtSharedAllocator)
+};
+
+// The process's Ort::Env. ONNX Runtime keeps a single environment per process,
+// so every MorpherModel gets it from here. With global thread pools, every
+// session in the process (all plugin instances) shares one intra-op pool
+// instead of starting its own, which would oversubscribe the cores.
+class OrtEnvironment
+{
+public:
+    struct Options
+    {
+        bool globalThreadPools = false;
+        int intraOpThreads = 0;         // global pool size, 0 lets ONNX Runtime decide (physical cores)
+        bool allowSpinning = false;     // idle pool threads spin instead of sleeping
+        std::shared_ptr<const WorkerPolicy> threadPolicy;
+        bool sharedAllocator = false;
+        juce::int64 allocatorLimitBytes = (juce::int64)512 << 20;
+        // Where sessions keep their optimized models (see OptimizedModelCache), none if empty
+        juce::File optimizedModelDirectory;
+        // ORT-format model files are memory-mapped and their weights used in place,
+        // so all sessions and processes share those pages; sessions in this
+        // environment also share their prepacked weights
+        bool sharedWeights = false;
+        // Engines use the configuration OrtAutotuner stored for their model, and
+        // idle plugin instances tune models that have none
+        bool autotune = false;
+
+        // Keys sharedThreadPool (default on), poolThreads, poolSpinning, and poolCores /
+        // poolExcludedCores, which override the worker policy's cores for the pool;
+        // sharedAllocator (default on), arenaLimitMB, optimizedModelCache (default on),
+        // sharedWeights (default on) and autotune (default on)
+        static Options fromSettings(const juce::PropertySet& settings, const WorkerPolicy& workerPolicy);
+    };
+
+    // The first caller's options decide, until the last user has released it
+    static std::shared_ptr<OrtEnvironment> getShared(const Options& options);
+    ~OrtEnvironment();
+
+    Ort::Env& getEnv() {return env;}
+    bool hasGlobalThreadPools() const {return globalThreadPools;}
+    const Options& getOptions() const {return options;}
+    OrtPoolThreads::Status getPoolThreadStatus() const;
+    // nullptr unless Options::sharedAllocator and ONNX Runtime accepted it;
+    // otherwise sessions keep their own arenas
+    OrtSharedAllocator* getSharedAllocator() const {return allocator.get();}
+    // nullptr unless Options::sharedWeights
+    OrtPrepackedWeightsContainer* getPrepackedWeights() const {return prepackedWeights.get();}
+
+private:
+    explicit OrtEnvironment(const Options& options);
+    void createWithGlobalThreadPools();
+
+    const Options options;
+    bool globalThreadPools = false;
+    // Both outlive env, which joins the pool threads on destruction
+    std::unique_ptr<OrtPoolThreads> poolThreads;
+    std::unique_ptr<OrtSharedAllocator> allocator;
+    std::unique_ptr<OrtPrepackedWeightsContainer, void (*)(OrtPrepackedWeightsContainer*)> prepackedWeights{nullptr, nullptr};
+    Ort::Env env{nullptr};
+
+    JUCE_DECLARE_NON_COPYABLE(OrtEnvironment)
+};
+
+#endif /* OrtEnvironment_h */
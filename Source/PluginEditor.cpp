@@ -45,6 +45,10 @@ HARDAudioProcessorEditor::HARDAudioProcessorEditor (HARDAudioProcessor& p)
     addAndMakeVisible(&sourceGainSlider);
     addAndMakeVisible(&sidechainGainSlider);
     addAndMakeVisible(&syncButton);
+    addAndMakeVisible(&referenceButton);
+    addAndMakeVisible(&instantButton);
+    addAndMakeVisible(&telemetryButton);
+    addAndMakeVisible(&telemetryLabel);
     
     syncButton.setClickingTogglesState(true);
     
@@ -58,10 +62,29 @@ HARDAudioProcessorEditor::HARDAudioProcessorEditor (HARDAudioProcessor& p)
     valueTreeState.addParameterListener("rhythm", this);
     valueTreeState.addParameterListener("sync", this);
     
+    referenceButton.onClick = [this]{referenceButtonClicked();};
+    
+    // Not a host parameter, since switching it restarts the output
+    instantButton.setButtonText("instant");
+    instantButton.setColour(juce::TextButton::buttonOnColourId, juce::Colours::dodgerblue);
+    instantButton.setClickingTogglesState(true);
+    instantButton.setToggleState(audioProcessor.getInstantFaders(), juce::dontSendNotification);
+    instantButton.onClick = [this]{audioProcessor.setInstantFaders(instantButton.getToggleState());};
+    audioProcessor.getReferenceClip().addChangeListener(this);
+    updateReferenceButton();
+    
+    telemetryButton.setButtonText("stats");
+    telemetryButton.onClick = [this]{telemetryButtonClicked();};
+    telemetryLabel.setFont(juce::Font(12.0f));
+    telemetryLabel.setColour(juce::Label::textColourId, juce::Colours::grey);
+    telemetryLabel.setJustificationType(juce::Justification::centred);
+    timerCallback();
+    startTimer(TELEMETRY_INTERVAL_MS);
 }
 
 HARDAudioProcessorEditor::~HARDAudioProcessorEditor()
 {
+    audioProcessor.getReferenceClip().removeChangeListener(this);
 }
 
 //==============================================================================
@@ -90,6 +113,10 @@ void HARDAudioProcessorEditor::resized()
     sourceGainSlider.setBounds(20, 120, 80, 200);
     sidechainGainSlider.setBounds(380, 120, 80, 200);
     syncButton.setBounds(220, 200, 40, 20);
+    referenceButton.setBounds(120, 330, 240, 22);
+    instantButton.setBounds(20, 330, 80, 22);
+    telemetryButton.setBounds(380, 330, 80, 22);
+    telemetryLabel.setBounds(20, 52, 440, 16);
 }
 
 void HARDAudioProcessorEditor::parameterChanged(const juce::String &parameterID, float newValue)
@@ -115,3 +142,100 @@ void HARDAudioProcessorEditor::parameterChanged(const juce::String &parameterID,
     }
 }
 
+
+void HARDAudioProcessorEditor::changeListenerCallback(juce::ChangeBroadcaster* source)
+{
+    updateReferenceButton();
+}
+
+void HARDAudioProcessorEditor::referenceButtonClicked()
+{
+    auto& referenceClip = audioProcessor.getReferenceClip();
+    if (referenceClip.getState() != ReferenceClip::State::empty)
+    {
+        referenceClip.unload();
+        return;
+    }
+    referenceChooser = std::make_unique<juce::FileChooser>("Select a reference clip", juce::File(), "*.wav;*.aif;*.aiff;*.flac;*.mp3");
+    referenceChooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                                  [this](const juce::FileChooser& chooser)
+    {
+        if (chooser.getResult().existsAsFile())
+        {
+            audioProcessor.getReferenceClip().load(chooser.getResult());
+        }
+    });
+}
+
+void HARDAudioProcessorEditor::updateReferenceButton()
+{
+    auto& referenceClip = audioProcessor.getReferenceClip();
+    juce::String name = referenceClip.getReferenceFile().getFileName();
+    switch (referenceClip.getState())
+    {
+        case ReferenceClip::State::empty:
+            referenceButton.setButtonText("Use reference clip as sidechain...");
+            break;
+        case ReferenceClip::State::preparing:
+            referenceButton.setButtonText("Preparing " + name + "...");
+            break;
+        case ReferenceClip::State::ready:
+            referenceButton.setButtonText(name + " (click to remove)");
+            break;
+        case ReferenceClip::State::failed:
+            referenceButton.setButtonText("Could not read " + name);
+            break;
+    }
+}
+
+void HARDAudioProcessorEditor::timerCallback()
+{
+    if (audioProcessor.isHibernating())
+    {
+        telemetryLabel.setText("idle", juce::dontSendNotification);
+        return;
+    }
+    auto telemetry = audioProcessor.getTelemetry();
+    juce::String text;
+    if (telemetry.run.count > 0)
+    {
+        text << "inference p50 " << juce::String(telemetry.run.p50Ms, 1) << " / p99 " << juce::String(telemetry.run.p99Ms, 1) << " ms";
+    }
+    if (telemetry.slack.count > 0)
+    {
+        text << (text.isEmpty() ? "" : ", ") << "slack p1 " << juce::String(telemetry.slack.p1Ms, 0) << " ms";
+    }
+    text << (text.isEmpty() ? "" : ", ") << telemetry.underruns << " underruns";
+    auto& monitor = audioProcessor.getCallbackMonitor();
+    if (monitor.isEnabled())
+    {
+        auto callback = monitor.getSnapshot();
+        text << ", callback p99 " << juce::String(callback.duration.p99Ms, 2) << " of " << juce::String(callback.deadlineMs, 1)
+             << " ms, " << callback.numOverruns << " over budget";
+    }
+    telemetryLabel.setText(text, juce::dontSendNotification);
+}
+
+void HARDAudioProcessorEditor::telemetryButtonClicked()
+{
+    auto& monitor = audioProcessor.getCallbackMonitor();
+    juce::PopupMenu menu;
+    menu.addItem("Save telemetry...", [this]{saveTelemetry();});
+    menu.addItem("Monitor audio callback", true, monitor.isEnabled(), [&monitor]{monitor.setEnabled(!monitor.isEnabled());});
+    menu.addItem("Reset", [this]{audioProcessor.resetTelemetry();});
+    menu.showMenuAsync(juce::PopupMenu::Options().withTargetComponent(&telemetryButton));
+}
+
+void HARDAudioProcessorEditor::saveTelemetry()
+{
+    telemetryChooser = std::make_unique<juce::FileChooser>("Save inference telemetry", juce::File::getSpecialLocation(juce::File::userDesktopDirectory).getChildFile("HARD telemetry.json"), "*.json");
+    telemetryChooser->launchAsync(juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles
+                                  | juce::FileBrowserComponent::warnAboutOverwriting,
+                                  [this](const juce::FileChooser& chooser)
+    {
+        if (chooser.getResult() != juce::File())
+        {
+            audioProcessor.dumpTelemetry(chooser.getResult());
+        }
+    });
+}
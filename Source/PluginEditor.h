@@ -69,7 +69,7 @@ public:
 };
 
 
-class HARDAudioProcessorEditor  : public juce::AudioProcessorEditor, public juce::AudioProcessorValueTreeState::Listener
+class HARDAudioProcessorEditor  : public juce::AudioProcessorEditor, public juce::AudioProcessorValueTreeState::Listener, public juce::ChangeListener, private juce::Timer
 {
 public:
     HARDAudioProcessorEditor (HARDAudioProcessor&);
@@ -86,8 +86,13 @@ public:
     }
     
     void parameterChanged(const juce::String &parameterID, float newValue) override;
+    // Reference clip state
+    void changeListenerCallback(juce::ChangeBroadcaster* source) override;
 
 private:
+    // Refreshes the telemetry line
+    void timerCallback() override;
+
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
     HARDAudioProcessor& audioProcessor;
@@ -99,6 +104,18 @@ private:
     juce::Slider sourceGainSlider;
     juce::Slider sidechainGainSlider;
     juce::TextButton syncButton;
+    juce::TextButton referenceButton;
+    juce::TextButton instantButton;
+    juce::TextButton telemetryButton;
+    juce::Label telemetryLabel;
+    std::unique_ptr<juce::FileChooser> referenceChooser;
+    std::unique_ptr<juce::FileChooser> telemetryChooser;
+    static const int TELEMETRY_INTERVAL_MS = 500;
+    
+    void referenceButtonClicked();
+    void telemetryButtonClicked();
+    void saveTelemetry();
+    void updateReferenceButton();
     
     std::unique_ptr<SliderAttachment> harmonySliderAttachment;
     std::unique_ptr<SliderAttachment> rhythmSliderAttachment;
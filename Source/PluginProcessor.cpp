@@ -8,6 +8,9 @@
 
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#if JucePlugin_Enable_ARA
+#include "ARADocumentController.h"
+#endif
 
 //==============================================================================
 HARDAudioProcessor::HARDAudioProcessor()
@@ -38,24 +41,89 @@ HARDAudioProcessor::HARDAudioProcessor()
                                                 0.0f, 1.0f, 1.0f),
     std::make_unique<juce::AudioParameterBool>(juce::ParameterID("sync",1),
                                                "Link Sliders",
+                                               false),
+    std::make_unique<juce::AudioParameterBool>(juce::ParameterID("timelineAlign",1),
+                                               "Align to Timeline",
                                                false)
 })
 {
     fifoBufferIn1.clearBuffer();
     fifoBufferIn2.clearBuffer();
     fifoBufferOutDNN.clearBuffer();
-    setLatencySamples(OUTPUT_DELAY_SAMPLES-OUTPUT_DELAY_BIAS_SAMPLES);
-    pInferenceThread = new ONNXMorpherInferenceThread();
+    reportLatency();
+    // Scheduling is per machine rather than per project, so it comes from HARD.settings.
+    // All instances in the process share one ONNX Runtime thread pool by default.
+    auto settings = WorkerPolicy::openUserSettings();
+    rtLog->configure(RtLog::Options::fromSettings(*settings));
+    workerPolicy = WorkerPolicy::fromSettings(*settings);
+    modelSource = ModelSource::getDefault();
+    auto environmentOptions = OrtEnvironment::Options::fromSettings(*settings, workerPolicy);
+    if (environmentOptions.autotune and !settings->containsKey("poolThreads"))
+    {
+        // The shared pool is sized for the default model
+        environmentOptions.intraOpThreads = juce::jmax(0, OrtAutotuner::findStored(modelSource).intraOpThreads);
+    }
+    environment = OrtEnvironment::getShared(environmentOptions);
+    windowCache = std::make_shared<WindowCache>(WINDOW_CACHE_BYTES);
+    // Windows rendered in earlier sessions, by any instance or the offline renderer. Off by
+    // default: live playback rarely repeats a window, and every computed one would be written.
+    const bool diskWindowCache = settings->getBoolValue("diskWindowCache", false);
+    if (diskWindowCache)
+    {
+        windowCache->setBackingStore(std::make_shared<DiskWindowCache>(DiskWindowCache::Options(), modelSource.getContentHash()));
+    }
+    MorpherModel::Options loaderOptions;
+    loaderOptions.threadPolicy = std::make_shared<const WorkerPolicy>(workerPolicy);
+    loaderOptions.environment = environment;
+    loaderOptions.autotuned = environment->getOptions().autotune;
+    modelLoader = std::make_unique<ModelLoader>(loaderOptions, WINDOW_CACHE_BYTES, diskWindowCache);
+    modelLoader->addChangeListener(this);
+    tierGovernor = TierGovernor(TierGovernor::Options::fromSettings(*settings));
+    // Off unless asked for; the editor's stats menu toggles it at run time
+    callbackMonitor.setEnabled(settings->getBoolValue("callbackMonitor", false));
+    callbackMonitor.setBudget(settings->getDoubleValue("callbackBudget", 0.8));
+    // The default model is the full tier
+    auto tiers = QualityTier::findTiers(modelSource, *settings);
+    int fullTier = 0;
+    for (int t = 0; t < tiers.size(); t++)
+    {
+        fullTier = (tiers[t].source.getDescription() == modelSource.getDescription()) ? t : fullTier;
+    }
+    tierGovernor.setTiers(tiers, fullTier);
+    if (tierGovernor.isActive())
+    {
+        startTimer(GOVERNOR_INTERVAL_MS);
+    }
+    
+    safeLatency = settings->getBoolValue("safeLatency", safeLatency);
+    hibernateWhenInactive = settings->getBoolValue("hibernateWhenInactive", hibernateWhenInactive);
+    hibernateAfterSeconds = juce::jmax(0.0, settings->getDoubleValue("hibernateAfterSeconds", hibernateAfterSeconds));
+    warmModels->setMaxModels(settings->getIntValue("warmModels", 1));
+    // Instances start hibernating and load their engine in prepareToPlay, so
+    // disabled tracks in a large template never load a session
+    hibernating = true;
+    fifoBufferIn1.releaseStorage();
+    fifoBufferIn2.releaseStorage();
+    fifoBufferOutDNN.releaseStorage();
     
     harmonyParameter = parameters.getRawParameterValue("harmony");
     rhythmParameter = parameters.getRawParameterValue("rhythm");
     sourceGainParameter = parameters.getRawParameterValue("sourceGain");
     sidechainGainParameter = parameters.getRawParameterValue("sidechainGain");
     syncParameter = parameters.getRawParameterValue("sync");
+    timelineAlignParameter = parameters.getRawParameterValue("timelineAlign");
 }
 
 HARDAudioProcessor::~HARDAudioProcessor()
 {
+    stopTimer();
+    autotuneThread->setInstanceAwake(this, false);
+    // Waits for a session that is being created
+    modelLoader->removeChangeListener(this);
+    modelLoader.reset();
+    cancelPendingUpdate();
+    // The worker writes into the output FIFOs, so stop it before any member goes away
+    inferenceThread.reset();
 }
 
 //==============================================================================
@@ -125,18 +193,42 @@ void HARDAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
-    fifoBufferIn1.clearBuffer();
-    fifoBufferIn2.clearBuffer();
-    fifoBufferOutDNN.clearBuffer();
     //fifoBufferIn1.fillZeros(DNN_INPUT_CACHE_SAMPLES);
     //fifoBufferIn2.fillZeros(DNN_INPUT_CACHE_SAMPLES);
-    fifoBufferOutDNN.fillZeros(OUTPUT_DELAY_SAMPLES);
+    // Re-primes the FIFOs
+    wake();
+    {
+        const juce::ScopedLock hl(hibernationLock);
+        allocateFaderGrid();
+        const int delay = chooseOutputDelay(sampleRate, samplesPerBlock);
+        if (delay != outputDelaySamples)
+        {
+            // Nothing is playing yet, so the FIFOs start over at the new delay
+            outputDelaySamples = delay;
+            requestedOutputDelaySamples = delay;
+            reprime(-1);
+        }
+    }
+    reportLatency();
+    
+   #if JucePlugin_Enable_ARA
+    prepareToPlayForARA(sampleRate, samplesPerBlock, getMainBusNumOutputChannels(), getProcessingPrecision());
+    // ARA regions are rendered ahead of time, so there is no latency to report
+    reportLatency();
+   #endif
 }
 
 void HARDAudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+   #if JucePlugin_Enable_ARA
+    releaseResourcesForARA();
+   #endif
+    if (hibernateWhenInactive)
+    {
+        hibernate();
+    }
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -170,11 +262,24 @@ void HARDAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::M
     juce::ScopedNoDenormals noDenormals;
     
     auto numSamples = buffer.getNumSamples();
+    CallbackMonitor::ScopedCallback callback(callbackMonitor, numSamples, getSampleRate());
     
     auto mainInputOutput = getBusBuffer(buffer, true, 0);
     auto sideChainInput = getBusBuffer(buffer, true, 1);
     
     bool isSyncMode = *syncParameter > 0.5f;
+    
+   #if JucePlugin_Enable_ARA
+    if (isBoundToARA())
+    {
+        if (auto* playbackRenderer = getPlaybackRenderer<HARDPlaybackRenderer>())
+        {
+            playbackRenderer->setParameters(*harmonyParameter, *rhythmParameter, *sourceGainParameter, *sidechainGainParameter);
+        }
+        processBlockForARA(buffer, isNonRealtime() ? juce::AudioProcessor::Realtime::no : juce::AudioProcessor::Realtime::yes, getPlayHead());
+        return;
+    }
+   #endif
 
     // In case we have more outputs than inputs, this code clears any output
     // channels that didn't contain input data, (because these aren't
@@ -191,12 +296,53 @@ void HARDAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::M
     // the samples and the outer loop is handling the channels.
     // Alternatively, you can process the samples with the channels
     // interleaved by keeping the same state.
+    juce::Optional<juce::AudioPlayHead::PositionInfo> position;
+    if (auto* playHead = getPlayHead())
     {
-        const juce::ScopedLock lock (critical);
+        position = playHead->getPosition();
+    }
+    bool isPlaying = position.hasValue() and position->getIsPlaying() and position->getTimeInSamples().hasValue();
+    
+    bool isIdle = (mainInputOutput.getMagnitude(0, numSamples) < SILENCE_LEVEL)
+              and (sideChainInput.getMagnitude(0, numSamples) < SILENCE_LEVEL)
+              and !(isPlaying and (referenceClip.getState() == ReferenceClip::State::ready));
+    // A rest in a playing song is not a reason to hibernate
+    bool isTransportRunning = position.hasValue() and position->getIsPlaying();
+    trackActivity(isIdle, !isTransportRunning, numSamples);
+    if (hibernating)
+    {
+        // Nothing was playing, so nothing is cut off; output resumes one latency after waking
+        mainInputOutput.clear();
+        countBypassed(numSamples);
+        return;
+    }
+    
+    updateInstantFaders();
+    handleTransport(position, numSamples);
+    callback.mark(CallbackMonitor::other);
+    
+    {
+        const CallbackMonitor::ScopedTimedLock lock(critical, callbackMonitor);
         fifoBufferIn1.pushData(mainInputOutput.getWritePointer(0), mainInputOutput.getWritePointer(1),  numSamples);
-        fifoBufferIn2.pushData(sideChainInput.getWritePointer(0), sideChainInput.getWritePointer(1),  numSamples);
+        if (referenceClip.getState() == ReferenceClip::State::ready)
+        {
+            // The reference clip follows the song position and is silent while stopped
+            if (isPlaying)
+            {
+                referenceClip.pushToFifo(fifoBufferIn2, *position->getTimeInSamples(), numSamples);
+            }
+            else
+            {
+                fifoBufferIn2.fillZeros(numSamples);
+            }
+        }
+        else
+        {
+            fifoBufferIn2.pushData(sideChainInput.getWritePointer(0), sideChainInput.getWritePointer(1),  numSamples);
+        }
         numNewInputSamples += numSamples;
     }
+    callback.mark(CallbackMonitor::input);
     
     if (isSyncMode)
     {
@@ -211,42 +357,707 @@ void HARDAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::M
     }
     
     
-    if ((numNewInputSamples >= DNN_INPUT_SAMPLES) and (fifoBufferIn1.getBufferSize() >= (DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES)) and (!pInferenceThread->threadIsInferring()))
+    if (!instantFadersActive)
+    {
+        handleControlChanges(numSamples);
+    }
+    callback.mark(CallbackMonitor::other);
+    
+    if ((numNewInputSamples >= DNN_INPUT_SAMPLES) and (fifoBufferIn1.getBufferSize() >= (DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES)) and (!inferenceThread->threadIsInferring()))
     {
-        const juce::ScopedLock lock (critical);
+        const CallbackMonitor::ScopedTimedLock lock(critical, callbackMonitor);
         jassert(fifoBufferIn1.getBufferSize() >= (DNN_INPUT_SAMPLES + DNN_INPUT_CACHE_SAMPLES));
         fifoBufferIn1.readData(dnnInputData1.data(), DNN_INPUT_SAMPLES + DNN_INPUT_CACHE_SAMPLES, DNN_INPUT_SAMPLES);
         fifoBufferIn2.readData(dnnInputData2.data(), DNN_INPUT_SAMPLES + DNN_INPUT_CACHE_SAMPLES, DNN_INPUT_SAMPLES);
         
         // Trigger a DNN inference
-        pInferenceThread->requestInference(dnnInputData1.data(), dnnInputData2.data(), *rhythmParameter, *harmonyParameter, *sourceGainParameter, *sidechainGainParameter, &fifoBufferOutDNN);
+        if (instantFadersActive)
+        {
+            inferenceThread->setDeadline(getWindowDeadlineMs());
+            inferenceThread->requestGridInference(dnnInputData1.data(), dnnInputData2.data(), *sourceGainParameter, *sidechainGainParameter, gridOutputBuffers.get());
+        }
+        else
+        {
+            requestWindow();
+        }
         
         numNewInputSamples -= DNN_INPUT_SAMPLES;
-        printf("Inference requested. \n");
+        RtLog::write(RtLog::Category::audio, RtLog::Level::debug, "Inference requested at sample {}.", processedSamples);
     }
+    callback.mark(CallbackMonitor::request);
     
     
     
-    auto dnnOutBufferSize = fifoBufferOutDNN.getBufferSize();
-    while((pInferenceThread->threadIsInferring()) and (dnnOutBufferSize<numSamples))
+    auto dnnOutBufferSize = instantFadersActive ? gridOutputBuffers[0].getBufferSize() : fifoBufferOutDNN.getBufferSize();
+    if ((dnnOutBufferSize < numSamples) and !reprimePending)
+    {
+        telemetry->countUnderrun();
+    }
+    while((inferenceThread->threadIsInferring()) and (dnnOutBufferSize<numSamples))
     {
         // If output buffer is empty but DNN inference is not done,
         // pause the process.
         // This loop should not be triggered.
     }
+    callback.mark(CallbackMonitor::spin);
     
+    measureControlResponse();
+    if (reprimePending)
     {
-        const juce::ScopedLock lock (critical);
-        fifoBufferOutDNN.readData(outBufferL.data(), outBufferR.data(), numSamples, numSamples);
+        mainInputOutput.clear();
+    }
+    else
+    {
+        const CallbackMonitor::ScopedTimedLock lock(critical, callbackMonitor);
+        if (instantFadersActive)
+        {
+            readGridOutput(numSamples);
+        }
+        else
+        {
+            fifoBufferOutDNN.readData(outBufferL.data(), outBufferR.data(), numSamples, numSamples);
+        }
         
         mainInputOutput.copyFrom(0, 0, outBufferL.data(), numSamples);
         mainInputOutput.copyFrom(1, 0, outBufferR.data(), numSamples);
         
     }
+    callback.mark(CallbackMonitor::output);
     //printf("Buffer size out: %d in: %d New: %d\n", fifoBufferOutDNN.getBufferSize(), fifoBufferIn1.getBufferSize(), numNewInputSamples);
     
     preHarmonyParam = *harmonyParameter;
     preRhythmParam = *rhythmParameter;
+    processedSamples += numSamples;
+}
+
+void HARDAudioProcessor::processBlockBypassed (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    trackActivity(true, true, buffer.getNumSamples());
+    countBypassed(buffer.getNumSamples());
+    juce::AudioProcessor::processBlockBypassed(buffer, midiMessages);
+}
+
+void HARDAudioProcessor::countBypassed(int numSamples)
+{
+    bypassedSamples += numSamples;
+    if (bypassedSamples >= DNN_INPUT_SAMPLES)
+    {
+        telemetry->countBypassed(bypassedSamples/DNN_INPUT_SAMPLES);
+        bypassedSamples %= DNN_INPUT_SAMPLES;
+    }
+}
+
+double HARDAudioProcessor::getWindowDeadlineMs()
+{
+    // The output runs short once less than a block is left after the overlap
+    // the next window crossfades into
+    FifoBuffer& fifo = instantFadersActive ? gridOutputBuffers[0] : fifoBufferOutDNN;
+    int samplesLeft = fifo.getBufferSize() - (int)ONNXMorpherInferenceThread::OVERLAP_SAMPLES - getBlockSize();
+    return samplesLeft*1000.0/getSampleRate();
+}
+
+bool HARDAudioProcessor::dumpTelemetry(const juce::File& file)
+{
+    auto* object = new juce::DynamicObject();
+    object->setProperty("inference", telemetry->getSnapshot().toVar());
+    object->setProperty("callbackMonitorEnabled", callbackMonitor.isEnabled());
+    object->setProperty("callback", callbackMonitor.getSnapshot().toVar());
+    juce::Array<juce::var> overruns;
+    for (const auto& overrun : callbackMonitor.getOverrunLog())
+    {
+        overruns.add(overrun.toString());
+    }
+    object->setProperty("overruns", overruns);
+    return file.replaceWithText(juce::JSON::toString(juce::var(object)));
+}
+
+void HARDAudioProcessor::trackActivity(bool isIdle, bool mayHibernate, int numSamples)
+{
+    if (!isIdle)
+    {
+        idleSamples = 0;
+        if (hibernating and !wakeRequested.exchange(true))
+        {
+            triggerAsyncUpdate();
+        }
+        return;
+    }
+    if (!mayHibernate)
+    {
+        idleSamples = 0;
+        return;
+    }
+    juce::int64 idle = idleSamples += numSamples;
+    if (!hibernating and (hibernateAfterSeconds > 0.0) and (idle >= (juce::int64)(hibernateAfterSeconds*getSampleRate()))
+        and !hibernationRequested.exchange(true))
+    {
+        triggerAsyncUpdate();
+    }
+}
+
+void HARDAudioProcessor::handleAsyncUpdate()
+{
+    if (faderGridRequested.exchange(false))
+    {
+        const juce::ScopedLock hl(hibernationLock);
+        allocateFaderGrid();
+    }
+    if (wakeRequested)
+    {
+        wakeInBackground();
+    }
+    else if (hibernationRequested and (idleSamples > 0))
+    {
+        hibernate();
+    }
+    hibernationRequested = false;
+}
+
+void HARDAudioProcessor::hibernate()
+{
+    const juce::ScopedLock hl(hibernationLock);
+    if (hibernating)
+    {
+        return;
+    }
+    {
+        // processBlock holds this lock and checks hibernating before touching the engine or FIFOs
+        const juce::ScopedLock sl(getCallbackLock());
+        hibernating = true;
+    }
+    inferenceThread->shutdown();
+    autotuneThread->setInstanceAwake(this, false);
+    if (environment->getOptions().autotune)
+    {
+        // Once every instance hibernates, the machine has time to spare
+        autotuneThread->startIfNeeded(modelSource);
+    }
+    // The session stays loaded for the next instance that wakes
+    warmModels->put(modelSource, inferenceThread->getModel());
+    inferenceThread.reset();
+    
+    const juce::ScopedLock sl(critical);
+    fifoBufferIn1.releaseStorage();
+    fifoBufferIn2.releaseStorage();
+    fifoBufferOutDNN.releaseStorage();
+    faderGridReady = false;
+    gridOutputBuffers.reset();
+    instantFadersActive = false;
+    RtLog::write(RtLog::Category::scheduling, RtLog::Level::info, "Hibernating.");
+}
+
+void HARDAudioProcessor::wakeInBackground()
+{
+    const juce::ScopedLock hl(hibernationLock);
+    if (!hibernating)
+    {
+        // prepareToPlay woke it meanwhile; only it reprimes an awake instance,
+        // as the audio thread is stopped then
+        wakeRequested = false;
+        return;
+    }
+    if (auto warmModel = warmModels->take(modelSource))
+    {
+        wake(std::move(warmModel));
+        return;
+    }
+    if (!wakeLoadPending)
+    {
+        // wakeRequested stays set, so input meanwhile does not ask again
+        autotuneThread->setInstanceAwake(this, true);
+        wakeLoadPending = true;
+        modelLoader->load(modelSource);
+        RtLog::writeText(RtLog::Category::scheduling, RtLog::Level::info, "Waking: loading {s} in the background.", modelSource.getDescription());
+    }
+}
+
+void HARDAudioProcessor::wake(std::shared_ptr<MorpherModel> loadedModel)
+{
+    const juce::ScopedLock hl(hibernationLock);
+    wakeRequested = false;
+    idleSamples = 0;
+    if (!hibernating)
+    {
+        reprime(-1);
+        expectedTimelineSample = -1;
+        reprimePending = false;
+        return;
+    }
+    
+    autotuneThread->setInstanceAwake(this, true);
+    const double start = juce::Time::getMillisecondCounterHiRes();
+    auto warmModel = loadedModel != nullptr ? std::move(loadedModel) : warmModels->take(modelSource);
+    const bool wasWarm = warmModel != nullptr;
+    if (wasWarm)
+    {
+        inferenceThread = std::make_unique<ONNXMorpherInferenceThread>(std::move(warmModel), true, workerPolicy);
+    }
+    else
+    {
+        // Usually the optimized, mapped copy from the model cache
+        inferenceThread = std::make_unique<ONNXMorpherInferenceThread>(workerPolicy, environment, modelSource);
+    }
+    inferenceThread->setWindowCache(windowCache);
+    inferenceThread->setTelemetry(telemetry);
+    {
+        const juce::ScopedLock sl(critical);
+        fifoBufferIn1.restoreStorage();
+        fifoBufferIn2.restoreStorage();
+        fifoBufferOutDNN.restoreStorage();
+    }
+    reprime(-1);
+    expectedTimelineSample = -1;
+    reprimePending = false;
+    {
+        const juce::ScopedLock sl(getCallbackLock());
+        hibernating = false;
+    }
+    // Only allocates once awake; the audio thread switches over when it is ready
+    allocateFaderGrid();
+    RtLog::write(RtLog::Category::scheduling, RtLog::Level::info, wasWarm ? "Woke in {} ms with a warm model." : "Woke in {} ms.", juce::Time::getMillisecondCounterHiRes() - start);
+}
+
+void HARDAudioProcessor::setEngineProfile(const EngineProfile& profile)
+{
+    const juce::ScopedLock hl(hibernationLock);
+    if (profile.outputDelaySamples > 0)
+    {
+        requestedOutputDelaySamples = juce::jlimit(MIN_OUTPUT_DELAY_SAMPLES, MAX_OUTPUT_DELAY_SAMPLES, profile.outputDelaySamples);
+    }
+    if (profile.source.getDescription() == modelSource.getDescription())
+    {
+        // Only the delay changes, or back to the current model
+        if (!wakeLoadPending)
+        {
+            modelLoader->cancel();
+        }
+        applyOutputDelay(requestedOutputDelaySamples);
+        return;
+    }
+    modelLoader->load(profile.source);
+}
+
+bool HARDAudioProcessor::isEngineSwapPending() const
+{
+    const juce::ScopedLock hl(hibernationLock);
+    return modelLoader->isLoading() or ((inferenceThread != nullptr) and inferenceThread->isSwapPending())
+        or ((inferenceThread != nullptr) and (inferenceThread->getPendingDelayShift() != 0));
+}
+
+void HARDAudioProcessor::changeListenerCallback(juce::ChangeBroadcaster*)
+{
+    ModelLoader::Result loaded;
+    if (!modelLoader->takeResult(loaded))
+    {
+        return;
+    }
+    const juce::ScopedLock hl(hibernationLock);
+    const bool wakesWithIt = std::exchange(wakeLoadPending, false) and hibernating;
+    if (loaded.model == nullptr)
+    {
+        // A failed wake is retried by the next prepareToPlay
+        if (wakesWithIt)
+        {
+            autotuneThread->setInstanceAwake(this, false);
+        }
+        // The governor and the delay go back to the model that keeps running
+        for (int t = 0; t < tierGovernor.getTiers().size(); t++)
+        {
+            if (tierGovernor.getTiers()[t].source.getDescription() == modelSource.getDescription())
+            {
+                tierGovernor.selectTier(t);
+            }
+        }
+        requestedOutputDelaySamples = outputDelaySamples;
+        RtLog::writeText(RtLog::Category::model, RtLog::Level::error, "Keeping {s}.", modelSource.getDescription() + ": " + loaded.error);
+        return;
+    }
+    // The load was timed while the other instances kept playing, so it only stands in
+    // for a tier with no cost yet, and only for this session; HARDRender tiers stores
+    // uncontended costs
+    for (int t = 0; t < tierGovernor.getTiers().size(); t++)
+    {
+        if ((tierGovernor.getTiers()[t].source.getDescription() == loaded.source.getDescription())
+            and (tierGovernor.getTiers()[t].windowMs <= 0.0) and (loaded.windowMs > 0.0))
+        {
+            tierGovernor.setTierCost(t, loaded.windowMs);
+        }
+    }
+    modelSource = loaded.source;
+    windowCache = loaded.windowCache;
+    if (wakesWithIt)
+    {
+        applyOutputDelay(requestedOutputDelaySamples);
+        wake(std::move(loaded.model));
+        return;
+    }
+    if (hibernating)
+    {
+        // Picked up when waking
+        warmModels->put(modelSource, std::move(loaded.model));
+    }
+    else
+    {
+        inferenceThread->swapModel(std::move(loaded.model), windowCache);
+    }
+    applyOutputDelay(requestedOutputDelaySamples);
+}
+
+void HARDAudioProcessor::timerCallback()
+{
+    const juce::ScopedLock hl(hibernationLock);
+    if (hibernating or isEngineSwapPending())
+    {
+        // The measurement restarts with the new model
+        governedWindows = (inferenceThread != nullptr) ? inferenceThread->getNumWindowsCompleted() : 0;
+        return;
+    }
+    const double sampleRate = getSampleRate() > 0.0 ? getSampleRate() : 44100.0;
+    const double hopMs = DNN_INPUT_SAMPLES*1000.0/sampleRate;
+    const juce::int64 completed = inferenceThread->getNumWindowsCompleted();
+    for (; governedWindows < completed; governedWindows++)
+    {
+        if (tierGovernor.update(inferenceThread->getAverageInferenceMs(), hopMs))
+        {
+            const QualityTier& tier = tierGovernor.getTiers()[tierGovernor.getLastSwitch().to];
+            RtLog::writeText(RtLog::Category::model, RtLog::Level::info, "Quality tier {s}.", tierGovernor.getLastSwitch().toString(tierGovernor.getTiers()));
+            // The delay the target tier needs; kept while its cost is unknown
+            const int delay = (safeLatency or (tier.windowMs <= 0.0)) ? 0 : computeOutputDelay(tier.windowMs, sampleRate, getBlockSize());
+            setEngineProfile({tier.source, delay});
+            governedWindows = completed;
+            break;
+        }
+    }
+}
+
+void HARDAudioProcessor::applyOutputDelay(int numSamples)
+{
+    {
+        // Keeps a concurrent re-prime from resetting the FIFOs between the two
+        const juce::ScopedLock sl(critical);
+        const int shift = numSamples - outputDelaySamples;
+        outputDelaySamples = numSamples;
+        if (inferenceThread != nullptr)
+        {
+            inferenceThread->shiftOutputDelay(shift);
+        }
+    }
+    reportLatency();
+}
+
+int HARDAudioProcessor::chooseOutputDelay(double sampleRate, int samplesPerBlock)
+{
+    if (safeLatency)
+    {
+        return OUTPUT_DELAY_SAMPLES;
+    }
+    // Measured once per model, which warm instances share
+    const MorpherModel::WindowTiming timing = inferenceThread->getModel()->getWindowTiming();
+    const int delay = computeOutputDelay(timing.maxMs, sampleRate, samplesPerBlock);
+    RtLog::write(RtLog::Category::scheduling, RtLog::Level::info, "Window inference {} ms median, {} ms max of {} runs; {}-sample blocks: output delay {} samples.",
+                 timing.medianMs, timing.maxMs, MorpherModel::WindowTiming::NUM_RUNS, samplesPerBlock, delay);
+    return delay;
+}
+
+int HARDAudioProcessor::computeOutputDelay(double inferenceMs, double sampleRate, int samplesPerBlock)
+{
+    const int inferenceSamples = (int)std::ceil(inferenceMs*INFERENCE_SAFETY_FACTOR*sampleRate/1000.0);
+    // A reprime leaves delay - numLeadIn samples in the output FIFO and numLeadIn in the input
+    // FIFO, which has to reach a full window with its cache before the first request. Its
+    // output must then arrive with OVERLAP_SAMPLES still unread; the lead-in cancels out.
+    // The request and the read that would run short each happen up to a block late.
+    return juce::jlimit(MIN_OUTPUT_DELAY_SAMPLES, MAX_OUTPUT_DELAY_SAMPLES,
+                        (int)(DNN_INPUT_SAMPLES + DNN_INPUT_CACHE_SAMPLES + ONNXMorpherInferenceThread::OVERLAP_SAMPLES)
+                        + 2*samplesPerBlock + inferenceSamples + SCHEDULING_MARGIN_SAMPLES);
+}
+
+void HARDAudioProcessor::reportLatency()
+{
+    int latency = outputDelaySamples - (int)OUTPUT_DELAY_BIAS_SAMPLES;
+   #if JucePlugin_Enable_ARA
+    if (isBoundToARA())
+    {
+        latency = 0;
+    }
+   #endif
+    if (latency != getLatencySamples())
+    {
+        RtLog::write(RtLog::Category::scheduling, RtLog::Level::info, "Latency: {} samples.", latency);
+        setLatencySamples(latency);
+    }
+}
+
+WorkerPolicy::Status HARDAudioProcessor::getWorkerPolicyStatus() const
+{
+    const juce::ScopedLock hl(hibernationLock);
+    return inferenceThread != nullptr ? inferenceThread->getWorkerPolicyStatus() : WorkerPolicy::Status();
+}
+
+MorpherModel::PoolThreadStatus HARDAudioProcessor::getPoolThreadStatus() const
+{
+    const juce::ScopedLock hl(hibernationLock);
+    return inferenceThread != nullptr ? inferenceThread->getPoolThreadStatus() : MorpherModel::PoolThreadStatus();
+}
+
+MorpherModel::MemoryStats HARDAudioProcessor::getModelMemoryStats() const
+{
+    const juce::ScopedLock hl(hibernationLock);
+    return inferenceThread != nullptr ? inferenceThread->getMemoryStats() : MorpherModel::MemoryStats();
+}
+
+OrtSharedAllocator::Stats HARDAudioProcessor::getSharedArenaStats() const
+{
+    const juce::ScopedLock hl(hibernationLock);
+    auto* allocator = environment->getSharedAllocator();
+    return allocator != nullptr ? allocator->getStats() : OrtSharedAllocator::Stats();
+}
+
+void HARDAudioProcessor::requestWindow()
+{
+    requestedHarmony = *harmonyParameter;
+    requestedRhythm = *rhythmParameter;
+    requestedSourceGain = *sourceGainParameter;
+    requestedSidechainGain = *sidechainGainParameter;
+    inferenceThread->setDeadline(getWindowDeadlineMs());
+    inferenceThread->requestInference(dnnInputData1.data(), dnnInputData2.data(), requestedRhythm, requestedHarmony, requestedSourceGain, requestedSidechainGain, &fifoBufferOutDNN);
+    if ((pendingChangeSample >= 0) and (responseWindow < 0))
+    {
+        // Windows complete in order, one at a time
+        responseWindow = inferenceThread->getNumWindowsCompleted() + 1;
+    }
+}
+
+void HARDAudioProcessor::handleControlChanges(int numSamples)
+{
+    bool changed = (std::abs(*harmonyParameter - requestedHarmony) > SIGNIFICANT_CONTROL_CHANGE)
+                or (std::abs(*rhythmParameter - requestedRhythm) > SIGNIFICANT_CONTROL_CHANGE)
+                or (std::abs(*sourceGainParameter - requestedSourceGain) > SIGNIFICANT_CONTROL_CHANGE)
+                or (std::abs(*sidechainGainParameter - requestedSidechainGain) > SIGNIFICANT_CONTROL_CHANGE);
+    if (changed and (pendingChangeSample < 0))
+    {
+        pendingChangeSample = processedSamples;
+        responseWindow = -1;
+    }
+    
+    if (changed and !cancelPending and inferenceThread->threadIsInferring())
+    {
+        // Only cancel if the buffered output lasts until a fresh run is done
+        double sampleRate = getSampleRate() > 0.0 ? getSampleRate() : 44100.0;
+        double averageMs = inferenceThread->getAverageInferenceMs();
+        double neededMs = averageMs*1.5 + numSamples*1000.0/sampleRate;
+        double bufferedMs = (fifoBufferOutDNN.getBufferSize() - numSamples)*1000.0/sampleRate;
+        if ((averageMs > 0.0) and (bufferedMs > neededMs))
+        {
+            inferenceThread->cancelInference();
+            cancelPending = true;
+            numCancellations++;
+        }
+    }
+    
+    // After a transport jump the cancelled window is stale; reprime() clears cancelPending
+    if (cancelPending and !reprimePending and !inferenceThread->threadIsInferring())
+    {
+        cancelPending = false;
+        if (inferenceThread->wasCancelled())
+        {
+            // dnnInputData still holds the cancelled window
+            const CallbackMonitor::ScopedTimedLock lock(critical, callbackMonitor);
+            requestWindow();
+            numReissues++;
+        }
+    }
+}
+
+void HARDAudioProcessor::measureControlResponse()
+{
+    if ((responseWindow < 0) or (inferenceThread->getNumWindowsCompleted() < responseWindow))
+    {
+        return;
+    }
+    // The new window's crossfade starts after everything queued ahead of it
+    int numQueued = juce::jmax(0, fifoBufferOutDNN.getBufferSize() - (int)DNN_INPUT_SAMPLES - (int)ONNXMorpherInferenceThread::OVERLAP_SAMPLES);
+    double sampleRate = getSampleRate() > 0.0 ? getSampleRate() : 44100.0;
+    double latencyMs = (processedSamples - pendingChangeSample + numQueued)*1000.0/sampleRate;
+    lastLatencyMs = latencyMs;
+    totalLatencyMs = totalLatencyMs + latencyMs;
+    maxLatencyMs = juce::jmax(maxLatencyMs.load(), latencyMs);
+    numLatencyMeasurements++;
+    pendingChangeSample = -1;
+    responseWindow = -1;
+}
+
+HARDAudioProcessor::ControlResponseStats HARDAudioProcessor::getControlResponseStats() const
+{
+    ControlResponseStats stats;
+    stats.cancellations = numCancellations;
+    stats.reissues = numReissues;
+    stats.numMeasured = numLatencyMeasurements;
+    stats.lastLatencyMs = lastLatencyMs;
+    stats.averageLatencyMs = stats.numMeasured > 0 ? totalLatencyMs/(double)stats.numMeasured : 0.0;
+    stats.maxLatencyMs = maxLatencyMs;
+    return stats;
+}
+
+void HARDAudioProcessor::handleTransport(const juce::Optional<juce::AudioPlayHead::PositionInfo>& position, int numSamples)
+{
+    juce::int64 timelineSample = -1;
+    if (position.hasValue() and position->getIsPlaying() and position->getTimeInSamples().hasValue())
+    {
+        timelineSample = *position->getTimeInSamples();
+        if (timelineSample != expectedTimelineSample)
+        {
+            // Everything queued belongs to the old position
+            reprimePending = true;
+            if (inferenceThread->threadIsInferring())
+            {
+                inferenceThread->cancelInference();
+            }
+        }
+        expectedTimelineSample = timelineSample + numSamples;
+    }
+    else
+    {
+        expectedTimelineSample = -1;
+    }
+    
+    // Otherwise the cancelled (or grid) window is still landing; output is muted meanwhile
+    if (reprimePending and !inferenceThread->threadIsInferring())
+    {
+        reprimePending = false;
+        reprime(timelineSample);
+    }
+}
+
+void HARDAudioProcessor::reprime(juce::int64 timelineSample)
+{
+    int numLeadIn = LEAD_IN_SAMPLES;
+    if ((*timelineAlignParameter > 0.5f) and (timelineSample >= 0))
+    {
+        // Input at fifo position numLeadIn is at timelineSample, so window k starts on a grid point
+        numLeadIn = (int)(((timelineSample % DNN_INPUT_SAMPLES) + DNN_INPUT_SAMPLES) % DNN_INPUT_SAMPLES);
+        if (numLeadIn < LEAD_IN_SAMPLES)
+        {
+            numLeadIn += DNN_INPUT_SAMPLES;
+        }
+    }
+    
+    // Shortening the output delay by the lead-in keeps the latency constant
+    const juce::ScopedLock lock (critical);
+    fifoBufferIn1.clearBuffer();
+    fifoBufferIn2.clearBuffer();
+    fifoBufferIn1.fillZeros(numLeadIn);
+    fifoBufferIn2.fillZeros(numLeadIn);
+    // The FIFOs start at the current delay, so a delay change in progress is done
+    inferenceThread->cancelDelayShift();
+    resetOutputBuffers(outputDelaySamples - numLeadIn);
+    numNewInputSamples = numLeadIn;
+    cancelPending = false;
+}
+
+void HARDAudioProcessor::setInstantFaders(bool enabled)
+{
+    instantFadersRequested = enabled;
+    if (!enabled)
+    {
+        return;
+    }
+    // setStateInformation may come from any thread while audio runs, so the grid
+    // is only allocated on the message thread (or in prepareToPlay)
+    if (juce::MessageManager::existsAndIsCurrentThread())
+    {
+        const juce::ScopedLock hl(hibernationLock);
+        allocateFaderGrid();
+    }
+    else
+    {
+        faderGridRequested = true;
+        triggerAsyncUpdate();
+    }
+}
+
+void HARDAudioProcessor::allocateFaderGrid()
+{
+    // A hibernating instance allocates the grid when it wakes
+    if (!instantFadersRequested or (gridOutputBuffers != nullptr) or hibernating)
+    {
+        return;
+    }
+    // Allocated once and kept, so the audio thread never allocates
+    gridOutputBuffers = std::make_unique<FifoBuffer[]>(NUM_FADER_GRID_POINTS);
+    inferenceThread->setFaderGrid(FADER_GRID_POINTS_PER_AXIS);
+    faderGridReady = true;
+}
+
+void HARDAudioProcessor::updateInstantFaders()
+{
+    if ((instantFadersRequested == instantFadersActive) or inferenceThread->threadIsInferring())
+    {
+        return;
+    }
+    if (instantFadersRequested and !faderGridReady)
+    {
+        // Switches once the message thread has allocated the grid
+        return;
+    }
+    // Windows rendered for the old mode are dropped and replaced by silence of
+    // the same length, so the latency does not change
+    const CallbackMonitor::ScopedTimedLock lock(critical, callbackMonitor);
+    int numDelaySamples = instantFadersActive ? gridOutputBuffers[0].getBufferSize() : fifoBufferOutDNN.getBufferSize();
+    instantFadersActive = instantFadersRequested;
+    resetOutputBuffers(numDelaySamples);
+}
+
+void HARDAudioProcessor::resetOutputBuffers(int numDelaySamples)
+{
+    // A pending latency measurement would count the discarded output
+    pendingChangeSample = -1;
+    responseWindow = -1;
+    fifoBufferOutDNN.clearBuffer();
+    if (instantFadersActive)
+    {
+        // The grid FIFOs of an inactive grid are left alone; they are reset when it becomes active
+        for (int p = 0; p < NUM_FADER_GRID_POINTS; p++)
+        {
+            gridOutputBuffers[p].clearBuffer();
+            gridOutputBuffers[p].fillZeros(numDelaySamples);
+        }
+    }
+    else
+    {
+        fifoBufferOutDNN.fillZeros(numDelaySamples);
+    }
+}
+
+void HARDAudioProcessor::readGridOutput(int numSamples)
+{
+    // Bilinear interpolation between the four grid points around the current faders
+    const int last = FADER_GRID_POINTS_PER_AXIS - 1;
+    float harmony = juce::jlimit(0.0f, 1.0f, harmonyParameter->load())*last;
+    float rhythm = juce::jlimit(0.0f, 1.0f, rhythmParameter->load())*last;
+    int harmonyIndex = juce::jmin((int)harmony, last - 1);
+    int rhythmIndex = juce::jmin((int)rhythm, last - 1);
+    float harmonyFraction = harmony - harmonyIndex;
+    float rhythmFraction = rhythm - rhythmIndex;
+    
+    std::fill(outBufferL.begin(), outBufferL.begin() + numSamples, 0.0f);
+    std::fill(outBufferR.begin(), outBufferR.begin() + numSamples, 0.0f);
+    for (int p = 0; p < NUM_FADER_GRID_POINTS; p++)
+    {
+        // Every FIFO is read to keep them in step, but at most four are mixed
+        gridOutputBuffers[p].readData(gridReadBuffer.data(), numSamples, numSamples);
+        int i = p/FADER_GRID_POINTS_PER_AXIS - harmonyIndex;
+        int j = p%FADER_GRID_POINTS_PER_AXIS - rhythmIndex;
+        if ((i < 0) or (i > 1) or (j < 0) or (j > 1))
+        {
+            continue;
+        }
+        float weight = (i == 0 ? 1.0f - harmonyFraction : harmonyFraction)*(j == 0 ? 1.0f - rhythmFraction : rhythmFraction);
+        for (int n = 0; n < numSamples; n++)
+        {
+            outBufferL[n] += gridReadBuffer[n].l*weight;
+            outBufferR[n] += gridReadBuffer[n].r*weight;
+        }
+    }
 }
 
 //==============================================================================
@@ -267,6 +1078,8 @@ void HARDAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
     // You could do that either as raw data, or use the XML or ValueTree classes
     // as intermediaries to make it easy to save and load complex data.
     auto state = parameters.copyState();
+    state.setProperty("referenceFile", referenceClip.getReferenceFile().getFullPathName(), nullptr);
+    state.setProperty("instantFaders", getInstantFaders(), nullptr);
     std::unique_ptr<juce::XmlElement> xml (state.createXml());
     copyXmlToBinary(*xml, destData);
 }
@@ -282,6 +1095,18 @@ void HARDAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
         if(xmlState->hasTagName(parameters.state.getType()))
         {
             parameters.replaceState(juce::ValueTree::fromXml(*xmlState));
+            
+            setInstantFaders(parameters.state.getProperty("instantFaders", false));
+            
+            juce::String referencePath = parameters.state.getProperty("referenceFile").toString();
+            if (referencePath.isEmpty())
+            {
+                referenceClip.unload();
+            }
+            else if (juce::File(referencePath) != referenceClip.getReferenceFile())
+            {
+                referenceClip.load(juce::File(referencePath));
+            }
         }
     }
 }
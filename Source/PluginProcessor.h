@@ -10,6 +10,14 @@
 
 #include <JuceHeader.h>
 #include "ONNXInferenceThread.hpp"
+#include "ReferenceClip.h"
+#include "WarmModelPool.h"
+#include "ModelLoader.h"
+#include "TierGovernor.h"
+#include "OrtAutotuner.h"
+#include "InferenceTelemetry.h"
+#include "CallbackMonitor.h"
+#include "RtLog.h"
 
 //==============================================================================
 /**
@@ -18,6 +26,9 @@ class HARDAudioProcessor  : public juce::AudioProcessor
                             #if JucePlugin_Enable_ARA
                              , public juce::AudioProcessorARAExtension
                             #endif
+                            , private juce::AsyncUpdater
+                            , private juce::ChangeListener
+                            , private juce::Timer
 {
 public:
     //==============================================================================
@@ -33,6 +44,7 @@ public:
    #endif
 
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlockBypassed (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
 
     //==============================================================================
     juce::AudioProcessorEditor* createEditor() override;
@@ -58,7 +70,136 @@ public:
     void setStateInformation (const void* data, int sizeInBytes) override;
 
     juce::AudioProcessorValueTreeState parameters;
+    
+    WindowCache::Stats getWindowCacheStats() {return windowCache->getStats();}
+    // When a clip is loaded it replaces the sidechain input
+    ReferenceClip& getReferenceClip() {return referenceClip;}
+    // Renders every window at a grid of harmony/rhythm settings and interpolates
+    // between them per block, so fader moves are heard without waiting for the
+    // next window. Message thread; takes effect once no inference is in flight.
+    void setInstantFaders(bool enabled);
+    bool getInstantFaders() const {return instantFadersRequested;}
+    
+    struct ControlResponseStats
+    {
+        juce::int64 cancellations = 0;      // in-flight windows stopped for a fader change
+        juce::int64 reissues = 0;           // of which were rendered again with the new values
+        juce::int64 numMeasured = 0;
+        double lastLatencyMs = 0.0;         // from a fader change to the first output sample that reflects it
+        double averageLatencyMs = 0.0;
+        double maxLatencyMs = 0.0;
+    };
+    ControlResponseStats getControlResponseStats() const;
+    
+    // Scheduling of the inference worker and its pool threads, as read back from the OS.
+    // These are empty while the instance hibernates.
+    WorkerPolicy::Status getWorkerPolicyStatus() const;
+    MorpherModel::PoolThreadStatus getPoolThreadStatus() const;
+    // This instance's session, and the arena shared by all instances
+    MorpherModel::MemoryStats getModelMemoryStats() const;
+    OrtSharedAllocator::Stats getSharedArenaStats() const;
+    
+    // A hibernating instance has released its session, worker and FIFOs. It
+    // hibernates when the host deactivates it (releaseResources), or after
+    // hibernateAfterSeconds (HARD.settings) of silent input with the transport
+    // stopped, or of bypass, and wakes on prepareToPlay or the first non-silent
+    // input. Input wakes it without blocking the message thread: the session is
+    // loaded in the background unless a warm one is available.
+    bool isHibernating() const {return hibernating;}
+    
+    // What the engine runs: a model, and the output delay that leaves it enough
+    // time per window. The delay is the reported latency plus OUTPUT_DELAY_BIAS_SAMPLES.
+    struct EngineProfile
+    {
+        ModelSource source;
+        int outputDelaySamples = 0;     // 0 keeps the current delay
+    };
+    // After a reprime, the first window is requested once the input holds a full window with
+    // its cache, and must arrive while OVERLAP_SAMPLES of the primed output are still unread.
+    // Below this even an instant model underruns; the last term is a margin for two 512-sample blocks.
+    static const int MIN_OUTPUT_DELAY_SAMPLES = ONNXMorpherInferenceThread::DNN_INPUT_SAMPLES + ONNXMorpherInferenceThread::DNN_INPUT_CACHE_SAMPLES
+                                              + ONNXMorpherInferenceThread::OVERLAP_SAMPLES + 2*512;
+    static const int MAX_OUTPUT_DELAY_SAMPLES = FifoBuffer::BUFFER_SIZE/2;
+    // Message thread. Switches without a gap or an audio thread stall: a new model
+    // is loaded and warmed up in the background while the current one keeps
+    // playing, and takes over at a window boundary with a crossfade. A new delay
+    // is reported to the host at once and reached over the next few windows.
+    // A profile requested while another is loading replaces it.
+    void setEngineProfile(const EngineProfile& profile);
+    bool isEngineSwapPending() const;
+    int getOutputDelaySamples() const {return outputDelaySamples;}
+    
+    // Model tiers found next to the model, cheapest first; the governor moves
+    // between them when qualityTiers (HARD.settings) is on and there is more than one
+    const juce::Array<QualityTier>& getQualityTiers() const {return tierGovernor.getTiers();}
+    int getQualityTier() const {return tierGovernor.getCurrentTier();}
+    
+    // Stage times of every window, and counts of skipped, bypassed and late
+    // ones, since the instance was created or reset. Kept across hibernation.
+    InferenceTelemetry::Snapshot getTelemetry() const {return telemetry->getSnapshot();}
+    void resetTelemetry() {telemetry->reset(); callbackMonitor.reset();}
+    // Writes the telemetry, the callback monitor's figures and its overrun log
+    // as JSON. Message thread.
+    bool dumpTelemetry(const juce::File& file);
+    // Times processBlock against its deadline when enabled (callbackMonitor in
+    // HARD.settings, or at run time), and logs the callbacks that go over budget
+    CallbackMonitor& getCallbackMonitor() {return callbackMonitor;}
 private:
+    // Feeds the tier governor
+    void timerCallback() override;
+
+    void changeListenerCallback(juce::ChangeBroadcaster* source) override;
+    // Message thread, under hibernationLock
+    void applyOutputDelay(int numSamples);
+    // The smallest output delay at which the model's slowest timed window
+    // still arrives in time at this block size. Without a
+    // FIFO underrun, a window has the delay minus one hop, two blocks
+    // (late request, early read) and its overlap to finish.
+    int chooseOutputDelay(double sampleRate, int samplesPerBlock);
+    // The same for a window that takes inferenceMs, e.g. a quality tier's cost
+    static int computeOutputDelay(double inferenceMs, double sampleRate, int samplesPerBlock);
+    void reportLatency();
+    
+    void handleAsyncUpdate() override;
+    // Both are message thread or host calls outside processBlock
+    void hibernate();
+    // Creates the engine, from loadedModel or a warm or newly loaded session. Blocks
+    // while a session is loaded, so only prepareToPlay calls it without a model.
+    void wake(std::shared_ptr<MorpherModel> loadedModel = nullptr);
+    // Message thread. Wakes at once with a warm session, otherwise has modelLoader
+    // load one and wakes when it is ready (changeListenerCallback).
+    void wakeInBackground();
+    // Counts idle samples and asks the message thread to hibernate or wake. Silence
+    // only counts as idle while mayHibernate (the transport is stopped, or bypass).
+    void trackActivity(bool isIdle, bool mayHibernate, int numSamples);
+    // Audio thread; counts whole hops without output
+    void countBypassed(int numSamples);
+    // How long the output FIFO lasts at the current block size, for the telemetry's slack
+    double getWindowDeadlineMs();
+    
+    // Cancels the window being inferred when the faders moved significantly since
+    // it was requested and the buffered output covers a fresh run, then re-issues it
+    void handleControlChanges(int numSamples);
+    void requestWindow();
+    void measureControlResponse();
+    void updateInstantFaders();
+    // Allocates the grid FIFOs if instant faders are requested and the instance is awake.
+    // Message thread or prepareToPlay, with hibernationLock held.
+    void allocateFaderGrid();
+    // Clears all output FIFOs and prefills the active one with numDelaySamples of silence
+    void resetOutputBuffers(int numDelaySamples);
+    void readGridOutput(int numSamples);
+
+    // Detects playback starts, seeks and loop jumps from the play head, cancels the
+    // window being inferred and re-primes the FIFOs once the worker is idle
+    void handleTransport(const juce::Optional<juce::AudioPlayHead::PositionInfo>& position, int numSamples);
+    // Flushes everything queued and starts a new window sequence at timelineSample (-1 if unknown).
+    // With "Align to Timeline", window boundaries fall on multiples of DNN_INPUT_SAMPLES on the
+    // timeline, so looped bars produce identical windows.
+    void reprime(juce::int64 timelineSample);
+    
+    // Declared first, so it outlives every thread of this instance that writes to it
+    juce::SharedResourcePointer<RtLog> rtLog;
     juce::CriticalSection critical;
     
     std::atomic<float>* harmonyParameter = nullptr;
@@ -66,6 +207,7 @@ private:
     std::atomic<float>* sourceGainParameter = nullptr;
     std::atomic<float>* sidechainGainParameter = nullptr;
     std::atomic<float>* syncParameter = nullptr;
+    std::atomic<float>* timelineAlignParameter = nullptr;
     
     float preHarmonyParam;
     float preRhythmParam;
@@ -79,13 +221,83 @@ private:
     static const unsigned int DNN_INPUT_CACHE_SAMPLES = 8192;
     static const unsigned int OUTPUT_DELAY_SAMPLES = 16384+8192;
     static const unsigned int OUTPUT_DELAY_BIAS_SAMPLES = 4096;
+    static const size_t WINDOW_CACHE_BYTES = 64 << 20;
+    static const int FADER_GRID_POINTS_PER_AXIS = 3;
+    static const int NUM_FADER_GRID_POINTS = FADER_GRID_POINTS_PER_AXIS*FADER_GRID_POINTS_PER_AXIS;
+    
+    // Zeros the first window after a re-prime starts with, so that its output
+    // begins with the first new input sample (the offline renderer's lead-in)
+    static const int LEAD_IN_SAMPLES = ONNXMorpherInferenceThread::DNN_OUTPUT_DROP_HEAD_SAMPLES + ONNXMorpherInferenceThread::OVERLAP_SAMPLES;
+    
+    juce::int64 expectedTimelineSample = -1;
+    bool reprimePending = false;
     
     std::array<stereo_float, DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES> dnnInputData1;
     std::array<stereo_float, DNN_INPUT_SAMPLES+DNN_INPUT_CACHE_SAMPLES> dnnInputData2;
     std::array<float, OUTPUT_DELAY_SAMPLES> outBufferL;
     std::array<float, OUTPUT_DELAY_SAMPLES> outBufferR;    // 出力書き込み用配列
     
-    ONNXMorpherInferenceThread* pInferenceThread;
+    // One output FIFO per fader grid point, allocated when instant faders are first enabled
+    std::unique_ptr<FifoBuffer[]> gridOutputBuffers;
+    std::array<stereo_float, OUTPUT_DELAY_SAMPLES> gridReadBuffer;
+    std::atomic<bool> instantFadersRequested{false};
+    // Set once gridOutputBuffers is allocated; the audio thread only switches to the grid then
+    std::atomic<bool> faderGridReady{false};
+    std::atomic<bool> faderGridRequested{false};
+    bool instantFadersActive = false;
+    
+    static constexpr float SIGNIFICANT_CONTROL_CHANGE = 0.02f;
+    float requestedHarmony = 0.0f;
+    float requestedRhythm = 0.0f;
+    float requestedSourceGain = 1.0f;
+    float requestedSidechainGain = 1.0f;
+    bool cancelPending = false;
+    juce::int64 processedSamples = 0;
+    juce::int64 pendingChangeSample = -1;       // first unanswered fader change
+    juce::int64 responseWindow = -1;            // window that carries it
+    
+    std::atomic<juce::int64> numCancellations{0};
+    std::atomic<juce::int64> numReissues{0};
+    std::atomic<juce::int64> numLatencyMeasurements{0};
+    std::atomic<double> lastLatencyMs{0.0};
+    std::atomic<double> totalLatencyMs{0.0};
+    std::atomic<double> maxLatencyMs{0.0};
+    
+    std::unique_ptr<ONNXMorpherInferenceThread> inferenceThread;
+    std::shared_ptr<WindowCache> windowCache;
+    std::shared_ptr<InferenceTelemetry> telemetry = std::make_shared<InferenceTelemetry>();
+    juce::int64 bypassedSamples = 0;
+    CallbackMonitor callbackMonitor;
+    
+    // What a woken instance loads its engine with
+    WorkerPolicy workerPolicy;
+    std::shared_ptr<OrtEnvironment> environment;
+    ModelSource modelSource;
+    juce::SharedResourcePointer<WarmModelPool> warmModels;
+    std::unique_ptr<ModelLoader> modelLoader;
+    juce::SharedResourcePointer<AutotuneThread> autotuneThread;
+    // Current value, and that of the profile being loaded
+    std::atomic<int> outputDelaySamples{OUTPUT_DELAY_SAMPLES};
+    int requestedOutputDelaySamples = OUTPUT_DELAY_SAMPLES;
+    // Keeps OUTPUT_DELAY_SAMPLES instead of choosing the delay from the measured inference time
+    bool safeLatency = false;
+    static constexpr double INFERENCE_SAFETY_FACTOR = 1.5;
+    static const int SCHEDULING_MARGIN_SAMPLES = 1024;
+    TierGovernor tierGovernor;
+    juce::int64 governedWindows = 0;
+    static const int GOVERNOR_INTERVAL_MS = 100;
+    mutable juce::CriticalSection hibernationLock;
+    std::atomic<bool> hibernating{false};
+    bool hibernateWhenInactive = true;
+    double hibernateAfterSeconds = 30.0;            // 0 never hibernates while active
+    std::atomic<juce::int64> idleSamples{0};
+    std::atomic<bool> wakeRequested{false};
+    // Message thread: modelLoader is loading the session to wake with
+    bool wakeLoadPending = false;
+    std::atomic<bool> hibernationRequested{false};
+    // Below this input level, a block counts as silent
+    static constexpr float SILENCE_LEVEL = 3.0e-5f;
+    ReferenceClip referenceClip;
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HARDAudioProcessor)
 };
@@ -0,0 +1,232 @@
+//
+//  ReferenceClip.cpp
+//  HARD
+//
+
+#include "ReferenceClip.h"
+#include "RtLog.h"
+
+#if JUCE_WINDOWS
+ #include <windows.h>
+#else
+ #include <sys/mman.h>
+#endif
+
+#define REFERENCE_BANK_EXTENSION ".hardbank"
+
+// Native byte order, followed by numFrames packed stereo_float frames
+struct BankHeader
+{
+    char magic[4];
+    juce::uint32 numChannels;
+    double sampleRate;
+    juce::int64 sourceSize;
+    juce::int64 sourceModificationTime;
+    juce::int64 numFrames;
+};
+
+static const char BANK_MAGIC[4] = {'H', 'R', 'B', '1'};
+static const int BANK_CHUNK_FRAMES = 65536;
+
+static bool bankMatchesSource(const juce::MemoryMappedFile& mapped, const juce::File& source)
+{
+    if ((mapped.getData() == nullptr) or (mapped.getSize() < sizeof(BankHeader)))
+    {
+        return false;
+    }
+    BankHeader header;
+    memcpy(&header, mapped.getData(), sizeof(header));
+    return (memcmp(header.magic, BANK_MAGIC, sizeof(BANK_MAGIC)) == 0) and (header.numChannels == 2)
+       and (header.sampleRate == ReferenceClip::SAMPLE_RATE) and (header.sourceSize == source.getSize())
+       and (header.sourceModificationTime == source.getLastModificationTime().toMilliseconds())
+       and (mapped.getSize() >= sizeof(BankHeader) + (size_t)header.numFrames*sizeof(stereo_float));
+}
+
+// Keeps the pages in RAM until they are unmapped, which also unlocks them. Fails
+// past the process's lock limit (RLIMIT_MEMLOCK, or the working set on Windows).
+static bool lockPages(const void* data, size_t numBytes)
+{
+   #if JUCE_WINDOWS
+    return VirtualLock(const_cast<void*>(data), numBytes) != 0;
+   #else
+    return mlock(data, numBytes) == 0;
+   #endif
+}
+
+ReferenceClip::ReferenceClip()
+:juce::Thread("ReferenceClipThread")
+{
+}
+
+ReferenceClip::~ReferenceClip()
+{
+    stopThread(10000);
+}
+
+juce::File ReferenceClip::getBankFile(const juce::File& source)
+{
+    if (source.getParentDirectory().hasWriteAccess())
+    {
+        return source.withFileExtension(source.getFileExtension().substring(1) + REFERENCE_BANK_EXTENSION);
+    }
+    const juce::String path = source.getFullPathName();
+    return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+        .getChildFile("HARD/ReferenceBanks")
+        .getChildFile(juce::String::toHexString(path.hashCode64()) + REFERENCE_BANK_EXTENSION);
+}
+
+void ReferenceClip::load(const juce::File& file)
+{
+    unload();
+    referenceFile = file;
+    state = State::preparing;
+    sendChangeMessage();
+    startThread();
+}
+
+void ReferenceClip::unload()
+{
+    stopThread(10000);
+    std::unique_ptr<juce::MemoryMappedFile> oldBank;
+    {
+        const juce::SpinLock::ScopedLockType lock(bankLock);
+        std::swap(oldBank, bank);
+        frames = nullptr;
+        numFrames = 0;
+    }
+    referenceFile = juce::File();
+    state = State::empty;
+    sendChangeMessage();
+}
+
+void ReferenceClip::pushToFifo(FifoBuffer& fifo, juce::int64 position, int numSamples)
+{
+    const juce::SpinLock::ScopedLockType lock(bankLock);
+    auto overlap = juce::Range<juce::int64>(0, numFrames).getIntersectionWith({position, position + numSamples});
+    if (overlap.isEmpty())
+    {
+        fifo.fillZeros(numSamples);
+        return;
+    }
+    int numBefore = (int)(overlap.getStart() - position);
+    fifo.fillZeros(numBefore);
+    fifo.pushData(frames + overlap.getStart(), (int)overlap.getLength());
+    fifo.fillZeros(numSamples - numBefore - (int)overlap.getLength());
+}
+
+void ReferenceClip::run()
+{
+    const juce::File source = referenceFile;
+    const juce::File bankFile = getBankFile(source);
+
+    auto mapped = std::make_unique<juce::MemoryMappedFile>(bankFile, juce::MemoryMappedFile::readOnly);
+    if (!bankMatchesSource(*mapped, source))
+    {
+        mapped.reset();
+        if (!prepareBank(source, bankFile))
+        {
+            state = threadShouldExit() ? State::empty : State::failed;
+            sendChangeMessage();
+            return;
+        }
+        mapped = std::make_unique<juce::MemoryMappedFile>(bankFile, juce::MemoryMappedFile::readOnly);
+        if (!bankMatchesSource(*mapped, source))
+        {
+            state = State::failed;
+            sendChangeMessage();
+            return;
+        }
+    }
+
+    BankHeader header;
+    memcpy(&header, mapped->getData(), sizeof(header));
+    const char* data = static_cast<const char*>(mapped->getData());
+
+    // Locked, so the audio thread never faults pages in. Past the lock limit the pages
+    // are only read in here, and the OS may still evict them under memory pressure.
+    if (!lockPages(data, mapped->getSize()))
+    {
+        RtLog::write(RtLog::Category::audio, RtLog::Level::info, "Reference bank of {} MB not locked in memory; playback may page-fault under memory pressure.",
+                     (double)mapped->getSize()/(1024.0*1024.0));
+        volatile char touched = 0;
+        for (size_t i = 0; i < mapped->getSize(); i += 4096)
+        {
+            touched = touched + data[i];
+        }
+    }
+
+    {
+        const juce::SpinLock::ScopedLockType lock(bankLock);
+        frames = reinterpret_cast<const stereo_float*>(data + sizeof(BankHeader));
+        numFrames = header.numFrames;
+        std::swap(bank, mapped);
+    }
+    state = State::ready;
+    sendChangeMessage();
+}
+
+bool ReferenceClip::prepareBank(const juce::File& source, const juce::File& bankFile)
+{
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(source));
+    if ((reader == nullptr) or (reader->sampleRate <= 0.0))
+    {
+        return false;
+    }
+    const bool isMono = (reader->numChannels == 1);
+    const double ratio = reader->sampleRate/SAMPLE_RATE;
+    const juce::int64 totalFrames = (juce::int64)std::ceil((double)reader->lengthInSamples/ratio);
+
+    juce::AudioFormatReaderSource readerSource(reader.get(), false);
+    juce::ResamplingAudioSource resampler(&readerSource, false, 2);
+    resampler.setResamplingRatio(ratio);
+    resampler.prepareToPlay(BANK_CHUNK_FRAMES, SAMPLE_RATE);
+
+    bankFile.getParentDirectory().createDirectory();
+    juce::TemporaryFile temporary(bankFile);
+    {
+        juce::FileOutputStream stream(temporary.getFile());
+        if (stream.failedToOpen())
+        {
+            return false;
+        }
+        BankHeader header;
+        memcpy(header.magic, BANK_MAGIC, sizeof(BANK_MAGIC));
+        header.numChannels = 2;
+        header.sampleRate = SAMPLE_RATE;
+        header.sourceSize = source.getSize();
+        header.sourceModificationTime = source.getLastModificationTime().toMilliseconds();
+        header.numFrames = totalFrames;
+        stream.write(&header, sizeof(header));
+
+        juce::AudioBuffer<float> chunk(2, BANK_CHUNK_FRAMES);
+        std::vector<stereo_float> packed(BANK_CHUNK_FRAMES);
+        for (juce::int64 done = 0; done < totalFrames; done += BANK_CHUNK_FRAMES)
+        {
+            if (threadShouldExit())
+            {
+                return false;
+            }
+            int numChunk = (int)juce::jmin((juce::int64)BANK_CHUNK_FRAMES, totalFrames - done);
+            resampler.getNextAudioBlock(juce::AudioSourceChannelInfo(&chunk, 0, numChunk));
+            const float* right = chunk.getReadPointer(isMono ? 0 : 1);
+            for (int i = 0; i < numChunk; i++)
+            {
+                packed[(size_t)i].l = chunk.getSample(0, i);
+                packed[(size_t)i].r = right[i];
+            }
+            if (!stream.write(packed.data(), sizeof(stereo_float)*(size_t)numChunk))
+            {
+                return false;
+            }
+        }
+        stream.flush();
+        if (stream.getStatus().failed())
+        {
+            return false;
+        }
+    }
+    resampler.releaseResources();
+    return temporary.overwriteTargetFileWithTemporary();
+}
@@ -0,0 +1,66 @@
+//
+//  ReferenceClip.h
+//  HARD
+//
+
+#ifndef ReferenceClip_h
+#define ReferenceClip_h
+
+#include <JuceHeader.h>
+#include "DataStructure.h"
+
+// Reference-clip mode: instead of a live sidechain, the sidechain input is read
+// from an audio file at the host's playback position.
+//
+// The file is decoded and resampled to 44.1kHz stereo once, on a background
+// thread, into a bank of packed stereo_float frames (the layout the inference
+// input FIFO takes). The bank is written next to the reference file as
+// <name>.hardbank, or to the application data folder if that is not writable,
+// and memory-mapped for playback, so reopening a project skips the decoding.
+// The mapping is locked in memory where the OS allows it, so playback does
+// not page-fault; otherwise its pages are only read in once.
+class ReferenceClip: public juce::ChangeBroadcaster,
+                     private juce::Thread
+{
+public:
+    static constexpr double SAMPLE_RATE = 44100.0;
+
+    enum class State
+    {
+        empty,
+        preparing,
+        ready,
+        failed
+    };
+
+    ReferenceClip();
+    ~ReferenceClip() override;
+
+    // Message thread; the clip is prepared in the background
+    void load(const juce::File& referenceFile);
+    void unload();
+    juce::File getReferenceFile() const {return referenceFile;}
+    State getState() const {return state;}
+
+    // Audio thread. Pushes numSamples frames starting at the given timeline
+    // position; frames outside the clip, or before it is ready, are silent.
+    void pushToFifo(FifoBuffer& fifo, juce::int64 position, int numSamples);
+
+private:
+    void run() override;
+    bool prepareBank(const juce::File& source, const juce::File& bank);
+    static juce::File getBankFile(const juce::File& source);
+
+    juce::File referenceFile;
+    std::atomic<State> state{State::empty};
+
+    // Guards the mapping against the audio thread, held only for copies and swaps
+    juce::SpinLock bankLock;
+    std::unique_ptr<juce::MemoryMappedFile> bank;
+    const stereo_float* frames = nullptr;
+    juce::int64 numFrames = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(ReferenceClip)
+};
+
+#endif /* ReferenceClip_h */
@@ -0,0 +1,240 @@
+//
+//  RtLog.cpp
+//  HARD
+//
+
+#include "RtLog.h"
+
+static_assert((RtLog::CAPACITY & (RtLog::CAPACITY-1)) == 0, "The ring capacity must be a power of two");
+
+std::atomic<RtLog*> RtLog::current{nullptr};
+
+RtLog::RtLog()
+    : juce::Thread("HARD log"),
+      cells(new Cell[CAPACITY]),
+      startTicks(juce::Time::getHighResolutionTicks())
+{
+    for (size_t i = 0; i < (size_t)CAPACITY; i++)
+    {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    configure(Options());
+    current = this;
+    startThread(juce::Thread::Priority::low);
+}
+
+RtLog::~RtLog()
+{
+    current = nullptr;
+    stopThread(FLUSH_INTERVAL_MS*10);
+    drain();
+}
+
+void RtLog::configure(const Options& options)
+{
+    for (int c = 0; c < NUM_CATEGORIES; c++)
+    {
+        levels[(size_t)c].store(options.levels[(size_t)c], std::memory_order_relaxed);
+    }
+    const juce::ScopedLock sl(outputLock);
+    if (options.file == juce::File())
+    {
+        fileOutput.reset();
+    }
+    else if ((fileOutput == nullptr) or (fileOutput->getFile() != options.file))
+    {
+        options.file.getParentDirectory().createDirectory();
+        fileOutput = std::make_unique<juce::FileOutputStream>(options.file);
+        if (fileOutput->failedToOpen())
+        {
+            fileOutput.reset();
+        }
+    }
+}
+
+bool RtLog::isEnabled(Category category, Level level)
+{
+    RtLog* log = current.load(std::memory_order_acquire);
+    return (log != nullptr) and (level != Level::off)
+       and (level <= log->levels[(size_t)category].load(std::memory_order_relaxed));
+}
+
+void RtLog::push(Category category, Level level, const char* format, const char* text, const double numbers[], int numNumbers)
+{
+    if (!isEnabled(category, level))
+    {
+        return;
+    }
+    RtLog* log = current.load(std::memory_order_acquire);
+    if ((log != nullptr) and !log->tryPush(category, level, format, text, numbers, numNumbers))
+    {
+        log->numDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool RtLog::tryPush(Category category, Level level, const char* format, const char* text, const double numbers[], int numNumbers)
+{
+    size_t position = writePosition.load(std::memory_order_relaxed);
+    Cell* cell = nullptr;
+    for (;;)
+    {
+        cell = &cells[position & (size_t)(CAPACITY-1)];
+        const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        const auto difference = (std::ptrdiff_t)sequence - (std::ptrdiff_t)position;
+        if (difference == 0)
+        {
+            if (writePosition.compare_exchange_weak(position, position+1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Full
+            return false;
+        }
+        else
+        {
+            position = writePosition.load(std::memory_order_relaxed);
+        }
+    }
+    Record& record = cell->record;
+    record.ticks = juce::Time::getHighResolutionTicks();
+    record.format = format;
+    record.category = category;
+    record.level = level;
+    record.numNumbers = numNumbers;
+    for (int i = 0; i < numNumbers; i++)
+    {
+        record.numbers[(size_t)i] = numbers[i];
+    }
+    record.text[0] = 0;
+    if (text != nullptr)
+    {
+        int i = 0;
+        for (; (i < MAX_TEXT_BYTES-1) and (text[i] != 0); i++)
+        {
+            record.text[i] = text[i];
+        }
+        record.text[i] = 0;
+    }
+    cell->sequence.store(position+1, std::memory_order_release);
+    return true;
+}
+
+bool RtLog::tryPop(Record& record)
+{
+    Cell& cell = cells[readPosition & (size_t)(CAPACITY-1)];
+    if (cell.sequence.load(std::memory_order_acquire) != readPosition+1)
+    {
+        return false;
+    }
+    record = cell.record;
+    cell.sequence.store(readPosition + (size_t)CAPACITY, std::memory_order_release);
+    readPosition++;
+    return true;
+}
+
+juce::String RtLog::formatRecord(const Record& record) const
+{
+    const double seconds = juce::Time::highResolutionTicksToSeconds(record.ticks - startTicks);
+    juce::String line;
+    line << "[" << juce::String(seconds, 3).paddedLeft(' ', 9) << " " << getCategoryName(record.category) << "] ";
+    int number = 0;
+    for (const char* c = record.format; *c != 0; c++)
+    {
+        if ((c[0] == '{') and (c[1] == '}'))
+        {
+            if (number < record.numNumbers)
+            {
+                const double value = record.numbers[(size_t)number++];
+                line << ((value == std::floor(value) and std::abs(value) < 1.0e15) ? juce::String((juce::int64)value) : juce::String(value, 2));
+            }
+            c++;
+        }
+        else if ((c[0] == '{') and (c[1] == 's') and (c[2] == '}'))
+        {
+            line << juce::String::fromUTF8(record.text);
+            c += 2;
+        }
+        else
+        {
+            line << *c;
+        }
+    }
+    return line;
+}
+
+void RtLog::run()
+{
+    while (!threadShouldExit())
+    {
+        wait(FLUSH_INTERVAL_MS);
+        drain();
+    }
+}
+
+void RtLog::drain()
+{
+    juce::String lines;
+    Record record;
+    while (tryPop(record))
+    {
+        lines << formatRecord(record) << "\n";
+    }
+    const juce::int64 dropped = numDropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+        lines << "(" << dropped << " log records dropped)\n";
+    }
+    if (lines.isEmpty())
+    {
+        return;
+    }
+    const juce::ScopedLock sl(outputLock);
+    if (fileOutput != nullptr)
+    {
+        fileOutput->writeText(lines, false, false, nullptr);
+        fileOutput->flush();
+    }
+    else
+    {
+        std::fputs(lines.toRawUTF8(), stderr);
+        std::fflush(stderr);
+    }
+}
+
+const char* RtLog::getCategoryName(Category category)
+{
+    switch (category)
+    {
+        case Category::audio: return "audio";
+        case Category::engine: return "engine";
+        case Category::model: return "model";
+        case Category::scheduling: return "scheduling";
+        default: return "";
+    }
+}
+
+RtLog::Level RtLog::parseLevel(const juce::String& name, Level defaultLevel)
+{
+    const juce::StringArray names {"off", "error", "info", "debug"};
+    const int index = names.indexOf(name.trim(), true);
+    return (index >= 0) ? (Level)index : defaultLevel;
+}
+
+RtLog::Options RtLog::Options::fromSettings(const juce::PropertySet& settings, Level defaultLevel)
+{
+    Options options;
+    const Level level = parseLevel(settings.getValue("logLevel"), defaultLevel);
+    for (int c = 0; c < NUM_CATEGORIES; c++)
+    {
+        const juce::String key = juce::String("logLevel.") + getCategoryName((Category)c);
+        options.levels[(size_t)c] = parseLevel(settings.getValue(key), level);
+    }
+    if (settings.getValue("logFile").isNotEmpty())
+    {
+        options.file = juce::File::getSpecialLocation(juce::File::userHomeDirectory).getChildFile(settings.getValue("logFile"));
+    }
+    return options;
+}
@@ -0,0 +1,125 @@
+//
+//  RtLog.h
+//  HARD
+//
+
+#ifndef RtLog_h
+#define RtLog_h
+
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+
+// Logging that is safe on the audio and inference threads. A call copies a
+// format string literal, up to MAX_NUMBERS numbers and an optional short text
+// into a preallocated, fixed-size record of a lock-free ring, and returns; it
+// never allocates, locks or makes a system call. A low-priority thread formats
+// the records and writes them to a file or stderr. When the ring is full,
+// records are dropped and counted rather than waited for, so logging does not
+// change the timing it is meant to show.
+//
+// Hold the log through a juce::SharedResourcePointer for as long as anything
+// may write to it; without a holder, write() does nothing.
+class RtLog: private juce::Thread
+{
+public:
+    enum class Category
+    {
+        audio = 0,      // the audio callback
+        engine,         // the inference worker
+        model,          // loading and swapping models
+        scheduling,     // thread policies, latency, hibernation
+        numCategories
+    };
+    enum class Level
+    {
+        off = 0,
+        error,
+        info,
+        debug       // per window or per block
+    };
+    static const int NUM_CATEGORIES = (int)Category::numCategories;
+    static const int MAX_NUMBERS = 6;
+    static const int MAX_TEXT_BYTES = 120;
+    static const int CAPACITY = 1024;           // records; a power of two
+    static const int FLUSH_INTERVAL_MS = 100;
+
+    struct Options
+    {
+        std::array<Level, NUM_CATEGORIES> levels;
+        juce::File file;                // stderr if not set
+        Options() {levels.fill(Level::info);}
+        // Keys logLevel (off/error/info/debug) for all categories, logLevel.<category>
+        // for one (e.g. logLevel.engine=debug), and logFile
+        static Options fromSettings(const juce::PropertySet& settings, Level defaultLevel = Level::info);
+    };
+
+    RtLog();
+    ~RtLog() override;
+    void configure(const Options& options);
+
+    static bool isEnabled(Category category, Level level);
+    // format is a string literal; each {} in it is replaced by the next number
+    template <typename... Numbers>
+    static void write(Category category, Level level, const char* format, Numbers... numbers)
+    {
+        static_assert(sizeof...(Numbers) <= MAX_NUMBERS, "Too many numbers for a log record");
+        const double values[] = {(double)numbers..., 0.0};
+        push(category, level, format, nullptr, values, (int)sizeof...(Numbers));
+    }
+    // As write(), with {s} in format replaced by text, truncated to MAX_TEXT_BYTES
+    template <typename... Numbers>
+    static void writeText(Category category, Level level, const char* format, const juce::String& text, Numbers... numbers)
+    {
+        static_assert(sizeof...(Numbers) <= MAX_NUMBERS, "Too many numbers for a log record");
+        const double values[] = {(double)numbers..., 0.0};
+        push(category, level, format, text.toRawUTF8(), values, (int)sizeof...(Numbers));
+    }
+
+    static const char* getCategoryName(Category category);
+    static Level parseLevel(const juce::String& name, Level defaultLevel);
+
+private:
+    struct Record
+    {
+        juce::int64 ticks = 0;
+        const char* format = nullptr;
+        std::array<double, MAX_NUMBERS> numbers{};
+        int numNumbers = 0;
+        Category category = Category::audio;
+        Level level = Level::info;
+        char text[MAX_TEXT_BYTES] = {};
+    };
+    // A bounded multi-producer queue (after Dmitry Vyukov). A cell can be
+    // written when its sequence equals the write position, and read when it
+    // is one past it.
+    struct Cell
+    {
+        std::atomic<size_t> sequence{0};
+        Record record;
+    };
+
+    static void push(Category category, Level level, const char* format, const char* text, const double numbers[], int numNumbers);
+    bool tryPush(Category category, Level level, const char* format, const char* text, const double numbers[], int numNumbers);
+    bool tryPop(Record& record);
+    juce::String formatRecord(const Record& record) const;
+    void run() override;
+    // Writer thread, or the destructor once it has stopped
+    void drain();
+
+    static std::atomic<RtLog*> current;
+
+    std::array<std::atomic<Level>, NUM_CATEGORIES> levels;
+    std::unique_ptr<Cell[]> cells;
+    std::atomic<size_t> writePosition{0};
+    size_t readPosition = 0;
+    std::atomic<juce::int64> numDropped{0};
+    const juce::int64 startTicks;
+
+    juce::CriticalSection outputLock;
+    std::unique_ptr<juce::FileOutputStream> fileOutput;
+
+    JUCE_DECLARE_NON_COPYABLE(RtLog)
+};
+
+#endif /* RtLog_h */
@@ -0,0 +1,156 @@
+//
+//  TierGovernor.cpp
+//  HARD
+//
+
+#include "TierGovernor.h"
+
+#define TIER_PREFIX "morpher-"
+#define TIER_COST_KEY "tierWindowMs."
+
+// Relative cost assumed between neighbouring tiers while one is not measured
+static const double UNKNOWN_TIER_COST_RATIO = 2.0;
+// Windows over budget in a row before stepping down, so a single spike does not
+static const int WINDOWS_OVER_BUDGET = 2;
+
+static juce::String getCostKey(const ModelSource& source)
+{
+    return TIER_COST_KEY + source.getFile().getFileName();
+}
+
+juce::Array<QualityTier> QualityTier::findTiers(const ModelSource& fullModel, const juce::PropertySet& settings)
+{
+    juce::Array<QualityTier> tiers;
+    QualityTier full;
+    full.name = "full";
+    full.source = fullModel;
+    tiers.add(full);
+    if (fullModel.getFile() == juce::File())
+    {
+        return tiers;
+    }
+    
+    for (const auto& file : fullModel.getFile().getParentDirectory().findChildFiles(juce::File::findFiles, false, TIER_PREFIX "*"))
+    {
+        const bool isOrt = file.hasFileExtension(".ort");
+        // ORT format before ONNX, as for the full model
+        if ((!isOrt and !file.hasFileExtension(".onnx")) or (!isOrt and file.withFileExtension(".ort").existsAsFile())
+            or (file == fullModel.getFile()))
+        {
+            continue;
+        }
+        QualityTier tier;
+        tier.name = file.getFileNameWithoutExtension().fromFirstOccurrenceOf(TIER_PREFIX, false, false);
+        tier.source = ModelSource::fromFile(file);
+        tiers.add(tier);
+    }
+    
+    bool allMeasured = true;
+    for (auto& tier : tiers)
+    {
+        tier.windowMs = settings.getDoubleValue(getCostKey(tier.source), 0.0);
+        allMeasured = allMeasured and (tier.windowMs > 0.0);
+    }
+    std::sort(tiers.begin(), tiers.end(), [allMeasured](const QualityTier& a, const QualityTier& b)
+    {
+        return allMeasured ? (a.windowMs < b.windowMs) : (a.source.getSize() < b.source.getSize());
+    });
+    return tiers;
+}
+
+void QualityTier::storeCost(juce::PropertySet& settings) const
+{
+    if ((windowMs > 0.0) and (source.getFile() != juce::File()))
+    {
+        settings.setValue(getCostKey(source), windowMs);
+    }
+}
+
+TierGovernor::Options TierGovernor::Options::fromSettings(const juce::PropertySet& settings)
+{
+    Options options;
+    options.enabled = settings.getBoolValue("qualityTiers", true);
+    options.stepDownLoad = juce::jlimit(0.1, 1.0, settings.getDoubleValue("tierStepDownLoad", options.stepDownLoad));
+    options.stepUpLoad = juce::jlimit(0.05, options.stepDownLoad, settings.getDoubleValue("tierStepUpLoad", options.stepUpLoad));
+    return options;
+}
+
+juce::String TierGovernor::Switch::toString(const juce::Array<QualityTier>& tiers) const
+{
+    return tiers[from].name + " -> " + tiers[to].name + ": "
+         + juce::String(windowMs, 1) + " ms per window, " + juce::String(deadlineMs, 1) + " ms hop (load "
+         + juce::String(deadlineMs > 0.0 ? windowMs/deadlineMs : 0.0, 2) + ")";
+}
+
+TierGovernor::TierGovernor(const Options& o)
+:options(o)
+{
+}
+
+void TierGovernor::setTiers(const juce::Array<QualityTier>& newTiers, int tier)
+{
+    tiers = newTiers;
+    currentTier = juce::jlimit(0, juce::jmax(0, tiers.size() - 1), tier);
+    windowsSinceSwitch = 0;
+    windowsOverBudget = 0;
+}
+
+void TierGovernor::selectTier(int tier)
+{
+    currentTier = juce::jlimit(0, juce::jmax(0, tiers.size() - 1), tier);
+    windowsSinceSwitch = 0;
+    windowsOverBudget = 0;
+}
+
+double TierGovernor::estimateLoad(int tier, double load) const
+{
+    const double from = tiers[currentTier].windowMs;
+    const double to = tiers[tier].windowMs;
+    if ((from > 0.0) and (to > 0.0))
+    {
+        return load*to/from;
+    }
+    return load*std::pow(UNKNOWN_TIER_COST_RATIO, tier - currentTier);
+}
+
+bool TierGovernor::update(double windowMs, double deadlineMs)
+{
+    if (!isActive() or (deadlineMs <= 0.0) or (windowMs <= 0.0))
+    {
+        return false;
+    }
+    // The measurement still includes windows of the previous tier
+    if (++windowsSinceSwitch < options.holdWindows)
+    {
+        return false;
+    }
+    const double load = windowMs/deadlineMs;
+    if (load > options.stepDownLoad)
+    {
+        if ((++windowsOverBudget >= WINDOWS_OVER_BUDGET) and (currentTier > 0))
+        {
+            switchTo(currentTier - 1, windowMs, deadlineMs);
+            return true;
+        }
+        return false;
+    }
+    windowsOverBudget = 0;
+    if ((currentTier + 1 < tiers.size()) and (estimateLoad(currentTier + 1, load) < options.stepUpLoad))
+    {
+        switchTo(currentTier + 1, windowMs, deadlineMs);
+        return true;
+    }
+    return false;
+}
+
+void TierGovernor::switchTo(int tier, double windowMs, double deadlineMs)
+{
+    lastSwitch.from = currentTier;
+    lastSwitch.to = tier;
+    lastSwitch.windowMs = windowMs;
+    lastSwitch.deadlineMs = deadlineMs;
+    currentTier = tier;
+    windowsSinceSwitch = 0;
+    windowsOverBudget = 0;
+    numSwitches++;
+}
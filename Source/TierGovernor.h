@@ -0,0 +1,88 @@
+//
+//  TierGovernor.h
+//  HARD
+//
+
+#ifndef TierGovernor_h
+#define TierGovernor_h
+
+#include <JuceHeader.h>
+#include "ModelSource.h"
+
+// One size of the morpher model. Tiers are files named morpher-<name>.ort or
+// .onnx next to the full model (e.g. morpher-tiny.onnx, morpher-base.onnx),
+// which is tier "full".
+struct QualityTier
+{
+    juce::String name;
+    ModelSource source;
+    double windowMs = 0.0;      // measured on this machine, 0 if not yet
+
+    // Cheapest first: by measured cost, or by file size while a cost is unknown.
+    // Costs come from the settings; only the full model if the set has one tier.
+    static juce::Array<QualityTier> findTiers(const ModelSource& fullModel, const juce::PropertySet& settings);
+    // Stores the tier's windowMs for findTiers()
+    void storeCost(juce::PropertySet& settings) const;
+};
+
+// Picks the model tier from the CPU budget. Each inference must finish within
+// one hop (DNN_INPUT_SAMPLES) of audio; the governor watches the measured
+// inference time against it, steps down to a cheaper tier under pressure and
+// back up once the next tier's estimated load leaves headroom again. After a
+// switch it waits holdWindows windows before deciding again. Not thread safe.
+class TierGovernor
+{
+public:
+    struct Options
+    {
+        bool enabled = false;
+        double stepDownLoad = 0.7;      // inference time / hop above which a cheaper tier is used
+        double stepUpLoad = 0.5;        // estimated load of the next tier below which it is used
+        int holdWindows = 8;
+
+        // Keys qualityTiers (default on), tierStepDownLoad and tierStepUpLoad
+        static Options fromSettings(const juce::PropertySet& settings);
+    };
+
+    struct Switch
+    {
+        int from = -1;
+        int to = -1;
+        double windowMs = 0.0;
+        double deadlineMs = 0.0;
+
+        // For logs, e.g. "full -> base: 151.0 ms per window, 185.8 ms hop (load 0.81)"
+        juce::String toString(const juce::Array<QualityTier>& tiers) const;
+    };
+
+    explicit TierGovernor(const Options& options = {});
+
+    void setTiers(const juce::Array<QualityTier>& tiers, int currentTier);
+    const juce::Array<QualityTier>& getTiers() const {return tiers;}
+    void setTierCost(int tier, double windowMs) {tiers.getReference(tier).windowMs = windowMs;}
+    int getCurrentTier() const {return currentTier;}
+    // Back to tier without counting a switch, e.g. when loading the chosen one failed
+    void selectTier(int tier);
+    bool isActive() const {return options.enabled and (tiers.size() > 1);}
+
+    // Once per window, with the time the model took for it and the hop it had.
+    // Returns true if the governor switched tiers; getLastSwitch() has the details.
+    bool update(double windowMs, double deadlineMs);
+    const Switch& getLastSwitch() const {return lastSwitch;}
+    int getNumSwitches() const {return numSwitches;}
+
+private:
+    // Load of tier at the current measurement, from the tiers' relative costs
+    double estimateLoad(int tier, double load) const;
+    void switchTo(int tier, double windowMs, double deadlineMs);
+
+    Options options;
+    juce::Array<QualityTier> tiers;
+    int currentTier = -1;
+    int windowsSinceSwitch = 0;
+    int windowsOverBudget = 0;
+    Switch lastSwitch;
+    int numSwitches = 0;
+};
+
+#endif /* TierGovernor_h */
@@ -0,0 +1,49 @@
+//
+//  WarmModelPool.cpp
+//  HARD
+//
+
+#include "WarmModelPool.h"
+
+std::shared_ptr<MorpherModel> WarmModelPool::take(const ModelSource& source)
+{
+    const juce::ScopedLock sl(lock);
+    const juce::String key = source.getDescription();
+    for (auto entry = entries.rbegin(); entry != entries.rend(); ++entry)
+    {
+        if (entry->source == key)
+        {
+            auto model = std::move(entry->model);
+            entries.erase(std::next(entry).base());
+            return model;
+        }
+    }
+    return nullptr;
+}
+
+void WarmModelPool::put(const ModelSource& source, std::shared_ptr<MorpherModel> model)
+{
+    std::vector<Entry> released;
+    {
+        const juce::ScopedLock sl(lock);
+        entries.push_back({source.getDescription(), std::move(model)});
+        while ((int)entries.size() > maxEntries)
+        {
+            released.push_back(std::move(entries.front()));
+            entries.erase(entries.begin());
+        }
+    }
+    // Sessions are destroyed outside the lock
+}
+
+void WarmModelPool::setMaxModels(int maxModels)
+{
+    std::vector<Entry> released;
+    const juce::ScopedLock sl(lock);
+    maxEntries = juce::jmax(0, maxModels);
+    while ((int)entries.size() > maxEntries)
+    {
+        released.push_back(std::move(entries.front()));
+        entries.erase(entries.begin());
+    }
+}
@@ -0,0 +1,37 @@
+//
+//  WarmModelPool.h
+//  HARD
+//
+
+#ifndef WarmModelPool_h
+#define WarmModelPool_h
+
+#include <JuceHeader.h>
+#include "MorpherModel.h"
+
+// Models released by hibernating instances, kept loaded and warmed up for the
+// next instance that wakes, so restoring usually skips loading a session. Hold
+// it through a juce::SharedResourcePointer so the models go away with the last
+// instance. Only a few are kept, as each holds a session's memory.
+class WarmModelPool
+{
+public:
+    // A model loaded from source, or nullptr if none is kept
+    std::shared_ptr<MorpherModel> take(const ModelSource& source);
+    // Keeps model unless the pool is full, in which case the oldest is released
+    void put(const ModelSource& source, std::shared_ptr<MorpherModel> model);
+    void setMaxModels(int maxModels);
+
+private:
+    struct Entry
+    {
+        juce::String source;
+        std::shared_ptr<MorpherModel> model;
+    };
+
+    juce::CriticalSection lock;
+    std::vector<Entry> entries;
+    int maxEntries = 1;
+};
+
+#endif /* WarmModelPool_h */
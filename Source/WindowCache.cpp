@@ -0,0 +1,122 @@
+//
+//  WindowCache.cpp
+//  HARD
+//
+
+#include "WindowCache.h"
+
+juce::uint64 WindowCache::hashBytes(const void* data, size_t numBytes, juce::uint64 seed)
+{
+    const juce::uint64 prime = 0x9E3779B97F4A7C15ULL;
+    juce::uint64 h = seed ^ (numBytes*prime);
+    const char* bytes = static_cast<const char*>(data);
+    size_t i = 0;
+    for (; i + sizeof(juce::uint64) <= numBytes; i += sizeof(juce::uint64))
+    {
+        juce::uint64 word;
+        memcpy(&word, bytes + i, sizeof(word));
+        h = (h ^ (word*prime))*prime;
+        h ^= h >> 29;
+    }
+    for (; i < numBytes; i++)
+    {
+        h = (h ^ (juce::uint8)bytes[i])*prime;
+    }
+    h ^= h >> 32;
+    return h;
+}
+
+WindowCache::WindowCache(size_t maxBytes)
+:maxEntries(juce::jmax((size_t)1, maxBytes/(sizeof(stereo_float)*WINDOW_SAMPLES)))
+{
+}
+
+juce::uint64 WindowCache::makeKey(const stereo_float input1[], const stereo_float input2[], float rhythm, float harmony, float sourceGain, float sidechainGain)
+{
+    const int parameters[4] = {
+        juce::roundToInt(rhythm*PARAMETER_STEPS),
+        juce::roundToInt(harmony*PARAMETER_STEPS),
+        juce::roundToInt(sourceGain*PARAMETER_STEPS),
+        juce::roundToInt(sidechainGain*PARAMETER_STEPS)
+    };
+    juce::uint64 h = hashBytes(parameters, sizeof(parameters), 0);
+    h = hashBytes(input1, sizeof(stereo_float)*WINDOW_SAMPLES, h);
+    return hashBytes(input2, sizeof(stereo_float)*WINDOW_SAMPLES, h);
+}
+
+bool WindowCache::lookup(juce::uint64 key, stereo_float output[])
+{
+    {
+        const juce::ScopedLock sl(lock);
+        auto found = index.find(key);
+        if (found != index.end())
+        {
+            entries.splice(entries.begin(), entries, found->second);
+            memcpy(output, found->second->output.data(), sizeof(stereo_float)*WINDOW_SAMPLES);
+            numHits++;
+            return true;
+        }
+    }
+    // Disk reads happen outside the lock
+    if ((backingStore != nullptr) and backingStore->load(key, output))
+    {
+        insert(key, output);
+        numHits++;
+        numDiskHits++;
+        return true;
+    }
+    numMisses++;
+    return false;
+}
+
+void WindowCache::store(juce::uint64 key, const stereo_float output[])
+{
+    insert(key, output);
+    if (backingStore != nullptr)
+    {
+        backingStore->store(key, output);
+    }
+}
+
+void WindowCache::insert(juce::uint64 key, const stereo_float output[])
+{
+    const juce::ScopedLock sl(lock);
+    auto found = index.find(key);
+    if (found != index.end())
+    {
+        entries.splice(entries.begin(), entries, found->second);
+        return;
+    }
+    if (entries.size() >= maxEntries)
+    {
+        // Reuse the least recently used entry's buffer
+        entries.splice(entries.begin(), entries, std::prev(entries.end()));
+        index.erase(entries.front().key);
+    }
+    else
+    {
+        entries.push_front({0, std::vector<stereo_float>(WINDOW_SAMPLES)});
+    }
+    entries.front().key = key;
+    memcpy(entries.front().output.data(), output, sizeof(stereo_float)*WINDOW_SAMPLES);
+    index[key] = entries.begin();
+}
+
+void WindowCache::clear()
+{
+    const juce::ScopedLock sl(lock);
+    entries.clear();
+    index.clear();
+}
+
+WindowCache::Stats WindowCache::getStats()
+{
+    const juce::ScopedLock sl(lock);
+    Stats stats;
+    stats.hits = numHits;
+    stats.diskHits = numDiskHits;
+    stats.misses = numMisses;
+    stats.numEntries = (int)entries.size();
+    stats.numBytes = entries.size()*sizeof(stereo_float)*WINDOW_SAMPLES;
+    return stats;
+}
@@ -0,0 +1,78 @@
+//
+//  WindowCache.h
+//  HARD
+//
+
+#ifndef WindowCache_h
+#define WindowCache_h
+
+#include <JuceHeader.h>
+#include "DataStructure.h"
+#include "MorpherModel.h"
+#include "DiskWindowCache.h"
+#include <list>
+#include <unordered_map>
+
+// Bounded LRU cache of model output windows, keyed by a hash of the two input
+// windows and the quantized fader/gain values. When the host loops the same
+// bars, every window after the first pass is served from here without running
+// the model. Thread safe, so one cache can be shared by several engines.
+class WindowCache
+{
+public:
+    static const unsigned int WINDOW_SAMPLES = MorpherModel::WINDOW_SAMPLES;
+    // Fader and gain values are rounded to this many steps before keying
+    static const int PARAMETER_STEPS = 1000;
+
+    struct Stats
+    {
+        juce::int64 hits = 0;
+        juce::int64 diskHits = 0;       // included in hits
+        juce::int64 misses = 0;
+        int numEntries = 0;
+        size_t numBytes = 0;
+    };
+
+    explicit WindowCache(size_t maxBytes);
+
+    // 64-bit multiply-xorshift over 8 byte words; fast enough to be negligible
+    // next to one inference, and collisions are practically impossible at this cache size.
+    static juce::uint64 hashBytes(const void* data, size_t numBytes, juce::uint64 seed);
+    static float quantize(float value) {return std::round(value*PARAMETER_STEPS)/PARAMETER_STEPS;}
+    static juce::uint64 makeKey(const stereo_float input1[], const stereo_float input2[], float rhythm, float harmony, float sourceGain, float sidechainGain);
+
+    // Misses fall through to the disk cache, and stored windows are written to it
+    void setBackingStore(std::shared_ptr<DiskWindowCache> store) {backingStore = std::move(store);}
+
+    // Copies the cached window to output and returns true on a hit
+    bool lookup(juce::uint64 key, stereo_float output[]);
+    void store(juce::uint64 key, const stereo_float output[]);
+    void clear();
+
+    Stats getStats();
+    size_t getMaxBytes() const {return maxEntries*sizeof(stereo_float)*WINDOW_SAMPLES;}
+
+private:
+    struct Entry
+    {
+        juce::uint64 key;
+        std::vector<stereo_float> output;
+    };
+
+    void insert(juce::uint64 key, const stereo_float output[]);
+
+    std::shared_ptr<DiskWindowCache> backingStore;
+    juce::CriticalSection lock;
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<juce::uint64, std::list<Entry>::iterator> index;
+    const size_t maxEntries;
+
+    std::atomic<juce::int64> numHits{0};
+    std::atomic<juce::int64> numDiskHits{0};
+    std::atomic<juce::int64> numMisses{0};
+
+    JUCE_DECLARE_NON_COPYABLE(WindowCache)
+};
+
+#endif /* WindowCache_h */
@@ -0,0 +1,211 @@
+//
+//  WorkerPolicy.cpp
+//  HARD
+//
+
+#include "WorkerPolicy.h"
+
+#if JUCE_MAC or JUCE_LINUX
+ #include <pthread.h>
+ #include <sched.h>
+#endif
+#if JUCE_MAC
+ #include <pthread/qos.h>
+#endif
+#if JUCE_LINUX
+ #include <cerrno>
+ #include <sys/resource.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+#endif
+
+static const int HIGH_PRIORITY_NICE = -10;
+
+static juce::uint64 getAllCores()
+{
+    const int numCores = juce::jmin(64, juce::SystemStats::getNumCpus());
+    return numCores >= 64 ? ~(juce::uint64)0 : (((juce::uint64)1 << numCores) - 1);
+}
+
+static bool applyPriority(const WorkerPolicy& policy, juce::String& description)
+{
+   #if JUCE_MAC or JUCE_LINUX
+    if (policy.priority == WorkerPolicy::Priority::realtime)
+    {
+        const int requested = (policy.scheduler == WorkerPolicy::Scheduler::fifo) ? SCHED_FIFO : SCHED_RR;
+        sched_param param {};
+        param.sched_priority = juce::jlimit(sched_get_priority_min(requested), sched_get_priority_max(requested), policy.realtimePriority);
+        pthread_setschedparam(pthread_self(), requested, &param);
+
+        int actual = 0;
+        sched_param actualParam {};
+        pthread_getschedparam(pthread_self(), &actual, &actualParam);
+        description << (actual == SCHED_FIFO ? "SCHED_FIFO" : actual == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER")
+                    << " " << actualParam.sched_priority;
+        return (actual == requested) and (actualParam.sched_priority == param.sched_priority);
+    }
+    if (policy.priority == WorkerPolicy::Priority::high)
+    {
+       #if JUCE_MAC
+        pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+        const qos_class_t actual = qos_class_self();
+        description << (actual == QOS_CLASS_USER_INTERACTIVE ? "user-interactive QoS" : "default QoS");
+        return actual == QOS_CLASS_USER_INTERACTIVE;
+       #else
+        const pid_t tid = (pid_t)syscall(SYS_gettid);
+        setpriority(PRIO_PROCESS, (id_t)tid, HIGH_PRIORITY_NICE);
+        errno = 0;
+        const int actual = getpriority(PRIO_PROCESS, (id_t)tid);
+        description << "nice " << actual;
+        return (errno == 0) and (actual == HIGH_PRIORITY_NICE);
+       #endif
+    }
+    description << "default priority";
+    return true;
+   #else
+    description << "default priority";
+    return policy.priority == WorkerPolicy::Priority::normal;
+   #endif
+}
+
+static bool applyAffinity(const WorkerPolicy& policy, juce::String& description)
+{
+    if ((policy.cores == 0) and (policy.excludedCores == 0))
+    {
+        description << ", all cores";
+        return true;
+    }
+    const juce::uint64 requested = (policy.cores != 0 ? policy.cores : getAllCores()) & ~policy.excludedCores;
+    if (requested == 0)
+    {
+        description << ", no cores left after exclusion";
+        return false;
+    }
+   #if JUCE_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int core = 0; core < 64; core++)
+    {
+        if (requested & ((juce::uint64)1 << core))
+        {
+            CPU_SET(core, &set);
+        }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    juce::uint64 actual = 0;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+    {
+        for (int core = 0; core < 64; core++)
+        {
+            if (CPU_ISSET(core, &set))
+            {
+                actual |= (juce::uint64)1 << core;
+            }
+        }
+    }
+    description << ", cores " << WorkerPolicy::toCoreList(actual);
+    return actual == (requested & getAllCores());
+   #else
+    description << ", core affinity not supported";
+    return false;
+   #endif
+}
+
+static bool applyDenormals(const WorkerPolicy& policy, juce::String& description)
+{
+    juce::FloatVectorOperations::disableDenormalisedNumberSupport(policy.flushDenormals);
+    const bool actual = juce::FloatVectorOperations::areDenormalsDisabled();
+    description << (actual ? ", FTZ/DAZ" : ", denormals");
+    return actual == policy.flushDenormals;
+}
+
+WorkerPolicy::Status WorkerPolicy::applyToCurrentThread() const
+{
+    Status status;
+    status.priorityApplied = applyPriority(*this, status.description);
+    status.affinityApplied = applyAffinity(*this, status.description);
+    status.denormalsApplied = applyDenormals(*this, status.description);
+    return status;
+}
+
+juce::uint64 WorkerPolicy::parseCoreList(const juce::String& list)
+{
+    juce::uint64 cores = 0;
+    for (const auto& token : juce::StringArray::fromTokens(list, ",", ""))
+    {
+        const juce::String range = token.trim();
+        if (range.isEmpty())
+        {
+            continue;
+        }
+        int first = range.upToFirstOccurrenceOf("-", false, false).getIntValue();
+        int last = range.containsChar('-') ? range.fromFirstOccurrenceOf("-", false, false).getIntValue() : first;
+        for (int core = juce::jmax(0, first); core <= juce::jmin(63, last); core++)
+        {
+            cores |= (juce::uint64)1 << core;
+        }
+    }
+    return cores;
+}
+
+juce::String WorkerPolicy::toCoreList(juce::uint64 cores)
+{
+    juce::StringArray ranges;
+    for (int core = 0; core < 64; core++)
+    {
+        if ((cores & ((juce::uint64)1 << core)) == 0)
+        {
+            continue;
+        }
+        int last = core;
+        while ((last < 63) and (cores & ((juce::uint64)1 << (last + 1))))
+        {
+            last++;
+        }
+        ranges.add(last > core ? juce::String(core) + "-" + juce::String(last) : juce::String(core));
+        core = last;
+    }
+    return ranges.joinIntoString(",");
+}
+
+juce::String WorkerPolicy::toString(Priority priority)
+{
+    switch (priority)
+    {
+        case Priority::high:     return "high";
+        case Priority::realtime: return "realtime";
+        default:                 return "normal";
+    }
+}
+
+WorkerPolicy WorkerPolicy::fromSettings(const juce::PropertySet& settings)
+{
+    WorkerPolicy policy;
+    const juce::String priority = settings.getValue("workerPriority", "normal").trim().toLowerCase();
+    if (priority == "high")
+    {
+        policy.priority = Priority::high;
+    }
+    else if ((priority == "fifo") or (priority == "rr"))
+    {
+        policy.priority = Priority::realtime;
+        policy.scheduler = (priority == "fifo") ? Scheduler::fifo : Scheduler::roundRobin;
+    }
+    policy.realtimePriority = settings.getIntValue("workerRealtimePriority", policy.realtimePriority);
+    policy.cores = parseCoreList(settings.getValue("workerCores"));
+    policy.excludedCores = parseCoreList(settings.getValue("workerExcludedCores"));
+    policy.flushDenormals = settings.getBoolValue("workerFlushDenormals", policy.flushDenormals);
+    return policy;
+}
+
+std::unique_ptr<juce::PropertiesFile> WorkerPolicy::openUserSettings()
+{
+    juce::PropertiesFile::Options options;
+    options.applicationName = "HARD";
+    options.filenameSuffix = ".settings";
+    options.folderName = "HARD";
+    options.osxLibrarySubFolder = "Application Support";
+    return std::make_unique<juce::PropertiesFile>(options);
+}
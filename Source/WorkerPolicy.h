@@ -0,0 +1,70 @@
+//
+//  WorkerPolicy.h
+//  HARD
+//
+
+#ifndef WorkerPolicy_h
+#define WorkerPolicy_h
+
+#include <JuceHeader.h>
+
+// How the inference worker and ONNX Runtime's pool threads are scheduled.
+// The defaults leave scheduling to the OS and only flush denormals, which is
+// what processBlock does with ScopedNoDenormals.
+//
+// A policy is applied from inside the thread it is for, then read back, so the
+// returned Status says what the thread actually runs with. Anything the OS
+// refused (e.g. SCHED_FIFO without the rights for it) is reported, not fatal.
+struct WorkerPolicy
+{
+    enum class Priority
+    {
+        normal,
+        high,       // macOS: user-interactive QoS, Linux: nice -10
+        realtime    // POSIX fixed-priority scheduling, see scheduler
+    };
+
+    enum class Scheduler
+    {
+        fifo,
+        roundRobin
+    };
+
+    Priority priority = Priority::normal;
+    Scheduler scheduler = Scheduler::fifo;
+    // Kept low, so the worker never preempts the host's audio threads
+    int realtimePriority = 10;
+    // Bit n is core n. cores = 0 means all cores; excludedCores are removed
+    // from either. Affinity is not supported on macOS.
+    juce::uint64 cores = 0;
+    juce::uint64 excludedCores = 0;
+    // Flush-to-zero / denormals-are-zero
+    bool flushDenormals = true;
+
+    struct Status
+    {
+        bool priorityApplied = true;
+        bool affinityApplied = true;
+        bool denormalsApplied = true;
+        juce::String description;   // what the thread runs with, or what failed
+
+        bool wasApplied() const {return priorityApplied and affinityApplied and denormalsApplied;}
+    };
+
+    // Applies the policy to the calling thread and checks the result
+    Status applyToCurrentThread() const;
+
+    // "0-3,6" <-> bit mask
+    static juce::uint64 parseCoreList(const juce::String& list);
+    static juce::String toCoreList(juce::uint64 cores);
+    static juce::String toString(Priority priority);
+
+    // Keys workerPriority (normal/high/fifo/rr), workerRealtimePriority,
+    // workerCores, workerExcludedCores and workerFlushDenormals
+    static WorkerPolicy fromSettings(const juce::PropertySet& settings);
+
+    // HARD.settings in the application data folder, shared by all instances
+    static std::unique_ptr<juce::PropertiesFile> openUserSettings();
+};
+
+#endif /* WorkerPolicy_h */